@@ -103,6 +103,11 @@ static void analyze_field_operation(expression *e) {
     for (field *class_field = the_class->field; class_field;
         class_field = class_field->next, ++i) {
       if (strcmp(field_name, class_field->symbol_name) == 0) {
+        // inherited fields come first, see generate_class
+        for (class *c = the_class->parent; c; c = c->parent) {
+          i += c->field_count;
+        }
+
         e->field_index = i;
         e->type = copy_type(class_field->field_type);
 
@@ -228,15 +233,7 @@ static void analyze_expression(block_statement *block, expression *e) {
         break;
       }
     } else if (ltype == T_STRING && rtype == T_STRING) {
-      switch (e->operation.compare_type) {
-      case O_GT:
-      case O_GTE:
-      case O_LT:
-      case O_LTE:
-        fail("relative string comparison not supported", e);
-      default:
-        break;
-      }
+      // strings order by their bytes
     } else if (ltype != T_BOOL && rtype != T_BOOL) {
       binary_numeric_promotion(e, true);
     }
@@ -597,6 +594,7 @@ static void analyze_expression(block_statement *block, expression *e) {
     ternary_numeric_promotion(e);
   } break;
   case O_BLOCKREF:
+  case O_BOUNDS_CHECK:
   case O_GET_LENGTH:
   case O_INSTANCEOF:
   case O_SET_LENGTH:
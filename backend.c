@@ -1,539 +1,1147 @@
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include "xalloc.h"
 #include "backend.h"
+#include "optimize.h"
+#include "llvm-backend/layout.h"
+#include "llvm-backend/runtime.h"
+#include "out/lib/runtime-header.h"
 
-static void w(FILE *file, char *string) {
+// Emits the program as C, for compilers other than LLVM: `cc -O2` or tcc build
+// it along with the runtime harness. The code system is one function, so the
+// program is too: a main with a label per block, where the parameters of each
+// block are locals it reads when it starts. A jump to a known block assigns
+// them directly and uses plain goto. A continuation that's only known at run
+// time is a label address, which receives its arguments through the pass
+// slots and gets there with a computed goto.
+//
+// Objects use the layouts and metastructs of the LLVM backend, so the harness
+// and its collector treat them exactly as they treat the objects of compiled
+// programs.
+
+// the declarations every program needs besides llvm-backend/runtime.h, which
+// comes first
+static const char prelude[] =
+  "#include <stdbool.h>\n"
+  "#include <stdint.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <string.h>\n"
+  "\n"
+  "// a block argument on its way through a computed goto\n"
+  "union value {\n"
+  "  bool b;\n"
+  "  uint8_t u8;\n"
+  "  int8_t s8;\n"
+  "  uint16_t u16;\n"
+  "  int16_t s16;\n"
+  "  uint32_t u32;\n"
+  "  int32_t s32;\n"
+  "  uint64_t u64;\n"
+  "  int64_t s64;\n"
+  "  float f32;\n"
+  "  double f64;\n"
+  "  long double f128;\n"
+  "  void *p;\n"
+  "};\n"
+  "\n"
+  "extern struct metastruct array_meta[];\n"
+  "extern int unreachable;\n"
+  "extern uint8_t *bear_heap_cursor, *bear_heap_limit;\n"
+  "uint8_t *bear_new(struct metastruct *mts, uint32_t storecount, void **ptr);\n"
+  "uint8_t *bear_new_array(uint64_t element_size, uint8_t kind, uint64_t length,\n"
+  "    uint32_t storecount, void **ptr);\n"
+  "uint8_t *bear_string_concat(uint8_t **parts, uint64_t count,\n"
+  "    uint32_t storecount, void **ptr);\n"
+  "uint8_t *bear_string_append(uint8_t **parts, uint64_t count,\n"
+  "    uint32_t storecount, void **ptr);\n"
+  "bool bear_streq(uint8_t *a, uint8_t *b);\n"
+  "int32_t bear_strcmp(uint8_t *a, uint8_t *b);\n"
+  "void bear_bounds_fail(uint64_t index, uint64_t length);\n"
+  "void bear_range_fail(uint64_t start, uint64_t end, uint64_t length);\n"
+  "\n"
+  "static inline uint64_t array_length(uint8_t *array) {\n"
+  "  return *(uint64_t*) array;\n"
+  "}\n"
+  "\n"
+  "static inline uint64_t string_length(uint8_t *string) {\n"
+  "  return *(uint64_t*) string & ~STRING_FLAGS;\n"
+  "}\n"
+  "\n"
+  "static inline uint8_t *string_data(uint8_t *string) {\n"
+  "  if (*(uint64_t*) string & STRING_SLICE_BIT) {\n"
+  "    return ((struct slice*) string)->data;\n"
+  "  }\n"
+  "  return string + 8;\n"
+  "}\n"
+  "\n"
+  "static inline void check_index(uint64_t index, uint64_t length) {\n"
+  "  if (__builtin_expect(index >= length, 0)) {\n"
+  "    bear_bounds_fail(index, length);\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "// the start of count bytes at start, after checking they fit\n"
+  "static inline uint8_t *array_range(uint8_t *array, uint64_t start,\n"
+  "    uint64_t count) {\n"
+  "  uint64_t length = array_length(array);\n"
+  "  if (__builtin_expect(start + count > length, 0)) {\n"
+  "    bear_range_fail(start, start + count, length);\n"
+  "  }\n"
+  "  return array + 8 + start;\n"
+  "}\n"
+  "\n"
+  "// the inline bump of the LLVM backend, falling back on bear_new\n"
+  "static inline uint8_t *new_object(struct metastruct *meta, uint32_t count,\n"
+  "    void **roots) {\n"
+  "  uint64_t size = 8 + ((meta->length + 7) & ~(uint64_t) 7);\n"
+  "  uint8_t *object;\n"
+  "  if (bear_heap_cursor != 0 &&\n"
+  "      (uint64_t) (bear_heap_limit - bear_heap_cursor) >= size) {\n"
+  "    uint8_t *header = bear_heap_cursor;\n"
+  "    bear_heap_cursor += size;\n"
+  "    *(uintptr_t*) header = (uintptr_t) meta | (uintptr_t) unreachable;\n"
+  "    object = header + 8;\n"
+  "  } else {\n"
+  "    object = bear_new(meta, count, roots);\n"
+  "  }\n"
+  "  // every field is stored before it is read, but the collector may look first\n"
+  "  memset(object, 0, meta->length);\n"
+  "  return object;\n"
+  "}\n";
+
+static void w(FILE *file, const char *string) {
   fputs(string, file);
 }
 
-static void wb(FILE *file, char *bytes, size_t size) {
-  fwrite(bytes, sizeof(char), size, file);
+static void wc(FILE *file, char chr) {
+  fputc(chr, file);
 }
 
-#define wbin(file, info, index, op) do {\
-  wt(file, info->type, "instruction", index, true);\
-  wf(file, " = ");\
-  wf(file, "instruction_");\
-  wi(file, info->parameters[0]);\
-  w(file, op);\
-  wf(file, "instruction_");\
-  wi(file, info->parameters[1]);\
-} while (0);
+// the local that holds value k of block i
+static void wv(FILE *file, size_t i, size_t k) {
+  fprintf(file, "v%zu_%zu", i, k);
+}
 
-#define wbinf(file, info, index, op) do {\
-  wt(file, info->type, "instruction", index, true);\
-  wf(file, " = ");\
-  wf(file, "instruction_");\
-  wi(file, info->parameters[0]);\
-  wf(file, op);\
-  wf(file, "instruction_");\
-  wi(file, info->parameters[1]);\
-} while (0);
+static void unsupported(const char *what) {
+  fprintf(stderr, "cub: the C backend does not support %s\n", what);
+  exit(1);
+}
 
-static void wc(FILE *file, char chr) {
-  char buf[1];
-  buf[0] = chr;
-  wb(file, buf, 1);
-}
-
-#define wf(file, v) do {\
-  fwrite(v, sizeof(char), sizeof(v) - 1, file);\
-} while (0);
-
-static void wi(FILE *file, size_t value) {
-  fprintf(file, "%zu", value);
-}
-
-static void wt(FILE *file, type *t, char *name_type, size_t i, bool constant) {
-  char *type = "void";
-  if (t) {
-    switch (t->type) {
-    case T_ARRAY:
-      fprintf(stderr, "array type not implemented\n");
-      exit(1);
-    case T_BLOCKREF:
-      wf(file, "void (*");
-      if (name_type) {
-        w(file, name_type);
-        wc(file, '_');
-        wi(file, i);
-      }
-      wf(file, ")(");
-      argument *arg = t->blocktype;
-      if (arg) {
-        wt(file, arg->argument_type, NULL, 0, true);
-        arg = arg->next;
-        for (; arg; arg = arg->next) {
-          wf(file, ", ");
-          wt(file, arg->argument_type, NULL, 0, true);
-        }
-      }
-      wc(file, ')');
-      return;
-    case T_BOOL: type = "bool"; break;
-    case T_F32: type = "float"; break;
-    case T_F64: type = "double"; break;
-    case T_F128: type = "long double"; break;
-    case T_OBJECT:
-      w(file, "struct_");
-      wi(file, t->struct_index);
-      wc(file, '*');
-      if (name_type) {
-        wc(file, ' ');
-        w(file, name_type);
-        wc(file, '_');
-        wi(file, i);
-      }
-      return;
-    case T_REF:
-      abort();
-    case T_S8: type = "int8_t"; break;
-    case T_S16: type = "int16_t"; break;
-    case T_S32: type = "int32_t"; break;
-    case T_S64: type = "int64_t"; break;
-    case T_STRING: type = "char*"; break;
-    case T_U8: type = "uint8_t"; break;
-    case T_U16: type = "uint16_t"; break;
-    case T_U32: type = "uint32_t"; break;
-    case T_U64: type = "uint64_t"; break;
-    case T_VOID: type = "void"; break;
-    }
+static const char *c_type(type *t) {
+  switch (t->type) {
+  case T_ARRAY:
+  case T_STRING:
+    // both are a 64-bit length followed by the contents, see the harness
+    return "uint8_t*";
+  case T_BLOCKREF: return "void*";
+  case T_BOOL: return "bool";
+  case T_F32: return "float";
+  case T_F64: return "double";
+  case T_F128: return "long double";
+  case T_S8: return "int8_t";
+  case T_S16: return "int16_t";
+  case T_S32: return "int32_t";
+  case T_S64: return "int64_t";
+  case T_U8: return "uint8_t";
+  case T_U16: return "uint16_t";
+  case T_U32: return "uint32_t";
+  case T_U64: return "uint64_t";
+  case T_VOID: return "void";
+  case T_OBJECT:
+  case T_REF:
+  default:
+    abort();
   }
-  if (constant) {
-    wf(file, "const ");
+}
+
+static void wt(FILE *file, type *t) {
+  if (t == NULL) {
+    w(file, "void");
+  } else if (t->type == T_OBJECT) {
+    fprintf(file, "struct struct_%zu*", t->struct_index);
+  } else {
+    w(file, c_type(t));
+  }
+}
+
+// the integer type of the same width, with the given signedness
+static const char *int_type(type *t, bool is_signed) {
+  switch (t->type) {
+  case T_BOOL: return "bool";
+  case T_S8:
+  case T_U8: return is_signed ? "int8_t" : "uint8_t";
+  case T_S16:
+  case T_U16: return is_signed ? "int16_t" : "uint16_t";
+  case T_S32:
+  case T_U32: return is_signed ? "int32_t" : "uint32_t";
+  case T_S64:
+  case T_U64: return is_signed ? "int64_t" : "uint64_t";
+  default:
+    abort();
   }
-  w(file, type);
-  if (name_type) {
-    wc(file, ' ');
-    w(file, name_type);
-    wc(file, '_');
-    wi(file, i);
+}
+
+// the member of union value that carries t
+static const char *pass_field(type *t) {
+  switch (t->type) {
+  case T_BOOL: return "b";
+  case T_U8: return "u8";
+  case T_S8: return "s8";
+  case T_U16: return "u16";
+  case T_S16: return "s16";
+  case T_U32: return "u32";
+  case T_S32: return "s32";
+  case T_U64: return "u64";
+  case T_S64: return "s64";
+  case T_F32: return "f32";
+  case T_F64: return "f64";
+  case T_F128: return "f128";
+  default: return "p";
   }
 }
 
-void backend_write(code_system *system, FILE *out) {
-  wf(out,
-    "#include <stdint.h>\n"
-    "#include <stdio.h>\n"
-    "#include <stdlib.h>\n\n"
-    "typedef enum {false, true} bool;\n");
+static bool is_gc_able(type *t) {
+  return t != NULL && (t->type == T_OBJECT || t->type == T_ARRAY ||
+    t->type == T_STRING);
+}
 
-  if (system->struct_count) {
-    wc(out, '\n');
+static bool is_stack_allocation(code_instruction *ins) {
+  return (ins->operation.type == O_NEW || ins->operation.type == O_NEW_ARRAY)
+    && ins->operation.allocation_type == O_STACK;
+}
+
+// the length of a stack array, which allocate_on_stack made sure is a literal
+static uint64_t stack_array_length(code_block *block, code_instruction *ins) {
+  code_instruction *length =
+    &block->instructions[ins->parameters[0] - block->parameter_count];
+  switch (length->type->type) {
+  case T_U8: return length->value_u8;
+  case T_U16: return length->value_u16;
+  case T_U32: return length->value_u32;
+  case T_U64: return length->value_u64;
+  default: abort();
+  }
+}
+
+// whether the tail jumps to blocks it names directly
+static bool is_static_tail(code_block *block) {
+  size_t count = block->system->block_count;
+  switch (block->tail.type) {
+  case GOTO:
+    return static_target(block, block->tail.first_block) < count;
+  case BRANCH:
+    return static_target(block, block->tail.first_block) < count &&
+      static_target(block, block->tail.second_block) < count;
+  }
+  return false;
+}
 
-    for (size_t i = 0; i < system->struct_count; i++) {
-      wf(out, "typedef struct struct_");
-      wi(out, i);
-      wf(out, " struct_");
-      wi(out, i);
-      wf(out, ";\n");
+// whether the block reference at value needs the address of its label, rather
+// than only naming the target of a jump
+static bool is_dynamic_ref(code_block *block, size_t value) {
+  struct use_data use = {.value = value, .found = false};
+  for (size_t j = value - block->parameter_count + 1;
+      j < block->instruction_count; j++) {
+    each_operand(&block->instructions[j], find_use, &use);
+  }
+  if (block->is_final) {
+    return use.found;
+  }
+  for (size_t p = 0; p < block->tail.parameter_count; p++) {
+    use.found = use.found || block->tail.parameters[p] == value;
+  }
+  return use.found || (!is_static_tail(block) &&
+    (block->tail.first_block == value ||
+     (block->tail.type == BRANCH && block->tail.second_block == value)));
+}
+
+// whether instruction j of the block gets a local
+static bool has_value(code_block *block, size_t j) {
+  code_instruction *ins = &block->instructions[j];
+  switch (ins->operation.type) {
+  case O_BOUNDS_CHECK:
+  case O_SET_FIELD:
+  case O_SET_INDEX:
+    return false;
+  case O_BLOCKREF:
+    return is_dynamic_ref(block, j + block->parameter_count);
+  default:
+    return ins->type != NULL && !is_void(ins->type);
+  }
+}
+
+static void write_structs(code_system *system, struct layout *layouts,
+    FILE *out) {
+  // a metastruct can point at its parent's, which may come later
+  for (size_t i = 0; i < system->struct_count; i++) {
+    fprintf(out, "struct struct_%zu;\n", i);
+    fprintf(out, "static struct metastruct meta_%zu;\n", i);
+  }
+
+  for (size_t i = 0; i < system->struct_count; i++) {
+    code_struct *str = get_code_struct(system, i);
+    struct layout *layout = &layouts[i];
+
+    // in layout order, which C pads exactly as LLVM does
+    fprintf(out, "\nstruct struct_%zu {\n", i);
+    for (size_t p = 0; p < str->field_count; p++) {
+      size_t f = layout->order[p];
+      w(out, "  ");
+      wt(out, str->fields[f].field_type);
+      fprintf(out, " field_%zu;\n", f);
+    }
+    if (str->field_count == 0) {
+      w(out, "  char empty;\n");
     }
+    w(out, "};\n");
 
-    wc(out, '\n');
+    // the header keeps the mark in the low bits of this address
+    fprintf(out, "static struct metastruct meta_%zu __attribute__((aligned(8)))"
+      " = {%lu, %zu, %lu, %zu, %zu, %lu, %zu, ", i, layout->size, i,
+      layout->refs, layout->object_refs, layout->string_refs, layout->narrow,
+      layout->narrow_refs);
+    if (str->has_parent) {
+      fprintf(out, "&meta_%zu};\n", str->parent_index);
+    } else {
+      w(out, "NULL};\n");
+    }
+  }
+}
 
-    for (size_t i = 0; i < system->struct_count; i++) {
-      code_struct *str = get_code_struct(system, i);
-
-      wf(out, "\nstruct struct_");
-      wi(out, i);
-      wf(out, " {\n");
-      for (size_t j = 0; j < str->field_count; j++) {
-        code_field *field = &str->fields[j];
-        wf(out, "  ");
-        wt(out, field->field_type, "field", j, false);
-        wf(out, ";\n");
+// one constant per distinct literal, laid out like a static heap string
+static void write_literals(code_system *system, FILE *out) {
+  for (size_t n = 0; n < system->string_count; n++) {
+    char *value = system->strings[n];
+    size_t length = strlen(value);
+    fprintf(out, "static const struct {\n  uint64_t length;\n"
+      "  uint8_t data[%zu];\n} str_%zu = {0x%lxu, \"", length + 1, n,
+      (uint64_t) length | STRING_STATIC);
+    for (char *s = value; *s; s++) {
+      char c = *s;
+      if (c >= 32 && c <= 126 && c != '"' && c != '\\' && c != '?') {
+        wc(out, c);
+      } else {
+        fprintf(out, "\\%03hho", (unsigned char) c);
       }
-      wf(out, "};\n");
     }
+    w(out, "\"};\n");
+  }
+
+  // the runtime seeds its intern table with these, see bear_string_intern
+  fprintf(out, "\nconst uint64_t bear_literal_count = %zu;\n",
+    system->string_count);
+  w(out, "uint8_t *bear_literals[] = {");
+  for (size_t n = 0; n < system->string_count; n++) {
+    fprintf(out, "%s(uint8_t*) &str_%zu", n ? ", " : "", n);
+  }
+  if (system->string_count == 0) {
+    w(out, "0");
+  }
+  w(out, "};\n");
+}
+
+static void write_natives(code_system *system, FILE *out) {
+  size_t natid = 0, natcap = 10;
+  char **natives = malloc(natcap * sizeof(char*));
+  if (natives == NULL) {
+    fputs("alloc failed\n", stderr);
+    exit(1);
   }
 
-  wf(out, "\n\n");
   for (size_t i = 0; i < system->block_count; i++) {
     code_block *block = get_code_block(system, i);
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type != O_NATIVE || is_bulk_native(ins->native_call)) {
+        continue;
+      }
 
-    wf(out, "static void block_");
-    wi(out, i);
-    wc(out, '(');
+      // anything not from the harness is libc's, like exit, and the prelude's
+      // headers already declare it with its real signature
+      char *name = ins->native_call;
+      if (strncmp(name, "bear_", 5) != 0) {
+        continue;
+      }
+      bool found = false;
+      for (size_t n = 0; n < natid && !found; n++) {
+        found = strcmp(name, natives[n]) == 0;
+      }
+      if (found) {
+        continue;
+      }
+      if (natid >= natcap) {
+        natives = realloc(natives, (natcap <<= 1) * sizeof(char*));
+      }
+      natives[natid++] = name;
 
-    size_t params = block->parameter_count;
-    if (params) {
-      code_field *field = &block->parameters[0];
-      wt(out, field->field_type, NULL, 0, true);
+      wt(out, ins->type);
+      fprintf(out, " %s(", name);
+      size_t count = ins->parameters[0];
+      for (size_t p = 1; p <= count; p++) {
+        if (p != 1) {
+          w(out, ", ");
+        }
+        wt(out, instruction_type(block, ins->parameters[p]));
+      }
+      w(out, count ? ");\n" : "void);\n");
+    }
+  }
 
-      for (size_t j = 1; j < params; j++) {
-        field = &block->parameters[j];
+  free(natives);
+}
+
+// writes the roots array an allocation at instruction j hands the collector:
+// every GC-able value defined before it, strings tagged the way the collector
+// expects. Returns how many there are.
+static size_t write_roots(code_block *block, size_t i, size_t j, FILE *out) {
+  size_t count = 0;
+  for (size_t v = 0; v < block->parameter_count + j; v++) {
+    // stores carry the type they store, but no value
+    size_t at = v - block->parameter_count;
+    if (v >= block->parameter_count && (!has_value(block, at) ||
+        block->instructions[at].operation.type == O_LITERAL)) {
+      continue;
+    }
+    type *t = instruction_type(block, v);
+    if (!is_gc_able(t)) {
+      continue;
+    }
+    w(out, count ? ", " : "void *roots[] = {");
+    if (t->type == T_STRING) {
+      w(out, "(void*) ((uintptr_t) ");
+      wv(out, i, v);
+      w(out, " | 1)");
+    } else {
+      wv(out, i, v);
+    }
+    count++;
+  }
+  if (count) {
+    w(out, "};\n    ");
+  }
+  return count;
+}
+
+static void write_roots_arg(size_t count, FILE *out) {
+  fprintf(out, "%zu, %s", count, count ? "roots" : "0");
+}
 
-        wf(out, ", ");
-        wt(out, field->field_type, NULL, 0, true);
+// the address of element b of array or string a, as an lvalue
+static void write_element(FILE *out, code_block *block, size_t i,
+    code_instruction *ins, type *element) {
+  size_t *ip = ins->parameters;
+  if (instruction_type(block, ip[0])->type == T_STRING) {
+    w(out, "string_data(");
+    wv(out, i, ip[0]);
+    w(out, ")[");
+  } else {
+    w(out, "((");
+    wt(out, element);
+    w(out, "*) (");
+    wv(out, i, ip[0]);
+    w(out, " + 8))[");
+  }
+  wv(out, i, ip[1]);
+  wc(out, ']');
+}
+
+static void write_length(FILE *out, code_block *block, size_t i,
+    size_t value) {
+  bool is_string = instruction_type(block, value)->type == T_STRING;
+  w(out, is_string ? "string_length(" : "array_length(");
+  wv(out, i, value);
+  wc(out, ')');
+}
+
+// bulk operations on u8 arrays from lib/core.cub and the loop idiom pass
+static void write_intrinsic(FILE *out, size_t i, size_t k,
+    code_instruction *ins) {
+  size_t *ip = ins->parameters;
+  const char *name = ins->native_call;
+
+  if (strcmp(name, "bear_array_fill") == 0) {
+    // (dest, start, count, value)
+    w(out, "memset(array_range(");
+    wv(out, i, ip[1]);
+    w(out, ", (uint64_t) ");
+    wv(out, i, ip[2]);
+    w(out, ", (uint64_t) ");
+    wv(out, i, ip[3]);
+    w(out, "), ");
+    wv(out, i, ip[4]);
+    w(out, ", (uint64_t) ");
+    wv(out, i, ip[3]);
+    wc(out, ')');
+    return;
+  }
+
+  // (dest, destStart, src, srcStart, count) and
+  // (left, leftStart, right, rightStart, count), checked in that order
+  w(out, "{\n    uint8_t *dst = array_range(");
+  wv(out, i, ip[1]);
+  w(out, ", (uint64_t) ");
+  wv(out, i, ip[2]);
+  w(out, ", (uint64_t) ");
+  wv(out, i, ip[5]);
+  w(out, ");\n    uint8_t *src = array_range(");
+  wv(out, i, ip[3]);
+  w(out, ", (uint64_t) ");
+  wv(out, i, ip[4]);
+  w(out, ", (uint64_t) ");
+  wv(out, i, ip[5]);
+  w(out, ");\n    ");
+  if (strcmp(name, "bear_array_copy") == 0) {
+    // the ranges may overlap when both are the same array
+    w(out, "memmove(dst, src, (uint64_t) ");
+  } else {
+    wv(out, i, k);
+    w(out, " = memcmp(dst, src, (uint64_t) ");
+  }
+  wv(out, i, ip[5]);
+  w(out, ");\n  }");
+}
+
+static void write_cast(FILE *out, code_block *block, size_t i, size_t k,
+    code_instruction *ins) {
+  type *from = instruction_type(block, ins->parameters[0]);
+  if (ins->operation.cast_type == O_REINTERPRET) {
+    // the same bits as another type
+    w(out, "memcpy(&");
+    wv(out, i, k);
+    w(out, ", &");
+    wv(out, i, ins->parameters[0]);
+    w(out, ", sizeof(");
+    wv(out, i, k);
+    w(out, "))");
+    return;
+  }
+
+  wv(out, i, k);
+  w(out, " = (");
+  wt(out, ins->type);
+  w(out, ") ");
+  switch (ins->operation.cast_type) {
+  case O_SIGN_EXTEND:
+    fprintf(out, "(%s) ", int_type(from, true));
+    break;
+  case O_ZERO_EXTEND:
+    fprintf(out, "(%s) ", int_type(from, false));
+    break;
+  default:
+    // C converts the rest as LLVM does
+    break;
+  }
+  wv(out, i, ins->parameters[0]);
+}
+
+static void write_compare(FILE *out, code_block *block, size_t i, size_t k,
+    code_instruction *ins) {
+  size_t *ip = ins->parameters;
+  const char *op;
+  switch (ins->operation.compare_type) {
+  case O_EQ: op = " == "; break;
+  case O_GT: op = " > "; break;
+  case O_GTE: op = " >= "; break;
+  case O_LT: op = " < "; break;
+  case O_LTE: op = " <= "; break;
+  case O_NE: op = " != "; break;
+  default: abort();
+  }
+
+  wv(out, i, k);
+  w(out, " = ");
+  if (instruction_type(block, ip[0])->type != T_STRING) {
+    wv(out, i, ip[0]);
+    w(out, op);
+    wv(out, i, ip[1]);
+    return;
+  }
+
+  switch (ins->operation.compare_type) {
+  case O_EQ:
+  case O_NE:
+    w(out, ins->operation.compare_type == O_EQ ? "bear_streq(" : "!bear_streq(");
+    wv(out, i, ip[0]);
+    w(out, ", ");
+    wv(out, i, ip[1]);
+    wc(out, ')');
+    break;
+  default:
+    w(out, "bear_strcmp(");
+    wv(out, i, ip[0]);
+    w(out, ", ");
+    wv(out, i, ip[1]);
+    wc(out, ')');
+    w(out, op);
+    wc(out, '0');
+  }
+}
+
+static void write_numeric(FILE *out, size_t i, size_t k,
+    code_instruction *ins) {
+  size_t *ip = ins->parameters;
+  const char *op;
+  switch (ins->operation.numeric_type) {
+  case O_ADD: op = " + "; break;
+  case O_BAND: op = " & "; break;
+  case O_BOR: op = " | "; break;
+  case O_BXOR: op = " ^ "; break;
+  case O_DIV: op = " / "; break;
+  case O_MOD: op = " % "; break;
+  case O_MUL: op = " * "; break;
+  case O_SUB: op = " - "; break;
+  default: abort();
+  }
+
+  wv(out, i, k);
+  w(out, " = ");
+  if (is_float(ins->type)) {
+    if (ins->operation.numeric_type == O_MOD) {
+      unsupported("floating-point remainders");
+    }
+    wv(out, i, ip[0]);
+    w(out, op);
+    wv(out, i, ip[1]);
+    return;
+  }
+
+  // computed unsigned and 64 bits wide, so it wraps instead of overflowing,
+  // and divides unsigned like the LLVM backend does
+  const char *unsigned_type = int_type(ins->type, false);
+  fprintf(out, "(%s) ((uint64_t) (%s) ", c_type(ins->type), unsigned_type);
+  wv(out, i, ip[0]);
+  fprintf(out, "%s(uint64_t) (%s) ", op, unsigned_type);
+  wv(out, i, ip[1]);
+  wc(out, ')');
+}
+
+static void write_shift(FILE *out, size_t i, size_t k, code_instruction *ins) {
+  size_t *ip = ins->parameters;
+  wv(out, i, k);
+  fprintf(out, " = (%s) ", c_type(ins->type));
+  switch (ins->operation.shift_type) {
+  case O_LSHIFT:
+    fprintf(out, "((uint64_t) (%s) ", int_type(ins->type, false));
+    wv(out, i, ip[0]);
+    w(out, " << ");
+    break;
+  case O_ASHIFT:
+    fprintf(out, "((%s) ", int_type(ins->type, true));
+    wv(out, i, ip[0]);
+    w(out, " >> ");
+    break;
+  case O_RSHIFT:
+    fprintf(out, "((%s) ", int_type(ins->type, false));
+    wv(out, i, ip[0]);
+    w(out, " >> ");
+    break;
+  default:
+    abort();
+  }
+  wv(out, i, ip[1]);
+  wc(out, ')');
+}
+
+static void write_literal(FILE *out, size_t i, size_t k,
+    code_instruction *ins) {
+  wv(out, i, k);
+  w(out, " = ");
+  switch (ins->type->type) {
+  case T_BOOL:
+    w(out, ins->value_bool ? "true" : "false");
+    break;
+  case T_OBJECT:
+    w(out, "0");
+    break;
+  case T_STRING:
+    fprintf(out, "(uint8_t*) &str_%zu", ins->string_index);
+    break;
+  case T_U8:
+    fprintf(out, "%hhu", ins->value_u8);
+    break;
+  case T_U16:
+    fprintf(out, "%hu", ins->value_u16);
+    break;
+  case T_U32:
+    fprintf(out, "%uu", ins->value_u32);
+    break;
+  case T_U64:
+    fprintf(out, "%luu", ins->value_u64);
+    break;
+  default:
+    abort();
+  }
+}
+
+static void write_new(FILE *out, code_block *block, size_t i, size_t j,
+    code_instruction *ins) {
+  size_t k = j + block->parameter_count;
+  size_t index = ins->type->struct_index;
+
+  if (ins->operation.allocation_type == O_STACK) {
+    // a stack slot is never on a page or in the chain, so it is never freed
+    fprintf(out, "stack_%zu_%zu.header = (uintptr_t) &meta_%zu | "
+      "(uintptr_t) unreachable;\n  memset(&stack_%zu_%zu.object, 0, "
+      "sizeof(stack_%zu_%zu.object));\n  ", i, k, index, i, k, i, k);
+    wv(out, i, k);
+    fprintf(out, " = &stack_%zu_%zu.object", i, k);
+    return;
+  }
+
+  w(out, "{\n    ");
+  size_t count = write_roots(block, i, j, out);
+  wv(out, i, k);
+  fprintf(out, " = (struct struct_%zu*) new_object(&meta_%zu, ", index,
+    index);
+  write_roots_arg(count, out);
+  w(out, ");\n  }");
+}
+
+static void write_new_array(FILE *out, code_block *block, size_t i, size_t j,
+    code_instruction *ins) {
+  size_t k = j + block->parameter_count;
+  type *et = ins->type->arraytype;
+  int kind = et->type == T_STRING ? ARRAY_STRING
+    : is_gc_able(et) ? ARRAY_OBJECT : ARRAY_PRIMITIVE;
+
+  if (ins->operation.allocation_type == O_STACK) {
+    // elements start out zero, as on the heap
+    fprintf(out, "stack_%zu_%zu.header = (uintptr_t) &array_meta[%d] | "
+      "(uintptr_t) unreachable;\n  stack_%zu_%zu.length = %lu;\n  "
+      "memset(stack_%zu_%zu.elements, 0, sizeof(stack_%zu_%zu.elements));\n  ",
+      i, k, kind, i, k, stack_array_length(block, ins), i, k, i, k);
+    wv(out, i, k);
+    fprintf(out, " = (uint8_t*) &stack_%zu_%zu.length", i, k);
+    return;
+  }
+
+  w(out, "{\n    ");
+  size_t count = write_roots(block, i, j, out);
+  wv(out, i, k);
+  w(out, " = bear_new_array(sizeof(");
+  wt(out, et);
+  fprintf(out, "), %d, (uint64_t) ", kind);
+  wv(out, i, ins->parameters[0]);
+  w(out, ", ");
+  write_roots_arg(count, out);
+  w(out, ");\n  }");
+}
+
+static void write_concat(FILE *out, code_block *block, size_t i, size_t j,
+    code_instruction *ins) {
+  size_t k = j + block->parameter_count;
+  size_t parts = ins->parameters[0];
+
+  // the runtime treats the parts as roots too
+  w(out, "{\n    uint8_t *parts[] = {");
+  for (size_t p = 1; p <= parts; p++) {
+    if (p != 1) {
+      w(out, ", ");
+    }
+    wv(out, i, ins->parameters[p]);
+  }
+  w(out, "};\n    ");
+  size_t count = write_roots(block, i, j, out);
+  wv(out, i, k);
+  fprintf(out, " = %s(parts, %zu, ", ins->operation.concat_type == O_APPEND
+    ? "bear_string_append" : "bear_string_concat", parts);
+  write_roots_arg(count, out);
+  w(out, ");\n  }");
+}
+
+static void write_instruction(FILE *out, code_block *block, size_t i,
+    size_t j) {
+  code_instruction *ins = &block->instructions[j];
+  size_t k = j + block->parameter_count;
+  size_t *ip = ins->parameters;
+
+  switch (ins->operation.type) {
+  case O_BITWISE_NOT:
+    wv(out, i, k);
+    fprintf(out, " = (%s) ~(%s) ", c_type(ins->type),
+      int_type(ins->type, false));
+    wv(out, i, ip[0]);
+    break;
+  case O_BLOCKREF:
+    if (!has_value(block, j)) {
+      // only ever the target of a direct jump
+      return;
+    }
+    wv(out, i, k);
+    fprintf(out, " = &&entry_%zu", ins->block_index);
+    break;
+  case O_BOUNDS_CHECK:
+    // a negative signed index wraps around to a huge unsigned one
+    w(out, "check_index((uint64_t) ");
+    wv(out, i, ip[1]);
+    w(out, ", ");
+    write_length(out, block, i, ip[0]);
+    wc(out, ')');
+    break;
+  case O_CAST:
+    write_cast(out, block, i, k, ins);
+    break;
+  case O_COMPARE:
+    write_compare(out, block, i, k, ins);
+    break;
+  case O_GET_FIELD:
+    wv(out, i, k);
+    w(out, " = ");
+    wv(out, i, ip[0]);
+    fprintf(out, "->field_%zu", ip[1]);
+    break;
+  case O_GET_INDEX:
+    wv(out, i, k);
+    w(out, " = ");
+    write_element(out, block, i, ins, ins->type);
+    break;
+  case O_GET_LENGTH:
+    wv(out, i, k);
+    w(out, " = (uint32_t) ");
+    write_length(out, block, i, ip[0]);
+    break;
+  case O_GET_SYMBOL:
+    wv(out, i, k);
+    w(out, " = ");
+    wv(out, i, ip[0]);
+    break;
+  case O_LITERAL:
+    write_literal(out, i, k, ins);
+    break;
+  case O_LOGIC: {
+    const char *op;
+    switch (ins->operation.logic_type) {
+    case O_AND: op = " & "; break;
+    case O_OR: op = " | "; break;
+    case O_XOR: op = " ^ "; break;
+    default: abort();
+    }
+    wv(out, i, k);
+    w(out, " = (");
+    wv(out, i, ip[0]);
+    fprintf(out, " != 0)%s(", op);
+    wv(out, i, ip[1]);
+    w(out, " != 0)");
+  } break;
+  case O_NATIVE: {
+    if (is_bulk_native(ins->native_call)) {
+      write_intrinsic(out, i, k, ins);
+      break;
+    }
+    if (has_value(block, j)) {
+      wv(out, i, k);
+      w(out, " = ");
+    }
+    fprintf(out, "%s(", ins->native_call);
+    size_t count = ip[0];
+    for (size_t p = 1; p <= count; p++) {
+      if (p != 1) {
+        w(out, ", ");
       }
+      wv(out, i, ip[p]);
     }
+    wc(out, ')');
+  } break;
+  case O_NEGATE:
+    wv(out, i, k);
+    if (is_float(ins->type)) {
+      w(out, " = -");
+    } else {
+      fprintf(out, " = (%s) -(uint64_t) (%s) ", c_type(ins->type),
+        int_type(ins->type, false));
+    }
+    wv(out, i, ip[0]);
+    break;
+  case O_NEW:
+    write_new(out, block, i, j, ins);
+    break;
+  case O_NEW_ARRAY:
+    write_new_array(out, block, i, j, ins);
+    break;
+  case O_NOT:
+    wv(out, i, k);
+    w(out, " = !");
+    wv(out, i, ip[0]);
+    break;
+  case O_NUMERIC:
+    write_numeric(out, i, k, ins);
+    break;
+  case O_SET_FIELD:
+    wv(out, i, ip[0]);
+    fprintf(out, "->field_%zu = ", ip[1]);
+    wv(out, i, ip[2]);
+    break;
+  case O_SET_INDEX:
+    write_element(out, block, i, ins,
+      instruction_type(block, ip[0])->arraytype);
+    w(out, " = ");
+    wv(out, i, ip[2]);
+    break;
+  case O_SHIFT:
+    write_shift(out, i, k, ins);
+    break;
+  case O_STR_CONCAT:
+    write_concat(out, block, i, j, ins);
+    break;
+  case O_IDENTITY:
+    unsupported("identity checking");
+    break;
+  case O_INSTANCEOF:
+    unsupported("instanceof checking");
+    break;
+  case O_SET_LENGTH:
+    unsupported("array resizing");
+    break;
+  case O_CALL:
+  case O_FUNCTION:
+  case O_NUMERIC_ASSIGN:
+  case O_POSTFIX:
+  case O_SET_SYMBOL:
+  case O_SHIFT_ASSIGN:
+  case O_STR_CONCAT_ASSIGN:
+  case O_TERNARY:
+    abort();
+  }
+  w(out, ";\n");
+}
+
+// assigns the tail's arguments straight to the parameters of target, through
+// temporaries in case they read each other
+static void write_arguments(FILE *out, code_system *system, code_block *block,
+    size_t i, size_t target) {
+  code_block *to = get_code_block(system, target);
+  size_t count = block->tail.parameter_count;
+
+  w(out, "{\n");
+  for (size_t p = 0; p < count; p++) {
+    w(out, "    ");
+    wt(out, to->parameters[p].field_type);
+    fprintf(out, " a%zu = ", p);
+    wv(out, i, block->tail.parameters[p]);
+    w(out, ";\n");
+  }
+  for (size_t p = 0; p < count; p++) {
+    w(out, "    ");
+    wv(out, target, p);
+    fprintf(out, " = a%zu;\n", p);
+  }
+  fprintf(out, "    goto block_%zu;\n  }", target);
+}
+
+static void write_tail(FILE *out, code_system *system, code_block *block,
+    size_t i) {
+  code_terminal *tail = &block->tail;
 
-    wf(out, ");\n");
+  if (block->is_final) {
+    w(out, "  goto done;\n");
+    return;
   }
 
-  wc(out, '\n');
-  for (size_t i = 0; i < system->block_count; i++) {
-    code_block *block = get_code_block(system, i);
+  if (is_static_tail(block)) {
+    size_t first = static_target(block, tail->first_block);
+    if (tail->type == GOTO) {
+      w(out, "  ");
+      write_arguments(out, system, block, i, first);
+      wc(out, '\n');
+      return;
+    }
+
+    size_t second = static_target(block, tail->second_block);
+    w(out, "  if (");
+    wv(out, i, tail->condition);
+    w(out, ") ");
+    write_arguments(out, system, block, i, first);
+    w(out, " else ");
+    write_arguments(out, system, block, i, second);
+    wc(out, '\n');
+    return;
+  }
 
-    wf(out, "\nstatic void block_");
-    wi(out, i);
+  for (size_t p = 0; p < tail->parameter_count; p++) {
+    fprintf(out, "  pass[%zu].%s = ", p,
+      pass_field(instruction_type(block, tail->parameters[p])));
+    wv(out, i, tail->parameters[p]);
+    w(out, ";\n");
+  }
+  w(out, "  goto *");
+  if (tail->type == GOTO) {
+    wv(out, i, tail->first_block);
+  } else {
     wc(out, '(');
+    wv(out, i, tail->condition);
+    w(out, " ? ");
+    wv(out, i, tail->first_block);
+    w(out, " : ");
+    wv(out, i, tail->second_block);
+    wc(out, ')');
+  }
+  w(out, ";\n");
+}
 
-    size_t offset = block->parameter_count;
-    if (offset) {
-      code_field *field = &block->parameters[0];
-      wt(out, field->field_type, "instruction", 0, true);
+// block 0 takes no parameters and runs first
+static bool is_entered(size_t i, const bool *direct, const bool *indirect) {
+  return i == 0 || direct[i] || indirect[i];
+}
 
-      for (size_t j = 1; j < offset; j++) {
-        field = &block->parameters[j];
+// marks the blocks that the blocks reachable from the first jump to directly,
+// and the ones they take the label address of
+static void find_entries(code_system *system, bool *direct, bool *indirect) {
+  bool changed;
+  do {
+    changed = false;
+    for (size_t i = 0; i < system->block_count; i++) {
+      code_block *block = get_code_block(system, i);
+      if (!is_entered(i, direct, indirect)) {
+        continue;
+      }
 
-        wf(out, ", ");
-        wt(out, field->field_type, "instruction", j, true);
+      for (size_t j = 0; j < block->instruction_count; j++) {
+        code_instruction *ins = &block->instructions[j];
+        if (ins->operation.type == O_BLOCKREF && has_value(block, j) &&
+            !indirect[ins->block_index]) {
+          indirect[ins->block_index] = changed = true;
+        }
+      }
+      if (block->is_final || !is_static_tail(block)) {
+        continue;
+      }
+      size_t first = static_target(block, block->tail.first_block);
+      if (!direct[first]) {
+        direct[first] = changed = true;
+      }
+      if (block->tail.type == BRANCH) {
+        size_t second = static_target(block, block->tail.second_block);
+        if (!direct[second]) {
+          direct[second] = changed = true;
+        }
       }
     }
+  } while (changed);
+}
 
-    wf(out, ") {\n");
+static void write_locals(FILE *out, code_system *system, const bool *direct,
+    const bool *indirect, size_t *max_params) {
+  *max_params = 0;
+  for (size_t i = 0; i < system->block_count; i++) {
+    code_block *block = get_code_block(system, i);
+    if (!is_entered(i, direct, indirect)) {
+      continue;
+    }
+    size_t offset = block->parameter_count;
+    if (offset > *max_params) {
+      *max_params = offset;
+    }
+
+    for (size_t k = 0; k < offset; k++) {
+      w(out, "  ");
+      wt(out, block->parameters[k].field_type);
+      wc(out, ' ');
+      wv(out, i, k);
+      w(out, ";\n");
+    }
 
     for (size_t j = 0; j < block->instruction_count; j++) {
-      size_t k = j + offset;
       code_instruction *ins = &block->instructions[j];
-      wf(out, "  ");
-      switch (ins->operation.type) {
-      case O_BITWISE_NOT:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = ~instruction_");
-        wi(out, ins->parameters[0]);
-        break;
-      case O_BLOCKREF:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = &block_");
-        wi(out, ins->block_index);
-        break;
-      case O_CAST:
-        switch (ins->operation.cast_type) {
-        case O_UPCAST:
-        case O_DOWNCAST:
-          wt(out, ins->type, "instruction", k, true);
-          wf(out, " = (");
-          type t = {
-            .type = T_OBJECT,
-            .struct_index = ins->type->struct_index
-          };
-          wt(out, &t, NULL, 0, true);
-          wf(out, ") instruction_");
-          wi(out, ins->parameters[0]);
-          break;
-        case O_FLOAT_EXTEND:
-        case O_FLOAT_TRUNCATE:
-        case O_FLOAT_TO_SIGNED:
-        case O_FLOAT_TO_UNSIGNED:
-        case O_SIGNED_TO_FLOAT:
-        case O_UNSIGNED_TO_FLOAT:
-        case O_TRUNCATE:
-        case O_SIGN_EXTEND:
-        case O_ZERO_EXTEND:
-          wt(out, ins->type, "instruction", k, true);
-          wf(out, " = (");
-          wt(out, ins->type, NULL, 0, true);
-          wf(out, ") instruction_");
-          wi(out, ins->parameters[0]);
-          break;
-        case O_REINTERPRET:
-          wf(out, "union {\n    ");
-          wt(out, instruction_type(block, ins->parameters[0]), "sub", 0, false);
-          wf(out, ";\n    ");
-          wt(out, ins->type, "sub", 1, false);
-          wf(out, ";\n  } union_");
-          wi(out, k);
-          wf(out, ";\n  union_");
-          wi(out, k);
-          wf(out, ".sub0 = instruction_");
-          wi(out, ins->parameters[0]);
-          wf(out, ";\n  ");
-          wt(out, ins->type, "instruction", k, true);
-          wf(out, " = union_");
-          wi(out, k);
-          wf(out, ".sub1");
-          break;
-        }
-        break;
-      case O_COMPARE: {
-        char *op;
-        switch (ins->operation.compare_type) {
-        case O_EQ: op = " == "; break;
-        case O_GT: op = " > "; break;
-        case O_GTE: op = " >= "; break;
-        case O_LT: op = " < "; break;
-        case O_LTE: op = " <= "; break;
-        case O_NE: op = " != "; break;
-        }
-        wbin(out, ins, k, op);
-      } break;
-      case O_GET_FIELD:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = instruction_");
-        wi(out, ins->parameters[0]);
-        wf(out, "->field_");
-        wi(out, ins->parameters[1]);
-        break;
-      case O_GET_INDEX:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = instruction_");
-        wi(out, ins->parameters[0]);
-        wf(out, "[instruction_");
-        wi(out, ins->parameters[1]);
-        wc(out, ']');
-        break;
-      case O_GET_SYMBOL:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = instruction_");
-        wi(out, ins->parameters[0]);
-        break;
-      case O_IDENTITY:
-        fprintf(stderr, "this backend does not support identity checking\n");
-        exit(1);
-      case O_INSTANCEOF:
-        fprintf(stderr, "this backend does not support instanceof checking\n");
-        exit(1);
-      case O_LITERAL:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = ");
-        switch (ins->type->type) {
-        case T_ARRAY:
-        case T_BLOCKREF:
-        case T_F32:
-        case T_F64:
-        case T_F128:
-        case T_REF:
-        case T_S8:
-        case T_S16:
-        case T_S32:
-        case T_S64:
-        case T_VOID:
-          abort();
-        case T_BOOL:
-          w(out, ins->value_bool ? "true" : "false");
-          break;
-        case T_OBJECT:
-          wf(out, "null");
-          break;
-        case T_STRING: {
-          wf(out, "(const char*) \"");
-          for (char *s = ins->value_string; *s; s++) {
-            fprintf(out, "\\x%02hhx", *s);
-          }
-          wc(out, '"');
-        } break;
-        case T_U8: {
-          char buf[5];
-          snprintf(buf, 5, "0x%02hhx", ins->value_u8);
-          wf(out, buf);
-        } break;
-        case T_U16: {
-          char buf[7];
-          snprintf(buf, 7, "0x%04hx", ins->value_u16);
-          wf(out, buf);
-        } break;
-        case T_U32: {
-          char buf[11];
-          snprintf(buf, 11, "0x%08x", ins->value_u32);
-          wf(out, buf);
-        } break;
-        case T_U64: {
-          char buf[19];
-          snprintf(buf, 19, "0x%016lx", ins->value_u64);
-          wf(out, buf);
-        } break;
-        }
-        break;
-      case O_LOGIC:
-        abort();
-        /*switch (ins->operation.logic_type) {
-        case O_AND: wbinf(out, ins, k, " && "); break;
-        case O_OR: wbinf(out, ins, k, " || "); break;
-        case O_XOR: wbinf(out, ins, k, " != "); break;
-        }
-        break;*/
-      case O_NATIVE: {
-        if (!is_void(ins->type)) {
-          wt(out, ins->type, "instruction", k, true);
-          wf(out, " = ");
-        }
-        w(out, ins->native_call);
-        wc(out, '(');
-
-        size_t count = ins->parameters[0];
-        if (count) {
-          wf(out, "instruction_");
-          wi(out, ins->parameters[1]);
-          for (size_t offset = 2; offset <= count; offset++) {
-            wf(out, ", instruction_");
-            wi(out, ins->parameters[offset]);
-          }
-        }
-        wc(out, ')');
-      } break;
-      case O_NEGATE:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = -instruction_");
-        wi(out, ins->parameters[0]);
-        break;
-      case O_NEW:
-        wf(out, "struct_");
-        wi(out, ins->type->struct_index);
-        wf(out, " instruction_");
-        wi(out, k);
-        wf(out, "_src;\n  ")
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = &instruction_");
-        wi(out, k);
-        wf(out, "_src");
-        // awww yeah memory leaks XD
-        // wf(out, " = malloc(sizeof(*instruction_");
-        // wi(out, k);
-        // wf(out, "))");
-        break;
-      case O_NEW_ARRAY:
-        fprintf(stderr, "array allocation not supported by this backend\n");
-        exit(1);
-
-        // but if it were, you'd look at parameters[0] to get the size of the
-        // array
-
-      case O_NOT:
-        wt(out, ins->type, "instruction", k, true);
-        wf(out, " = !instruction_");
-        wi(out, ins->parameters[0]);
-        break;
-      case O_NUMERIC: {
-        switch (ins->operation.numeric_type) {
-        case O_ADD: wbinf(out, ins, k, " + "); break;
-        case O_BAND: wbinf(out, ins, k, " & "); break;
-        case O_BOR: wbinf(out, ins, k, " | "); break;
-        case O_BXOR: wbinf(out, ins, k, " ^ "); break;
-        case O_DIV: wbinf(out, ins, k, " / "); break;
-        case O_MOD: wbinf(out, ins, k, " % "); break;
-        case O_MUL: wbinf(out, ins, k, " * "); break;
-        case O_SUB: wbinf(out, ins, k, " - "); break;
-        }
-      } break;
-      case O_SET_FIELD:
-        wf(out, "instruction_");
-        wi(out, ins->parameters[0]);
-        wf(out, "->field_");
-        wi(out, ins->parameters[1]);
-        wf(out, " = instruction_");
-        wi(out, ins->parameters[2]);
-        break;
-      case O_SET_INDEX:
-        wf(out, "instruction_");
-        wi(out, ins->parameters[0]);
-        wf(out, "[instruction_");
-        wi(out, ins->parameters[1]);
-        wf(out, "] = instruction_");
-        wi(out, ins->parameters[2]);
-        break;
-      case O_SHIFT:
-        switch (ins->operation.shift_type) {
-        case O_LSHIFT:
-          wbinf(out, ins, k, " << ");
-          break;
-        case O_ASHIFT:
-        case O_RSHIFT: {
-          type *left_type = instruction_type(block, ins->parameters[0]);
-          wt(out, ins->type, "instruction", k, true);
-          wf(out, " = ");
-          if (ins->operation.shift_type == O_ASHIFT) {
-            switch (left_type->type) {
-            case T_U8: wf(out, "(int8_t) "); break;
-            case T_U16: wf(out, "(int16_t) "); break;
-            case T_U32: wf(out, "(int32_t) "); break;
-            case T_U64: wf(out, "(int64_t) "); break;
-            default: break;
-            }
-          } else {
-            switch (left_type->type) {
-            case T_S8: wf(out, "(uint8_t) "); break;
-            case T_S16: wf(out, "(uint16_t) "); break;
-            case T_S32: wf(out, "(uint32_t) "); break;
-            case T_S64: wf(out, "(uint64_t) "); break;
-            default: break;
-            }
-          }
-          wf(out, "instruction_");
-          wi(out, ins->parameters[0]);
-          wf(out, " >> instruction_")
-          wi(out, ins->parameters[1]);
-        } break;
+      size_t k = j + offset;
+      if (has_value(block, j)) {
+        w(out, "  ");
+        if (ins->operation.type == O_LITERAL && ins->type->type == T_OBJECT) {
+          // null, which converts to whatever object type it's used as
+          w(out, "void*");
+        } else {
+          wt(out, ins->type);
         }
-        break;
-      case O_STR_CONCAT:
-        fprintf(stderr, "this backend does not support string concatenation\n");
-        exit(1);
-      case O_CALL:
-      case O_FUNCTION:
-      case O_NUMERIC_ASSIGN:
-      case O_POSTFIX:
-      case O_SET_SYMBOL:
-      case O_SHIFT_ASSIGN:
-      case O_STR_CONCAT_ASSIGN:
-      case O_TERNARY:
-        abort();
+        wc(out, ' ');
+        wv(out, i, k);
+        w(out, ";\n");
+      }
+
+      // one slot per stack allocation site, see allocate_on_stack: a header
+      // followed by the object
+      if (!is_stack_allocation(ins)) {
+        continue;
+      }
+      if (ins->operation.type == O_NEW) {
+        fprintf(out, "  struct {\n    uintptr_t header;\n    "
+          "struct struct_%zu object;\n  } stack_%zu_%zu;\n",
+          ins->type->struct_index, i, k);
+      } else {
+        uint64_t length = stack_array_length(block, ins);
+        w(out, "  struct {\n    uintptr_t header;\n    uint64_t length;\n    ");
+        wt(out, ins->type->arraytype);
+        fprintf(out, " elements[%lu];\n  } stack_%zu_%zu;\n",
+          length ? length : 1, i, k);
       }
-      wf(out, ";\n");
     }
+  }
+}
 
-    printf("block tail %zu\n", i);
-    if (!block->is_final) {
-      wf(out, "  ");
-      switch (block->tail.type) {
-      case GOTO: {
-        wf(out, "instruction_");
-        wi(out, block->tail.first_block);
-        wc(out, '(');
-        size_t params = block->tail.parameter_count;
-        if (params) {
-          wf(out, "instruction_");
-          wi(out, block->tail.parameters[0]);
-
-          for (size_t i = 1; i < params; i++) {
-            wf(out, ", instruction_");
-            wi(out, block->tail.parameters[i]);
-          }
-        }
-        wc(out, ')');
-      } break;
-      case BRANCH: {
-        wf(out, "(instruction_");
-        wi(out, block->tail.condition);
-        wf(out, " ? instruction_");
-        wi(out, block->tail.first_block);
-        wf(out, " : instruction_");
-        wi(out, block->tail.second_block);
-        wf(out, ")(");
-        size_t params = block->tail.parameter_count;
-        if (params) {
-          wf(out, "instruction_");
-          wi(out, block->tail.parameters[0]);
-
-          for (size_t i = 1; i < params; i++) {
-            wf(out, ", instruction_");
-            wi(out, block->tail.parameters[i]);
-          }
-        }
-        wc(out, ')');
-      } break;
+void backend_write_c(code_system *system, FILE *out) {
+  if (compressed_refs) {
+    unsupported("compressed references");
+  }
+
+  struct layout *layouts = layout_structs(system);
+  size_t count = system->block_count;
+
+  fwrite(llvm_backend_runtime_h, 1, llvm_backend_runtime_h_len, out);
+  w(out, "\n");
+  w(out, prelude);
+  w(out, "\n");
+  write_structs(system, layouts, out);
+  w(out, "\n");
+  write_natives(system, out);
+  w(out, "\n");
+  write_literals(system, out);
+
+  // which blocks are entered by name, and which through a label address
+  bool *direct = calloc(count, sizeof(bool));
+  bool *indirect = calloc(count, sizeof(bool));
+  if (direct == NULL || indirect == NULL) {
+    fputs("alloc failed\n", stderr);
+    exit(1);
+  }
+  find_entries(system, direct, indirect);
+
+  w(out, "\nint main(void) {\n");
+  size_t max_params;
+  write_locals(out, system, direct, indirect, &max_params);
+  fprintf(out, "  union value pass[%zu];\n", max_params ? max_params : 1);
+
+  for (size_t i = 0; i < count; i++) {
+    code_block *block = get_code_block(system, i);
+
+    wc(out, '\n');
+    if (indirect[i]) {
+      fprintf(out, "entry_%zu:\n", i);
+      for (size_t p = 0; p < block->parameter_count; p++) {
+        w(out, "  ");
+        wv(out, i, p);
+        fprintf(out, " = pass[%zu].%s;\n", p,
+          pass_field(block->parameters[p].field_type));
       }
-      wf(out, ";\n");
+    }
+    if (direct[i]) {
+      fprintf(out, "block_%zu:\n", i);
+    }
+    if (!is_entered(i, direct, indirect)) {
+      continue;
     }
 
-    wf(out, "}\n");
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      if (block->instructions[j].operation.type == O_BLOCKREF &&
+          !has_value(block, j)) {
+        continue;
+      }
+      w(out, "  ");
+      write_instruction(out, block, i, j);
+    }
+    write_tail(out, system, block, i);
   }
 
-  wf(out, "\n\n"
-    "int main() {\n"
-    "  block_0();\n"
-    "  return 0;\n"
-    "}\n");
+  w(out, "\ndone:\n  return 0;\n}\n");
+
+  free(direct);
+  free(indirect);
+  free_layouts(system, layouts);
 }
@@ -5,6 +5,25 @@
 
 #include "generate.h"
 
+// object fields hold 32-bit offsets into one heap region the runtime reserves,
+// instead of full pointers; only the LLVM backend supports this
+extern bool compressed_refs;
+
 void backend_write(code_system*, FILE *out);
 
+// writes the program as C, to build along with the harness
+void backend_write_c(code_system*, FILE *out);
+
+// writes x86-64 machine code straight to an object file, without optimizing,
+// for quick debug builds
+void backend_write_x86(code_system*, const char *filename);
+
+// optimizes and compiles to an object file in-process; only the LLVM backend
+// supports this
+void backend_write_object(code_system*, const char *filename);
+
+// compiles and runs the program in this process, returning its exit status;
+// only the LLVM backend supports this
+int backend_run(code_system*);
+
 #endif
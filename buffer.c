@@ -36,6 +36,7 @@ void buffer_realloc(buffer *buffer, size_t min_add) {
   } while (new_size < min_size);
 
   buffer->data = xrealloc(buffer->data, new_size);
+  buffer->total = new_size;
 }
 
 char *buffer_pop(buffer *buffer) {
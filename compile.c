@@ -11,6 +11,7 @@
 #include "generate.h"
 #include "backend.h"
 #include "optimize.h"
+#include "interpret.h"
 
 #include "out/lib/core.h"
 
@@ -34,7 +35,8 @@ static block_statement *parse_file(char *filename) {
   return root;
 }
 
-static void backend_write_file(char *filename, code_system *system) {
+static void backend_write_file(char *filename, code_system *system,
+    void (*write)(code_system*, FILE*)) {
   FILE *dest;
 
   dest = fopen(filename, "w");
@@ -43,7 +45,7 @@ static void backend_write_file(char *filename, code_system *system) {
     exit(1);
   }
 
-  backend_write(system, dest);
+  write(system, dest);
 
   fflush(dest);
   fclose(dest);
@@ -71,13 +73,46 @@ static block_statement *wrap_core(block_statement *root) {
   return core_block;
 }
 
+bool compressed_refs = false;
+
 int main(int argc, char *argv[]) {
   block_statement *root;
   code_system *system;
+  bool emit_object = false, emit_c = false, emit_x86 = false, run = false,
+    interpret_only = false;
+
+  if (argc > 1 && strcmp(argv[1], "run") == 0) {
+    run = true;
+    argc--;
+    argv++;
+  }
+
+  for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; argc--, argv++) {
+    if (strcmp(argv[1], "--compressed-refs") == 0) {
+      compressed_refs = true;
+    } else if (strcmp(argv[1], "--emit-object") == 0) {
+      emit_object = true;
+    } else if (strcmp(argv[1], "--emit-c") == 0) {
+      emit_c = true;
+    } else if (strcmp(argv[1], "--emit-x86") == 0) {
+      emit_x86 = true;
+    } else if (run && strcmp(argv[1], "--interpret") == 0) {
+      interpret_only = true;
+    } else {
+      break;
+    }
+  }
 
   if (argc > 3 || (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
-      strcmp(argv[1], "--help") == 0))) {
-    fprintf(stderr, "usage: cub [<input-file> [<output-file>]]\n");
+      strcmp(argv[1], "--help") == 0)) || (emit_object && argc != 3) ||
+      (emit_x86 && argc != 3) || emit_object + emit_c + emit_x86 > 1 ||
+      (run && (emit_object || emit_c || emit_x86 || argc != 2))) {
+    fprintf(stderr,
+      "usage: cub [--compressed-refs] [<input-file> [<output-file>]]\n"
+      "       cub [--compressed-refs] --emit-object <input-file> <object-file>\n"
+      "       cub --emit-c [<input-file> [<c-file>]]\n"
+      "       cub --emit-x86 <input-file> <object-file>\n"
+      "       cub run [--interpret] [--compressed-refs] <input-file>\n");
     return 0;
   }
 
@@ -89,11 +124,18 @@ int main(int argc, char *argv[]) {
   system = generate(root);
   optimize(system);
 
-  // TODO: | llc | gcc -xassembler - out/lib/llvm-harness.s -o argv[2]
-  if (argc > 2) {
-    backend_write_file(argv[2], system);
+  void (*write)(code_system*, FILE*) = emit_c ? backend_write_c
+    : backend_write;
+  if (run) {
+    return interpret_only ? interpret(system) : backend_run(system);
+  } else if (emit_object) {
+    backend_write_object(system, argv[2]);
+  } else if (emit_x86) {
+    backend_write_x86(system, argv[2]);
+  } else if (argc > 2) {
+    backend_write_file(argv[2], system, write);
   } else {
-    backend_write(system, stdout);
+    write(system, stdout);
   }
 
   // http://stackoverflow.com/q/31622764/345645
@@ -46,12 +46,20 @@
       }]
     ],
     'link_settings': {
+      'ldflags': [
+        # natives are looked up by name when interpreting
+        '-rdynamic'
+      ],
       'libraries': [
-        '-lm'
+        '-lm',
+        '-ldl',
+        '-lpthread',
+        '<!@(llvm-config --ldflags --libs core irreader bitreader linker passes native)'
       ],
     },
     'include_dirs': [
-      '.'
+      '.',
+      '<!@(llvm-config --includedir)'
     ],
     'sources': [
       'expression/assign.c',
@@ -103,9 +111,21 @@
       'generate-block.c',
       'generate.c',
       'optimize.c',
+      'optimize-escape.c',
+      'optimize-idiom.c',
+      'optimize-range.c',
+      'optimize-view.c',
+      'interpret.c',
+      'backend.c',
       'llvm-backend/llvm-backend.c',
+      'llvm-backend/layout.c',
+      'llvm-backend/llvm-object.c',
+      'llvm-backend/llvm-jit.c',
+      'llvm-backend/llvm-harness.c',
       'llvm-backend/patch.c',
       'llvm-backend/types.c',
+      'x86-backend/elf-object.c',
+      'x86-backend/x86-backend.c',
       'compile.c'
     ],
     'actions': [{
@@ -123,6 +143,67 @@
         'xxd', '-i', 'lib/<(lib_name).cub', 'out/lib/<(lib_name).h'
       ],
       'message': 'Including core library'
+    }, {
+      'action_name': 'runtime_header_include',
+      'inputs': [
+        'llvm-backend/runtime.h'
+      ],
+      'outputs': [
+        'out/lib/runtime-header.h'
+      ],
+      'action': [
+        'xxd', '-i', 'llvm-backend/runtime.h', 'out/lib/runtime-header.h'
+      ],
+      'message': 'Including the runtime header'
+    }, {
+      'action_name': 'harness_object',
+      'inputs': [
+        'llvm-backend/llvm-harness.c'
+      ],
+      'outputs': [
+        'out/lib/llvm-harness.o'
+      ],
+      'action': [
+        'gcc', '-c', '-O2', '-fPIC', 'llvm-backend/llvm-harness.c',
+        '-o', 'out/lib/llvm-harness.o'
+      ],
+      'message': 'Compiling the harness'
+    }, {
+      'action_name': 'harness_include',
+      'inputs': [
+        'out/lib/llvm-harness.o'
+      ],
+      'outputs': [
+        'out/lib/llvm-harness.h'
+      ],
+      'action': [
+        'xxd', '-i', 'out/lib/llvm-harness.o', 'out/lib/llvm-harness.h'
+      ],
+      'message': 'Including the harness'
+    }, {
+      'action_name': 'runtime_bitcode',
+      'inputs': [
+        'llvm-backend/llvm-runtime.ll'
+      ],
+      'outputs': [
+        'out/lib/llvm-runtime.bc'
+      ],
+      'action': [
+        'llvm-as', 'llvm-backend/llvm-runtime.ll', '-o', 'out/lib/llvm-runtime.bc'
+      ],
+      'message': 'Assembling the runtime bitcode'
+    }, {
+      'action_name': 'runtime_include',
+      'inputs': [
+        'out/lib/llvm-runtime.bc'
+      ],
+      'outputs': [
+        'out/lib/llvm-runtime.h'
+      ],
+      'action': [
+        'xxd', '-i', 'out/lib/llvm-runtime.bc', 'out/lib/llvm-runtime.h'
+      ],
+      'message': 'Including the runtime bitcode'
     }]
   }]
 }
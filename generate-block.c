@@ -185,7 +185,9 @@ static void inject_params(code_block *dest, code_block *src) {
     dest_entry = dest_entry->next;
   }
 
-  for (instruction_node *node = dest->stack_head; node; node = node->next) {
+  // the stack values come from the source block, the destination only has the
+  // parameter slots they land in
+  for (instruction_node *node = src->stack_head; node; node = node->next) {
     term->parameters[i++] = node->instruction;
   }
 }
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "xalloc.h"
 #include "generate.h"
 
@@ -92,3 +94,89 @@ void add_blockref(code_block *src, size_t dest_block) {
   get->type = get_blockref_type(get_code_block(src->system, dest_block));
   get->block_index = dest_block;
 }
+
+void each_operand(code_instruction *ins, operand_iter iter, void *data) {
+  size_t *ip = ins->parameters;
+
+  switch (ins->operation.type) {
+  case O_BITWISE_NOT:
+  case O_CAST:
+  case O_GET_FIELD:
+  case O_GET_LENGTH:
+  case O_GET_SYMBOL:
+  case O_INSTANCEOF:
+  case O_NEGATE:
+  case O_NEW_ARRAY:
+  case O_NOT:
+    iter(&ip[0], data);
+    break;
+  case O_BOUNDS_CHECK:
+  case O_COMPARE:
+  case O_GET_INDEX:
+  case O_IDENTITY:
+  case O_LOGIC:
+  case O_NUMERIC:
+  case O_SET_LENGTH:
+  case O_SHIFT:
+    iter(&ip[0], data);
+    iter(&ip[1], data);
+    break;
+  case O_NATIVE:
+  case O_STR_CONCAT: {
+    size_t count = ip[0];
+    for (size_t i = 1; i <= count; i++) {
+      iter(&ip[i], data);
+    }
+  } break;
+  case O_SET_FIELD:
+    // the second parameter is the field index
+    iter(&ip[0], data);
+    iter(&ip[2], data);
+    break;
+  case O_SET_INDEX:
+    iter(&ip[0], data);
+    iter(&ip[1], data);
+    iter(&ip[2], data);
+    break;
+
+  case O_BLOCKREF:
+  case O_LITERAL:
+  case O_NEW:
+    break;
+  case O_CALL:
+  case O_FUNCTION:
+  case O_NUMERIC_ASSIGN:
+  case O_POSTFIX:
+  case O_SET_SYMBOL:
+  case O_SHIFT_ASSIGN:
+  case O_STR_CONCAT_ASSIGN:
+  case O_TERNARY:
+    abort();
+  }
+}
+
+void each_tail_operand(code_block *block, operand_iter iter, void *data) {
+  if (block->is_final) {
+    return;
+  }
+
+  code_terminal *tail = &block->tail;
+  iter(&tail->first_block, data);
+
+  if (tail->type == BRANCH) {
+    iter(&tail->second_block, data);
+    iter(&tail->condition, data);
+  }
+
+  for (size_t i = 0; i < tail->parameter_count; i++) {
+    iter(&tail->parameters[i], data);
+  }
+}
+
+// the natives on u8 arrays that every backend lowers itself instead of calling
+// into the harness, and that the optimizer knows only touch their arguments
+bool is_bulk_native(const char *name) {
+  return strcmp(name, "bear_array_copy") == 0 ||
+    strcmp(name, "bear_array_fill") == 0 ||
+    strcmp(name, "bear_array_compare") == 0;
+}
@@ -24,10 +24,26 @@ static code_struct *add_struct(code_system *system) {
     sizeof(code_struct));
 
   code_struct *cstruct = xmalloc(sizeof(*cstruct));
+  cstruct->is_context = false;
+  cstruct->has_parent = false;
   system->structs[system->struct_count++] = cstruct;
   return cstruct;
 }
 
+static size_t add_string(code_system *system, char *value) {
+  for (size_t i = 0; i < system->string_count; i++) {
+    if (strcmp(system->strings[i], value) == 0) {
+      return i;
+    }
+  }
+
+  resize(system->string_count, &system->string_cap, (void**) &system->strings,
+    sizeof(char*));
+
+  system->strings[system->string_count] = value;
+  return system->string_count++;
+}
+
 static symbol_entry *add_symbol(code_block *block, symbol_entry *upstream_entry,
     size_t instruction) {
   symbol_entry **entry = &block->symbol_head;
@@ -72,6 +88,9 @@ static size_t get_return_struct(code_system *system, type *return_type) {
     return 0;
   }
 
+  // compare and store the code generation type, not the class
+  return_type = resolve_type(system, copy_type(return_type));
+
   size_t count = system->struct_count;
   code_struct *return_struct;
 
@@ -111,7 +130,7 @@ static size_t get_return_struct(code_system *system, type *return_type) {
   blocktype->next = xmalloc(sizeof(argument));
   blocktype = blocktype->next;
   blocktype->symbol_name = NULL;
-  blocktype->argument_type = copy_type(return_type);
+  blocktype->argument_type = return_type;
   blocktype->next = NULL;
 
   return count;
@@ -171,6 +190,15 @@ static void mirror_instruction(code_block *parent, size_t src) {
   mirror->parameters[0] = src;
 }
 
+// checks the index on top of the stack against the array beneath it
+static void bounds_check(code_block *parent) {
+  code_instruction *check = new_instruction(parent, 2);
+  check->operation.type = O_BOUNDS_CHECK;
+  check->type = NULL;
+  check->parameters[0] = peek_stack(parent, 1);
+  check->parameters[1] = peek_stack(parent, 0);
+}
+
 // HEAD
 
 typedef void(*block_iter)(code_block *block, void *iter_data);
@@ -190,6 +218,9 @@ static code_block *generate_function(code_system*, function*);
 static code_block *generate_function_stub(code_system*, function*);
 static code_block *generate_expression(code_block*, expression*);
 static code_block *generate_call(code_block*, expression*);
+static code_block *generate_concat_parts(code_block*, expression*,
+  size_t *count);
+static void concat_parts(code_block*, size_t count, concat_type);
 static code_block *generate_linear(code_block*, expression*,
   size_t ref_param_count);
 static code_block *generate_new(code_block*, expression*);
@@ -491,35 +522,61 @@ static void generate_return(code_block *parent, return_statement *ret) {
     parent->tail.parameters[1] = last_instruction(parent);
   }
 
-  parent->tail.parameters[0] = 0;
+  // the first argument everywhere but the return block of a call, which
+  // receives the callee's return struct first and loads its own from that
+  size_t return_instruction = parent->return_instruction;
+
+  parent->tail.parameters[0] = return_instruction;
   parent->tail.first_block = next_instruction(parent);
 
-  size_t return_index = instruction_type(parent, 0)->struct_index;
+  size_t return_index = instruction_type(parent,
+    return_instruction)->struct_index;
   code_struct *return_struct = get_code_struct(parent->system, return_index);
   type *return_block_type = return_struct->fields[0].field_type;
 
   code_instruction *unwrap = new_instruction(parent, 2);
   unwrap->operation.type = O_GET_FIELD;
   unwrap->type = copy_type(return_block_type);
-  unwrap->parameters[0] = 0; // return structs are always the first argument
+  unwrap->parameters[0] = return_instruction;
   unwrap->parameters[1] = 0; // blockref position in all return structs
 }
 
 // STRUCTURE AND CLASS GENERATION
 
+// writes the fields of the_class after those of its ancestors, returning how
+// many there are
+static size_t generate_fields(code_system *system, class *the_class,
+    code_field *fields) {
+  size_t index = 0;
+  if (the_class->parent) {
+    index = generate_fields(system, the_class->parent, fields);
+  }
+
+  for (field *entry = the_class->field; entry; entry = entry->next) {
+    type *field_type = resolve_type(system, copy_type(entry->field_type));
+    fields[index].field_type = field_type;
+    ++index;
+  }
+
+  return index;
+}
+
 static code_struct *generate_class(code_system *system, class *the_class) {
   code_struct *cstruct = get_code_struct(system, the_class->struct_index);
-  cstruct->field_count = the_class->field_count;
+  size_t field_count = the_class->field_count;
+  for (class *c = the_class->parent; c; c = c->parent) {
+    field_count += c->field_count;
+  }
 
-  if (the_class->field_count) {
-    cstruct->fields = xmalloc(sizeof(code_field) * the_class->field_count);
+  cstruct->field_count = field_count;
+  if (field_count) {
+    cstruct->fields = xmalloc(sizeof(code_field) * field_count);
+    generate_fields(system, the_class, cstruct->fields);
+  }
 
-    size_t index = 0;
-    for (field *entry = the_class->field; entry; entry = entry->next) {
-      type *field_type = resolve_type(system, copy_type(entry->field_type));
-      cstruct->fields[index].field_type = field_type;
-      ++index;
-    }
+  if (the_class->parent) {
+    cstruct->has_parent = true;
+    cstruct->parent_index = the_class->parent->struct_index;
   }
 
   return cstruct;
@@ -627,12 +684,16 @@ static code_block *generate_expression(code_block *parent, expression *value) {
   case O_CAST:
     return generate_cast(parent, value);
   case O_COMPARE:
-  case O_GET_INDEX: // TODO: bounds checking
   case O_IDENTITY:
   case O_NUMERIC:
   case O_SHIFT:
-  case O_STR_CONCAT:
     return generate_linear(parent, value, 2);
+  case O_STR_CONCAT: {
+    size_t count = 0;
+    parent = generate_concat_parts(parent, value, &count);
+    concat_parts(parent, count, O_CONCAT);
+    return parent;
+  }
   case O_GET_FIELD: {
     parent = generate_expression(parent, value->value);
 
@@ -647,6 +708,22 @@ static code_block *generate_expression(code_block *parent, expression *value) {
 
     return parent;
   }
+  case O_GET_INDEX: {
+    parent = generate_expression(parent, value->value);
+    push_stack(parent);
+
+    parent = generate_expression(parent, value->value->next);
+    push_stack(parent);
+
+    bounds_check(parent);
+
+    code_instruction *get = new_instruction(parent, 2);
+    get->operation.type = O_GET_INDEX;
+    get->type = resolve_type(parent->system, copy_type(value->type));
+    get->parameters[1] = pop_stack(parent);
+    get->parameters[0] = pop_stack(parent);
+    return parent;
+  }
   case O_GET_SYMBOL: {
     const symbol_entry *upstream = value->symbol_entry;
 
@@ -683,7 +760,9 @@ static code_block *generate_expression(code_block *parent, expression *value) {
     literal->type = copy_type(value->type);
     switch (literal->type->type) {
     case T_BOOL: literal->value_bool = value->value_bool; break;
-    case T_STRING: literal->value_string = value->value_string; break;
+    case T_STRING:
+      literal->string_index = add_string(parent->system, value->value_string);
+      break;
     case T_U8: literal->value_u8 = value->value_u8; break;
     case T_U16: literal->value_u16 = value->value_u16; break;
     case T_U32: literal->value_u32 = value->value_u32; break;
@@ -706,7 +785,7 @@ static code_block *generate_expression(code_block *parent, expression *value) {
 
     code_instruction *native = new_instruction(parent, value->arg_count + 1);
     native->operation.type = O_NATIVE;
-    native->type = copy_type(value->type);
+    native->type = resolve_type(parent->system, copy_type(value->type));
     native->native_call = value->symbol_name;
 
     size_t i = value->arg_count;
@@ -724,7 +803,8 @@ static code_block *generate_expression(code_block *parent, expression *value) {
 
     code_instruction *new = new_instruction(parent, 1);
     new->operation.type = O_NEW_ARRAY;
-    new->type = copy_type(value->type);
+    new->operation.allocation_type = O_HEAP;
+    new->type = resolve_type(parent->system, copy_type(value->type));
     new->parameters[0] = last_instruction(parent) - 1;
     return parent;
   }
@@ -753,7 +833,7 @@ static code_block *generate_expression(code_block *parent, expression *value) {
       parent = generate_expression(parent, left->value->next);
       push_stack(parent);
 
-      // TODO: bounds checking
+      bounds_check(parent);
 
       // array value
       code_instruction *get = new_instruction(parent, 2);
@@ -817,17 +897,25 @@ static code_block *generate_expression(code_block *parent, expression *value) {
 
       if (cast) {
         cast->operation.type = O_CAST;
-        cast->type = copy_type(value->value->type);
+        cast->type = resolve_type(parent->system, copy_type(value->value->type));
         cast->parameters[0] = last_instruction(parent) - 1;
       }
+    } else if (value->operation.type == O_STR_CONCAT_ASSIGN) {
+      // the old value is already on the stack as the first part
+      size_t count = 1;
+      parent = generate_concat_parts(parent, right, &count);
+      concat_parts(parent, count, O_APPEND);
     } else {
       parent = generate_expression(parent, right);
     }
 
-    code_instruction *compute = new_instruction(parent, 2);
-    compute->type = copy_type(value->type);
-    compute->parameters[0] = pop_stack(parent);
-    compute->parameters[1] = last_instruction(parent) - 1;
+    code_instruction *compute = NULL;
+    if (value->operation.type != O_STR_CONCAT_ASSIGN) {
+      compute = new_instruction(parent, 2);
+      compute->type = copy_type(value->type);
+      compute->parameters[0] = pop_stack(parent);
+      compute->parameters[1] = last_instruction(parent) - 1;
+    }
 
     size_t mirror = last_instruction(parent);
     switch (value->operation.type) {
@@ -840,7 +928,6 @@ static code_block *generate_expression(code_block *parent, expression *value) {
       compute->operation.shift_type = value->operation.shift_type;
       break;
     case O_STR_CONCAT_ASSIGN:
-      compute->operation.type = O_STR_CONCAT;
       break;
     case O_POSTFIX:
       compute->operation.type = O_NUMERIC;
@@ -864,7 +951,7 @@ static code_block *generate_expression(code_block *parent, expression *value) {
       mirror_instruction(parent, mirror);
     } break;
     case O_GET_INDEX: {
-      // TODO: bounds checking
+      // already checked when the old value was read
       code_instruction *set = new_instruction(parent, 3);
       set->operation.type = O_SET_INDEX;
       set->type = NULL;
@@ -932,16 +1019,16 @@ static code_block *generate_expression(code_block *parent, expression *value) {
     parent = generate_expression(parent, value->value->next);
     push_stack(parent);
 
-    // TODO: bounds checking
+    bounds_check(parent);
 
     parent = generate_expression(parent, value->value->next->next);
 
     code_instruction *set = new_instruction(parent, 3);
     set->operation.type = O_SET_INDEX;
     set->type = NULL;
-    set->parameters[2] = pop_stack(parent);
+    set->parameters[2] = last_instruction(parent) - 1;
+    set->parameters[1] = pop_stack(parent);
     set->parameters[0] = pop_stack(parent);
-    set->parameters[1] = last_instruction(parent) - 1;
 
     mirror_instruction(parent, last_instruction(parent) - 1);
 
@@ -992,6 +1079,8 @@ static code_block *generate_expression(code_block *parent, expression *value) {
 
   // gets translated to control flow in analysis
   case O_LOGIC:
+  // only emitted by generation
+  case O_BOUNDS_CHECK:
     abort();
   }
 
@@ -1024,7 +1113,8 @@ static code_block *generate_call(code_block *parent, expression *value) {
 
   return_block->parameters[0].field_type = get_object_type(return_struct);
   if (non_void) {
-    return_block->parameters[1].field_type = copy_type(return_type);
+    return_block->parameters[1].field_type =
+      resolve_type(system, copy_type(return_type));
   }
 
   // generate and stack call expressions, including the callee
@@ -1074,6 +1164,7 @@ static code_block *generate_call(code_block *parent, expression *value) {
 
     context_struct = add_struct(system);
     context_struct->field_count = field_count;
+    context_struct->is_context = true;
     context_struct->fields = xmalloc(sizeof(code_field) * field_count);
 
     context_struct->fields[0].field_type = get_blockref_type(return_block);
@@ -1082,6 +1173,7 @@ static code_block *generate_call(code_block *parent, expression *value) {
   // add NEW instruction for context struct to call block
   code_instruction *new = new_instruction(parent, 1);
   new->operation.type = O_NEW;
+  new->operation.allocation_type = O_HEAP;
   new->type = get_object_type(context_index);
   new->parameters[0] = context_index;
 
@@ -1106,7 +1198,7 @@ static code_block *generate_call(code_block *parent, expression *value) {
     code_instruction *cast = new_instruction(return_block, 2);
     cast->operation.type = O_CAST;
     cast->operation.cast_type = O_DOWNCAST;
-    cast->type = copy_type(new->type);
+    cast->type = copy_type(instruction_type(parent, object));
     cast->parameters[0] = 0;
 
     size_t return_context = last_instruction(return_block);
@@ -1221,6 +1313,52 @@ static code_block *generate_call(code_block *parent, expression *value) {
   return return_block;
 }
 
+// strings are immutable, so the array is copied - forward_array_views turns
+// the copy back into a view of the array when nothing can change it later
+static code_block *generate_array_string(code_block *parent,
+    expression *value) {
+  parent = generate_expression(parent, value->value);
+  size_t array = last_instruction(parent);
+
+  code_instruction *length = new_instruction(parent, 1);
+  length->operation.type = O_GET_LENGTH;
+  length->type = new_type(T_U32);
+  length->parameters[0] = array;
+  size_t length_value = last_instruction(parent);
+
+  code_instruction *copy = new_instruction(parent, 1);
+  copy->operation.type = O_NEW_ARRAY;
+  copy->operation.allocation_type = O_HEAP;
+  copy->type = resolve_type(parent->system, copy_type(value->value->type));
+  copy->parameters[0] = length_value;
+  size_t copy_value = last_instruction(parent);
+
+  code_instruction *zero = add_instruction(parent);
+  zero->operation.type = O_LITERAL;
+  zero->type = new_type(T_U32);
+  zero->value_u32 = 0;
+  size_t zero_value = last_instruction(parent);
+
+  code_instruction *native = new_instruction(parent, 6);
+  native->operation.type = O_NATIVE;
+  native->type = new_type(T_VOID);
+  native->native_call = "bear_array_copy";
+  native->parameters[0] = 5;
+  native->parameters[1] = copy_value;
+  native->parameters[2] = zero_value;
+  native->parameters[3] = array;
+  native->parameters[4] = zero_value;
+  native->parameters[5] = length_value;
+
+  code_instruction *cast = new_instruction(parent, 1);
+  cast->operation.type = O_CAST;
+  cast->operation.cast_type = O_REINTERPRET;
+  cast->type = resolve_type(parent->system, copy_type(value->type));
+  cast->parameters[0] = copy_value;
+
+  return parent;
+}
+
 static code_block *generate_cast(code_block *parent, expression *value) {
   switch (value->operation.cast_type) {
   case O_DOWNCAST:
@@ -1230,6 +1368,10 @@ static code_block *generate_cast(code_block *parent, expression *value) {
   case O_FLOAT_TO_UNSIGNED:
   case O_FLOAT_TRUNCATE:
   case O_REINTERPRET:
+    if (value->type->type == T_STRING) {
+      return generate_array_string(parent, value);
+    }
+    // fallthrough
   case O_SIGN_EXTEND:
   case O_SIGNED_TO_FLOAT:
   case O_TRUNCATE:
@@ -1241,7 +1383,7 @@ static code_block *generate_cast(code_block *parent, expression *value) {
     code_instruction *cast = new_instruction(parent, 1);
     cast->operation.type = O_CAST;
     cast->operation.cast_type = value->operation.cast_type;
-    cast->type = copy_type(value->type);
+    cast->type = resolve_type(parent->system, copy_type(value->type));
     cast->parameters[0] = last_instruction(parent) - 1;
   } break;
   }
@@ -1250,6 +1392,33 @@ static code_block *generate_cast(code_block *parent, expression *value) {
 }
 
 // TODO: is using the expression value chain good enough?
+// pushes each operand of a ~ chain, so it becomes one concatenation that
+// allocates once
+static code_block *generate_concat_parts(code_block *parent, expression *value,
+    size_t *count) {
+  if (value->operation.type == O_STR_CONCAT) {
+    expression *left = value->value;
+    parent = generate_concat_parts(parent, left, count);
+    return generate_concat_parts(parent, left->next, count);
+  }
+
+  parent = generate_expression(parent, value);
+  push_stack(parent);
+  (*count)++;
+  return parent;
+}
+
+static void concat_parts(code_block *parent, size_t count, concat_type type) {
+  code_instruction *concat = new_instruction(parent, count + 1);
+  concat->operation.type = O_STR_CONCAT;
+  concat->operation.concat_type = type;
+  concat->type = new_type(T_STRING);
+  concat->parameters[0] = count;
+  for (; count > 0; count--) {
+    concat->parameters[count] = pop_stack(parent);
+  }
+}
+
 static code_block *generate_linear(code_block *parent, expression *value,
     size_t ref_param_count) {
   size_t param_count = 0;
@@ -1266,7 +1435,7 @@ static code_block *generate_linear(code_block *parent, expression *value,
 
   code_instruction *ins = new_instruction(parent, param_count);
   ins->operation = value->operation;
-  ins->type = copy_type(value->type);
+  ins->type = resolve_type(parent->system, copy_type(value->type));
   while (param_count-- > 0) {
     ins->parameters[param_count] = pop_stack(parent);
   }
@@ -1298,6 +1467,7 @@ static code_block *generate_new(code_block *parent, expression *value) {
 
   code_instruction *new = new_instruction(parent, 1);
   new->operation.type = O_NEW;
+  new->operation.allocation_type = O_HEAP;
   new->type = get_object_type(the_class->struct_index);
   new->parameters[0] = the_class->struct_index;
 
@@ -1353,6 +1523,9 @@ code_system *generate(block_statement *root) {
   system->block_count = 0;
   system->block_cap = 0;
   system->blocks = NULL;
+  system->string_count = 0;
+  system->string_cap = 0;
+  system->strings = NULL;
 
   code_struct *void_return_struct = add_struct(system);
   void_return_struct->field_count = 1;
@@ -13,6 +13,13 @@ typedef struct {
 typedef struct {
   size_t field_count;
   code_field *fields;
+  // saves the caller's values across a call, so each field beyond the return
+  // blockref is written once before the call and read once after it
+  bool is_context;
+  // a class's struct begins with the fields of the class it extends, which
+  // keep the parent's layout so an upcast object reads them in the same place
+  bool has_parent;
+  size_t parent_index;
 } code_struct;
 
 typedef struct {
@@ -32,7 +39,8 @@ typedef struct {
     uint16_t value_u16;
     uint32_t value_u32;
     uint64_t value_u64;
-    char *value_string;
+    // string literal, in the system's string pool
+    size_t string_index;
     // parameterized operation array (includes things like field index)
     size_t *parameters;
     // block reference
@@ -88,13 +96,17 @@ typedef struct block_node {
 } block_node;
 
 typedef struct code_system {
-  // TODO: byte arrays in one constant block referenced in slices from the code
   size_t struct_count, struct_cap;
   code_struct **structs;
   size_t block_count, block_cap;
   code_block **blocks;
+  // distinct string literals, so equal literals share one constant
+  size_t string_count, string_cap;
+  char **strings;
 } code_system;
 
+typedef void (*operand_iter)(size_t *operand, void *iter_data);
+
 code_block *fork_block(code_block *parent);
 void join_blocks(code_block *parent, size_t dest_block);
 code_block *rejoin_block(code_block *context, code_block *inner);
@@ -114,6 +126,9 @@ code_instruction *new_instruction(code_block *parent, size_t parameter_count);
 size_t last_instruction(code_block *block);
 size_t next_instruction(code_block *block);
 void add_blockref(code_block *src, size_t dest_block);
+void each_operand(code_instruction *ins, operand_iter iter, void *iter_data);
+void each_tail_operand(code_block *block, operand_iter iter, void *iter_data);
+bool is_bulk_native(const char *name);
 code_system *generate(block_statement *root);
 type *instruction_type(code_block*, size_t);
 
@@ -13,8 +13,9 @@ static void wti(FILE *out, type *t) {
 	}
 	switch (t->type) {
 	case T_ARRAY:
-		fprintf(stderr, "array type not implemented\n");
-		exit(1);
+		wt(t->arraytype);
+		pf("[]");
+		break;
 	case T_BLOCKREF:
 		pf("func(");
 		argument *arg = t->blocktype;
@@ -131,6 +132,9 @@ void backend_write(code_system *system, FILE *out) {
 			case O_BLOCKREF:
 				SET("ref B%zu", ins->block_index);
 				break;
+			case O_BOUNDS_CHECK:
+				pf("  check $%zu[$%zu]", AP(0), AP(1));
+				break;
 			case O_CAST: {
 				const char *name = NULL;
 				switch (ins->operation.cast_type) {
@@ -253,6 +257,9 @@ void backend_write(code_system *system, FILE *out) {
 				wt(TP(0));
 				pf(" $%zu->%zu", AP(0), ins->parameters[1]);
 				break;
+			case O_GET_LENGTH:
+				SET("length $%zu", AP(0));
+				break;
 			case O_GET_INDEX:
 				SETR("index ");
 				wt(TP(0));
@@ -283,7 +290,7 @@ void backend_write(code_system *system, FILE *out) {
 					SETR("null");
 					break;
 				case T_STRING:
-					SET("string \"%s\"", ins->value_string);
+					SET("string #%zu \"%s\"", ins->string_index, system->strings[ins->string_index]);
 					break;
 				case T_U8:
 					SET("%hhu", ins->value_u8);
@@ -320,9 +327,12 @@ void backend_write(code_system *system, FILE *out) {
 				SET("negate $%zu", AP(0));
 				break;
 			case O_NEW:
-				SETR("new");
+				SETR(ins->operation.allocation_type == O_STACK ? "new on stack" : "new");
 				// ins->parameters[0] is the length of O_NEW_ARRAY
 				break;
+			case O_NEW_ARRAY:
+				SET("new [$%zu]%s", AP(0), ins->operation.allocation_type == O_STACK ? " on stack" : "");
+				break;
 			case O_NOT:
 				SET("not $%zu", AP(0));
 				break;
@@ -372,9 +382,17 @@ void backend_write(code_system *system, FILE *out) {
 				}
 				SET("$%zu %s $%zu", AP(0), op, AP(1));
 			} break;
+			case O_SET_LENGTH:
+				pf("  resize $%zu to $%zu", AP(0), AP(1));
+				break;
+			case O_STR_CONCAT: {
+				SETR(ins->operation.concat_type == O_APPEND ? "append" : "concat");
+				size_t count = ins->parameters[0];
+				for (size_t i = 1; i <= count; i++) {
+					pf("%s $%zu", i == 1 ? "" : ",", AP(i));
+				}
+			} break;
 			// TODO: implement me!
-			case O_NEW_ARRAY:
-			case O_STR_CONCAT:
 			case O_IDENTITY:
 			case O_INSTANCEOF:
 			// should not exist post-generation
@@ -0,0 +1,892 @@
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "backend.h"
+#include "interpret.h"
+#include "xalloc.h"
+#include "llvm-backend/layout.h"
+#include "llvm-backend/runtime.h"
+
+// Runs a code_system directly, for when the LLVM round trip would take longer
+// than the program. Every block gets its own register file, indexed the way
+// the block already indexes its values: parameters first, then one register
+// per instruction. Each block runs to completion before another starts, so a
+// block's registers are only ever overwritten by the parameters passed into
+// it, and its literals are written once up front instead of executed.
+//
+// The instructions are translated to a flat array per block, with their
+// types resolved into opcodes and masks, and dispatched by computed goto. The
+// runtime is the same harness compiled programs link against, linked into
+// cub itself: objects use the layouts and metastructs of the LLVM backend, so
+// the collector walks them the same way.
+
+extern int unreachable;
+extern uint8_t *bear_heap_cursor, *bear_heap_limit, *bear_heap_base;
+uint8_t *bear_new(struct metastruct *mts, uint32_t storecount, void **ptr);
+uint8_t *bear_new_array(uint64_t element_size, uint8_t kind, uint64_t length,
+    uint32_t storecount, void **ptr);
+uint8_t *bear_string_concat(uint8_t **parts, uint64_t count,
+    uint32_t storecount, void **ptr);
+uint8_t *bear_string_append(uint8_t **parts, uint64_t count,
+    uint32_t storecount, void **ptr);
+uint8_t *bear_string_intern(uint8_t *value);
+bool bear_streq(uint8_t *a, uint8_t *b);
+int32_t bear_strcmp(uint8_t *a, uint8_t *b);
+void bear_bounds_fail(uint64_t index, uint64_t length);
+void bear_range_fail(uint64_t start, uint64_t end, uint64_t length);
+void bear_compress_refs(void);
+
+// a compiled program seeds the harness's intern table with its literals
+// through these, but they're interned one by one here instead
+uint8_t *bear_literals[] = {NULL};
+const uint64_t bear_literal_count = 0;
+
+typedef enum {
+  I_COPY,
+  I_NOT,
+  I_BITWISE_NOT,
+  I_NEGATE,
+  I_ADD,
+  I_SUB,
+  I_MUL,
+  I_DIV,
+  I_MOD,
+  I_AND,
+  I_OR,
+  I_XOR,
+  I_SHL,
+  I_LSHR,
+  I_ASHR,
+  I_LOGIC_AND,
+  I_LOGIC_OR,
+  I_LOGIC_XOR,
+  // greater-than comparisons swap their operands
+  I_EQ,
+  I_NE,
+  I_ULT,
+  I_ULE,
+  I_SLT,
+  I_SLE,
+  I_STREQ,
+  I_STRNE,
+  I_STRCMP,
+  I_SIGN_EXTEND,
+  I_TRUNCATE,
+  I_GET_FIELD8,
+  I_GET_FIELD16,
+  I_GET_FIELD32,
+  I_GET_FIELD64,
+  I_GET_NARROW,
+  I_SET_FIELD8,
+  I_SET_FIELD16,
+  I_SET_FIELD32,
+  I_SET_FIELD64,
+  I_SET_NARROW,
+  I_GET_LENGTH,
+  I_BOUNDS_CHECK,
+  I_GET_CHAR,
+  I_GET_INDEX8,
+  I_GET_INDEX16,
+  I_GET_INDEX32,
+  I_GET_INDEX64,
+  I_SET_INDEX8,
+  I_SET_INDEX16,
+  I_SET_INDEX32,
+  I_SET_INDEX64,
+  I_NEW,
+  I_NEW_ARRAY,
+  I_CONCAT,
+  I_APPEND,
+  I_CALL,
+  I_ARRAY_COPY,
+  I_ARRAY_FILL,
+  I_ARRAY_COMPARE,
+  I_GOTO,
+  I_BRANCH,
+  I_HALT,
+  I_COUNT
+} opcode;
+
+struct op {
+  // the label for code, filled in by run
+  const void *handler;
+  opcode code;
+  // 64 minus the width of the signed operand, for sign extension
+  unsigned shift;
+  // the bits of the result's type
+  uint64_t mask;
+  // registers
+  size_t dest, a, b, c;
+  // field offset, element size, comparison or array kind
+  uint64_t imm;
+  // operands beyond the first few: call arguments, concatenated parts and
+  // the parameters passed to the next block
+  size_t arg_count;
+  size_t *args;
+  // the values an allocation hands the collector as roots
+  size_t root_count;
+  size_t *roots;
+  bool *root_strings;
+  void *function;
+  struct metastruct *meta;
+};
+
+struct interpreter {
+  code_system *system;
+  struct layout *layouts;
+  struct metastruct *metas;
+  uint8_t **literals;
+  uint64_t **frames;
+  struct op **code;
+  // scratch space for the values passed between blocks and to the runtime
+  size_t max_scratch;
+};
+
+static unsigned type_bits(type *t) {
+  switch (t->type) {
+  case T_BOOL: return 1;
+  case T_S8: case T_U8: return 8;
+  case T_S16: case T_U16: return 16;
+  case T_S32: case T_U32: case T_F32: return 32;
+  default: return 64;
+  }
+}
+
+static uint64_t type_mask(type *t) {
+  unsigned bits = type_bits(t);
+  return bits == 64 ? UINT64_MAX : ((uint64_t) 1 << bits) - 1;
+}
+
+static bool is_signed(type *t) {
+  switch (t->type) {
+  case T_S8:
+  case T_S16:
+  case T_S32:
+  case T_S64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_gc_able(type *t) {
+  return t != NULL && (t->type == T_OBJECT || t->type == T_ARRAY || t->type == T_STRING);
+}
+
+static void unsupported(const char *what) {
+  fprintf(stderr, "cub: the interpreter does not support %s\n", what);
+  exit(1);
+}
+
+// the GC-able values defined before instruction j, all of which the collector
+// treats as live
+static void find_roots(code_block *block, size_t j, struct op *op) {
+  size_t limit = block->parameter_count + j;
+  op->roots = xmalloc(sizeof(size_t) * (limit + 1));
+  op->root_strings = xmalloc(sizeof(bool) * (limit + 1));
+  op->root_count = 0;
+  for (size_t v = 0; v < limit; v++) {
+    if (v >= block->parameter_count &&
+        block->instructions[v - block->parameter_count].operation.type == O_LITERAL) {
+      continue;
+    }
+    type *t = instruction_type(block, v);
+    if (is_gc_able(t)) {
+      op->roots[op->root_count] = v;
+      op->root_strings[op->root_count++] = t->type == T_STRING;
+    }
+  }
+}
+
+static void copy_args(struct op *op, size_t count, size_t *args) {
+  op->arg_count = count;
+  op->args = xmalloc(sizeof(size_t) * (count + 1));
+  if (count) {
+    memcpy(op->args, args, sizeof(size_t) * count);
+  }
+}
+
+static opcode sized(opcode base, type *t) {
+  switch (type_size(t)) {
+  case 1: return base;
+  case 2: return base + 1;
+  case 4: return base + 2;
+  case 8: return base + 3;
+  default: unsupported("16-byte values"); return base;
+  }
+}
+
+static opcode compare_op(code_block *block, code_instruction *ins,
+    struct op *op) {
+  type *t = instruction_type(block, ins->parameters[0]);
+  compare_type kind = ins->operation.compare_type;
+  if (t->type == T_STRING) {
+    op->imm = kind;
+    return kind == O_EQ ? I_STREQ : kind == O_NE ? I_STRNE : I_STRCMP;
+  }
+  if (is_float(t)) {
+    unsupported("floating point");
+  }
+
+  bool sign = is_signed(t);
+  op->shift = 64 - type_bits(t);
+  if (kind == O_GT || kind == O_GTE) {
+    size_t swap = op->a;
+    op->a = op->b;
+    op->b = swap;
+  }
+  switch (kind) {
+  case O_EQ: return I_EQ;
+  case O_NE: return I_NE;
+  case O_GT:
+  case O_LT: return sign ? I_SLT : I_ULT;
+  case O_GTE:
+  case O_LTE: return sign ? I_SLE : I_ULE;
+  }
+  abort();
+}
+
+static opcode cast_op(code_block *block, code_instruction *ins,
+    struct op *op) {
+  switch (ins->operation.cast_type) {
+  case O_UPCAST:
+  case O_DOWNCAST:
+  case O_REINTERPRET:
+  case O_ZERO_EXTEND:
+    return I_COPY;
+  case O_SIGN_EXTEND:
+    op->shift = 64 - type_bits(instruction_type(block, ins->parameters[0]));
+    return I_SIGN_EXTEND;
+  case O_TRUNCATE:
+    return I_TRUNCATE;
+  default:
+    unsupported("floating point");
+    return I_COPY;
+  }
+}
+
+static opcode native_op(code_instruction *ins, struct op *op) {
+  const char *name = ins->native_call;
+  if (strcmp(name, "bear_array_copy") == 0) {
+    return I_ARRAY_COPY;
+  }
+  if (strcmp(name, "bear_array_fill") == 0) {
+    return I_ARRAY_FILL;
+  }
+  if (strcmp(name, "bear_array_compare") == 0) {
+    return I_ARRAY_COMPARE;
+  }
+
+  // the harness is linked in and cub exports its symbols, so natives resolve
+  // the same way they would against a compiled program
+  op->function = dlsym(RTLD_DEFAULT, name);
+  if (op->function == NULL) {
+    fprintf(stderr, "cub: unknown native %s\n", name);
+    exit(1);
+  }
+  if (ins->parameters[0] > 6) {
+    unsupported("natives with more than six arguments");
+  }
+  return I_CALL;
+}
+
+static void set_literal(struct interpreter *it, uint64_t *regs,
+    size_t k, code_instruction *ins) {
+  switch (ins->type->type) {
+  case T_BOOL: regs[k] = ins->value_bool; break;
+  case T_OBJECT: regs[k] = 0; break;
+  case T_STRING:
+    regs[k] = (uintptr_t) it->literals[ins->string_index];
+    break;
+  case T_U8: regs[k] = ins->value_u8; break;
+  case T_U16: regs[k] = ins->value_u16; break;
+  case T_U32: regs[k] = ins->value_u32; break;
+  case T_U64: regs[k] = ins->value_u64; break;
+  case T_S8: regs[k] = (uint8_t) ins->value_s8; break;
+  case T_S16: regs[k] = (uint16_t) ins->value_s16; break;
+  case T_S32: regs[k] = (uint32_t) ins->value_s32; break;
+  case T_S64: regs[k] = (uint64_t) ins->value_s64; break;
+  default: unsupported("floating point literals");
+  }
+}
+
+static struct op *translate_block(struct interpreter *it, size_t b) {
+  code_block *block = get_code_block(it->system, b);
+  size_t offset = block->parameter_count;
+  uint64_t *regs = it->frames[b];
+  struct op *ops = xmalloc(sizeof(struct op) * (block->instruction_count + 1));
+  struct op *op = ops;
+
+  for (size_t j = 0; j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    size_t *ip = ins->parameters;
+    size_t k = j + offset;
+
+    switch (ins->operation.type) {
+    case O_LITERAL:
+      set_literal(it, regs, k, ins);
+      continue;
+    case O_BLOCKREF:
+      regs[k] = ins->block_index;
+      continue;
+    default:
+      break;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->dest = k;
+    op->mask = is_void(ins->type) ? UINT64_MAX : type_mask(ins->type);
+
+    switch (ins->operation.type) {
+    case O_BITWISE_NOT:
+      op->a = ip[0];
+      op->code = I_BITWISE_NOT;
+      break;
+    case O_BOUNDS_CHECK:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->shift = is_signed(instruction_type(block, ip[1]))
+        ? 64 - type_bits(instruction_type(block, ip[1])) : 0;
+      op->code = I_BOUNDS_CHECK;
+      break;
+    case O_CAST:
+      op->a = ip[0];
+      op->code = cast_op(block, ins, op);
+      break;
+    case O_COMPARE:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->code = compare_op(block, ins, op);
+      break;
+    case O_GET_FIELD: {
+      size_t s = instruction_type(block, ip[0])->struct_index;
+      op->a = ip[0];
+      op->imm = it->layouts[s].offset[ip[1]];
+      op->code = is_narrow(ins->type) ? I_GET_NARROW
+        : sized(I_GET_FIELD8, ins->type);
+    } break;
+    case O_GET_INDEX:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->code = instruction_type(block, ip[0])->type == T_STRING ? I_GET_CHAR
+        : sized(I_GET_INDEX8, ins->type);
+      break;
+    case O_GET_LENGTH:
+      op->a = ip[0];
+      op->code = I_GET_LENGTH;
+      break;
+    case O_GET_SYMBOL:
+      op->a = ip[0];
+      op->code = I_COPY;
+      break;
+    case O_LOGIC:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->code = ins->operation.logic_type == O_AND ? I_LOGIC_AND
+        : ins->operation.logic_type == O_OR ? I_LOGIC_OR : I_LOGIC_XOR;
+      break;
+    case O_NATIVE:
+      copy_args(op, ip[0], ip + 1);
+      op->code = native_op(ins, op);
+      break;
+    case O_NEGATE:
+      op->a = ip[0];
+      op->code = I_NEGATE;
+      break;
+    case O_NEW:
+      // the stack slots of the LLVM backend become ordinary heap objects
+      op->meta = &it->metas[ins->type->struct_index];
+      find_roots(block, j, op);
+      op->code = I_NEW;
+      break;
+    case O_NEW_ARRAY: {
+      type *et = ins->type->arraytype, *lt = instruction_type(block, ip[0]);
+      op->a = ip[0];
+      op->shift = is_signed(lt) ? 64 - type_bits(lt) : 0;
+      op->imm = et->type == T_STRING ? ARRAY_STRING
+        : is_gc_able(et) ? ARRAY_OBJECT : ARRAY_PRIMITIVE;
+      op->c = type_size(et);
+      find_roots(block, j, op);
+      op->code = I_NEW_ARRAY;
+    } break;
+    case O_NOT:
+      op->a = ip[0];
+      op->code = I_NOT;
+      break;
+    case O_NUMERIC:
+      if (is_float(ins->type)) {
+        unsupported("floating point");
+      }
+      op->a = ip[0];
+      op->b = ip[1];
+      switch (ins->operation.numeric_type) {
+      case O_ADD: op->code = I_ADD; break;
+      case O_BAND: op->code = I_AND; break;
+      case O_BOR: op->code = I_OR; break;
+      case O_BXOR: op->code = I_XOR; break;
+      case O_DIV: op->code = I_DIV; break;
+      case O_MOD: op->code = I_MOD; break;
+      case O_MUL: op->code = I_MUL; break;
+      case O_SUB: op->code = I_SUB; break;
+      }
+      break;
+    case O_SET_FIELD: {
+      size_t s = instruction_type(block, ip[0])->struct_index;
+      type *ft = get_code_struct(it->system, s)->fields[ip[1]].field_type;
+      op->a = ip[0];
+      op->b = ip[2];
+      op->imm = it->layouts[s].offset[ip[1]];
+      op->code = is_narrow(ft) ? I_SET_NARROW : sized(I_SET_FIELD8, ft);
+    } break;
+    case O_SET_INDEX:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->c = ip[2];
+      op->code = sized(I_SET_INDEX8,
+        instruction_type(block, ip[0])->arraytype);
+      break;
+    case O_SHIFT:
+      op->a = ip[0];
+      op->b = ip[1];
+      op->shift = 64 - type_bits(ins->type);
+      op->code = ins->operation.shift_type == O_LSHIFT ? I_SHL
+        : ins->operation.shift_type == O_RSHIFT ? I_LSHR : I_ASHR;
+      break;
+    case O_STR_CONCAT:
+      copy_args(op, ip[0], ip + 1);
+      find_roots(block, j, op);
+      op->code = ins->operation.concat_type == O_APPEND ? I_APPEND : I_CONCAT;
+      break;
+    case O_SET_LENGTH:
+      fputs("array resizing not implemented\n", stderr);
+      exit(1);
+    default:
+      abort();
+    }
+
+    size_t scratch = op->arg_count > op->root_count
+      ? op->arg_count : op->root_count;
+    if (scratch > it->max_scratch) {
+      it->max_scratch = scratch;
+    }
+    op++;
+  }
+
+  memset(op, 0, sizeof(*op));
+  if (block->is_final) {
+    op->code = I_HALT;
+  } else {
+    code_terminal *tail = &block->tail;
+    copy_args(op, tail->parameter_count, tail->parameters);
+    op->a = tail->first_block;
+    op->b = tail->condition;
+    op->c = tail->second_block;
+    op->code = tail->type == GOTO ? I_GOTO : I_BRANCH;
+    if (tail->parameter_count > it->max_scratch) {
+      it->max_scratch = tail->parameter_count;
+    }
+  }
+  return ops;
+}
+
+// laid out like the compiled program's string constants
+static uint8_t *make_literal(const char *value) {
+  size_t length = strlen(value);
+  uint8_t *out = xmalloc(8 + length);
+  *(uint64_t*) out = length | STRING_STATIC;
+  memcpy(out + 8, value, length);
+  return out;
+}
+
+static void translate(struct interpreter *it) {
+  code_system *system = it->system;
+
+  it->layouts = layout_structs(system);
+  it->metas = xmalloc(sizeof(struct metastruct) * (system->struct_count + 1));
+  for (size_t i = 0; i < system->struct_count; i++) {
+    struct layout *layout = &it->layouts[i];
+    it->metas[i] = (struct metastruct) {
+      .length = layout->size,
+      .struct_id = i,
+      .refs = layout->refs,
+      .object_refs = layout->object_refs,
+      .string_refs = layout->string_refs,
+      .narrow = layout->narrow,
+      .narrow_refs = layout->narrow_refs,
+      .parent = NULL
+    };
+    code_struct *str = get_code_struct(system, i);
+    if (str->has_parent) {
+      it->metas[i].parent = &it->metas[str->parent_index];
+    }
+  }
+
+  it->literals = xmalloc(sizeof(uint8_t*) * (system->string_count + 1));
+  for (size_t n = 0; n < system->string_count; n++) {
+    it->literals[n] = make_literal(system->strings[n]);
+  }
+
+  it->frames = xmalloc(sizeof(uint64_t*) * system->block_count);
+  it->code = xmalloc(sizeof(struct op*) * system->block_count);
+  it->max_scratch = 0;
+  for (size_t b = 0; b < system->block_count; b++) {
+    code_block *block = get_code_block(system, b);
+    size_t count = block->parameter_count + block->instruction_count;
+    it->frames[b] = xmalloc(sizeof(uint64_t) * (count + 1));
+    memset(it->frames[b], 0, sizeof(uint64_t) * (count + 1));
+  }
+  for (size_t b = 0; b < system->block_count; b++) {
+    it->code[b] = translate_block(it, b);
+  }
+}
+
+static void free_translation(struct interpreter *it) {
+  code_system *system = it->system;
+  for (size_t b = 0; b < system->block_count; b++) {
+    struct op *ops = it->code[b];
+    for (size_t j = 0;; j++) {
+      free(ops[j].args);
+      free(ops[j].roots);
+      free(ops[j].root_strings);
+      if (ops[j].code == I_GOTO || ops[j].code == I_BRANCH ||
+          ops[j].code == I_HALT) {
+        break;
+      }
+    }
+    free(ops);
+    free(it->frames[b]);
+  }
+  for (size_t n = 0; n < system->string_count; n++) {
+    free(it->literals[n]);
+  }
+  free(it->code);
+  free(it->frames);
+  free(it->literals);
+  free(it->metas);
+  free_layouts(system, it->layouts);
+}
+
+static inline int64_t sign_extend(uint64_t value, unsigned shift) {
+  return (int64_t) (value << shift) >> shift;
+}
+
+static inline uint64_t array_length(uint64_t value) {
+  return *(uint64_t*) (uintptr_t) value & ~STRING_FLAGS;
+}
+
+static inline uint8_t *array_data(uint64_t value) {
+  return (uint8_t*) (uintptr_t) value + 8;
+}
+
+static inline uint8_t *string_data(uint64_t value) {
+  uint8_t *string = (uint8_t*) (uintptr_t) value;
+  if (*(uint64_t*) string & STRING_SLICE_BIT) {
+    return ((struct slice*) string)->data;
+  }
+  return string + 8;
+}
+
+// the start of count elements at start, after checking they fit
+static inline uint8_t *array_range(uint64_t array, uint64_t start,
+    uint64_t count) {
+  uint64_t length = array_length(array);
+  if (start + count > length) {
+    bear_range_fail(start, start + count, length);
+  }
+  return array_data(array) + start;
+}
+
+// fills roots with the op's roots, strings tagged the way the collector
+// expects, and returns how many there are
+static inline uint32_t gather_roots(struct op *op, uint64_t *regs,
+    void **roots) {
+  for (size_t r = 0; r < op->root_count; r++) {
+    uintptr_t value = regs[op->roots[r]];
+    roots[r] = (void*) (op->root_strings[r] ? value | 1 : value);
+  }
+  return op->root_count;
+}
+
+// the inline bump of the LLVM backend, falling back on bear_new
+static inline uint8_t *new_object(struct metastruct *meta, struct op *op,
+    uint64_t *regs, void **roots) {
+  uint64_t size = 8 + ((meta->length + 7) & ~(uint64_t) 7);
+  uint8_t *object;
+  if (bear_heap_cursor != NULL &&
+      (uint64_t) (bear_heap_limit - bear_heap_cursor) >= size) {
+    uint8_t *header = bear_heap_cursor;
+    bear_heap_cursor += size;
+    *(uintptr_t*) header = (uintptr_t) meta | (uintptr_t) unreachable;
+    object = header + 8;
+  } else {
+    object = bear_new(meta, gather_roots(op, regs, roots), roots);
+  }
+  // every field is stored before it is read, but the collector may look first
+  memset(object, 0, meta->length);
+  return object;
+}
+
+static int run(struct interpreter *it) {
+  static const void *handlers[I_COUNT] = {
+    [I_COPY] = &&do_copy,
+    [I_NOT] = &&do_not,
+    [I_BITWISE_NOT] = &&do_bitwise_not,
+    [I_NEGATE] = &&do_negate,
+    [I_ADD] = &&do_add,
+    [I_SUB] = &&do_sub,
+    [I_MUL] = &&do_mul,
+    [I_DIV] = &&do_div,
+    [I_MOD] = &&do_mod,
+    [I_AND] = &&do_and,
+    [I_OR] = &&do_or,
+    [I_XOR] = &&do_xor,
+    [I_SHL] = &&do_shl,
+    [I_LSHR] = &&do_lshr,
+    [I_ASHR] = &&do_ashr,
+    [I_LOGIC_AND] = &&do_logic_and,
+    [I_LOGIC_OR] = &&do_logic_or,
+    [I_LOGIC_XOR] = &&do_logic_xor,
+    [I_EQ] = &&do_eq,
+    [I_NE] = &&do_ne,
+    [I_ULT] = &&do_ult,
+    [I_ULE] = &&do_ule,
+    [I_SLT] = &&do_slt,
+    [I_SLE] = &&do_sle,
+    [I_STREQ] = &&do_streq,
+    [I_STRNE] = &&do_strne,
+    [I_STRCMP] = &&do_strcmp,
+    [I_SIGN_EXTEND] = &&do_sign_extend,
+    [I_TRUNCATE] = &&do_truncate,
+    [I_GET_FIELD8] = &&do_get_field8,
+    [I_GET_FIELD16] = &&do_get_field16,
+    [I_GET_FIELD32] = &&do_get_field32,
+    [I_GET_FIELD64] = &&do_get_field64,
+    [I_GET_NARROW] = &&do_get_narrow,
+    [I_SET_FIELD8] = &&do_set_field8,
+    [I_SET_FIELD16] = &&do_set_field16,
+    [I_SET_FIELD32] = &&do_set_field32,
+    [I_SET_FIELD64] = &&do_set_field64,
+    [I_SET_NARROW] = &&do_set_narrow,
+    [I_GET_LENGTH] = &&do_get_length,
+    [I_BOUNDS_CHECK] = &&do_bounds_check,
+    [I_GET_CHAR] = &&do_get_char,
+    [I_GET_INDEX8] = &&do_get_index8,
+    [I_GET_INDEX16] = &&do_get_index16,
+    [I_GET_INDEX32] = &&do_get_index32,
+    [I_GET_INDEX64] = &&do_get_index64,
+    [I_SET_INDEX8] = &&do_set_index8,
+    [I_SET_INDEX16] = &&do_set_index16,
+    [I_SET_INDEX32] = &&do_set_index32,
+    [I_SET_INDEX64] = &&do_set_index64,
+    [I_NEW] = &&do_new,
+    [I_NEW_ARRAY] = &&do_new_array,
+    [I_CONCAT] = &&do_concat,
+    [I_APPEND] = &&do_append,
+    [I_CALL] = &&do_call,
+    [I_ARRAY_COPY] = &&do_array_copy,
+    [I_ARRAY_FILL] = &&do_array_fill,
+    [I_ARRAY_COMPARE] = &&do_array_compare,
+    [I_GOTO] = &&do_goto,
+    [I_BRANCH] = &&do_branch,
+    [I_HALT] = &&do_halt
+  };
+
+  code_system *system = it->system;
+  for (size_t b = 0; b < system->block_count; b++) {
+    struct op *ops = it->code[b];
+    for (size_t j = 0;; j++) {
+      ops[j].handler = handlers[ops[j].code];
+      if (ops[j].code == I_GOTO || ops[j].code == I_BRANCH ||
+          ops[j].code == I_HALT) {
+        break;
+      }
+    }
+  }
+
+  void **scratch = xmalloc(sizeof(void*) * (2 * it->max_scratch + 1));
+  uint64_t *passed = (uint64_t*) scratch;
+  uint64_t *regs = it->frames[0];
+  struct op *ip = it->code[0];
+  uint64_t target;
+
+#define R(x) regs[ip->x]
+#define PTR(x) ((uint8_t*) (uintptr_t) regs[ip->x])
+#define SET(value) regs[ip->dest] = (value) & ip->mask
+#define NEXT() goto *(++ip)->handler
+
+  goto *ip->handler;
+
+do_copy: SET(R(a)); NEXT();
+do_not: SET(R(a) == 0); NEXT();
+do_bitwise_not: SET(~R(a)); NEXT();
+do_negate: SET(-R(a)); NEXT();
+do_add: SET(R(a) + R(b)); NEXT();
+do_sub: SET(R(a) - R(b)); NEXT();
+do_mul: SET(R(a) * R(b)); NEXT();
+// unsigned, as the LLVM backend has it
+do_div: SET(R(a) / R(b)); NEXT();
+do_mod: SET(R(a) % R(b)); NEXT();
+do_and: SET(R(a) & R(b)); NEXT();
+do_or: SET(R(a) | R(b)); NEXT();
+do_xor: SET(R(a) ^ R(b)); NEXT();
+do_shl: SET(R(b) < 64 - ip->shift ? R(a) << R(b) : 0); NEXT();
+do_lshr: SET(R(b) < 64 - ip->shift ? R(a) >> R(b) : 0); NEXT();
+do_ashr: {
+  uint64_t amount = R(b) < 64 - ip->shift ? R(b) : 63 - ip->shift;
+  SET((uint64_t) (sign_extend(R(a), ip->shift) >> amount));
+} NEXT();
+do_logic_and: SET((R(a) != 0) & (R(b) != 0)); NEXT();
+do_logic_or: SET((R(a) != 0) | (R(b) != 0)); NEXT();
+do_logic_xor: SET((R(a) != 0) ^ (R(b) != 0)); NEXT();
+do_eq: SET(R(a) == R(b)); NEXT();
+do_ne: SET(R(a) != R(b)); NEXT();
+do_ult: SET(R(a) < R(b)); NEXT();
+do_ule: SET(R(a) <= R(b)); NEXT();
+do_slt: SET(sign_extend(R(a), ip->shift) < sign_extend(R(b), ip->shift)); NEXT();
+do_sle: SET(sign_extend(R(a), ip->shift) <= sign_extend(R(b), ip->shift)); NEXT();
+do_streq: SET(bear_streq(PTR(a), PTR(b))); NEXT();
+do_strne: SET(!bear_streq(PTR(a), PTR(b))); NEXT();
+do_strcmp: {
+  int32_t order = bear_strcmp(PTR(a), PTR(b));
+  switch ((compare_type) ip->imm) {
+  case O_GT: SET(order > 0); break;
+  case O_GTE: SET(order >= 0); break;
+  case O_LT: SET(order < 0); break;
+  default: SET(order <= 0); break;
+  }
+} NEXT();
+do_sign_extend: SET((uint64_t) sign_extend(R(a), ip->shift)); NEXT();
+do_truncate: SET(R(a)); NEXT();
+do_get_field8: SET(*(uint8_t*) (PTR(a) + ip->imm)); NEXT();
+do_get_field16: SET(*(uint16_t*) (PTR(a) + ip->imm)); NEXT();
+do_get_field32: SET(*(uint32_t*) (PTR(a) + ip->imm)); NEXT();
+do_get_field64: SET(*(uint64_t*) (PTR(a) + ip->imm)); NEXT();
+do_get_narrow: {
+  uint32_t narrow = *(uint32_t*) (PTR(a) + ip->imm);
+  SET(narrow ? (uintptr_t) (bear_heap_base + 8 * (uint64_t) narrow) : 0);
+} NEXT();
+do_set_field8: *(uint8_t*) (PTR(a) + ip->imm) = R(b); NEXT();
+do_set_field16: *(uint16_t*) (PTR(a) + ip->imm) = R(b); NEXT();
+do_set_field32: *(uint32_t*) (PTR(a) + ip->imm) = R(b); NEXT();
+do_set_field64: *(uint64_t*) (PTR(a) + ip->imm) = R(b); NEXT();
+do_set_narrow:
+  *(uint32_t*) (PTR(a) + ip->imm) = R(b)
+    ? (uint32_t) ((PTR(b) - bear_heap_base) >> 3) : 0;
+  NEXT();
+do_get_length: SET(array_length(R(a))); NEXT();
+do_bounds_check: {
+  // a negative signed index wraps around to a huge unsigned one
+  uint64_t index = ip->shift ? (uint64_t) sign_extend(R(b), ip->shift) : R(b);
+  uint64_t length = array_length(R(a));
+  if (index >= length) {
+    bear_bounds_fail(index, length);
+  }
+} NEXT();
+do_get_char: SET(string_data(R(a))[R(b)]); NEXT();
+do_get_index8: SET(array_data(R(a))[R(b)]); NEXT();
+do_get_index16: SET(((uint16_t*) array_data(R(a)))[R(b)]); NEXT();
+do_get_index32: SET(((uint32_t*) array_data(R(a)))[R(b)]); NEXT();
+do_get_index64: SET(((uint64_t*) array_data(R(a)))[R(b)]); NEXT();
+do_set_index8: array_data(R(a))[R(b)] = R(c); NEXT();
+do_set_index16: ((uint16_t*) array_data(R(a)))[R(b)] = R(c); NEXT();
+do_set_index32: ((uint32_t*) array_data(R(a)))[R(b)] = R(c); NEXT();
+do_set_index64: ((uint64_t*) array_data(R(a)))[R(b)] = R(c); NEXT();
+do_new:
+  regs[ip->dest] = (uintptr_t) new_object(ip->meta, ip, regs, scratch);
+  NEXT();
+do_new_array: {
+  uint64_t length = ip->shift ? (uint64_t) sign_extend(R(a), ip->shift) : R(a);
+  uint32_t count = gather_roots(ip, regs, scratch);
+  regs[ip->dest] = (uintptr_t) bear_new_array(ip->c, ip->imm, length, count,
+    scratch);
+} NEXT();
+do_concat:
+do_append: {
+  // the parts go at the start of scratch, the roots after them
+  void **roots = scratch + it->max_scratch;
+  uint32_t count = gather_roots(ip, regs, roots);
+  for (size_t p = 0; p < ip->arg_count; p++) {
+    scratch[p] = (void*) (uintptr_t) regs[ip->args[p]];
+  }
+  uint8_t *(*concat)(uint8_t**, uint64_t, uint32_t, void**) =
+    ip->code == I_APPEND ? bear_string_append : bear_string_concat;
+  regs[ip->dest] = (uintptr_t) concat((uint8_t**) scratch, ip->arg_count,
+    count, roots);
+} NEXT();
+do_call: {
+  // integer and pointer arguments all travel in the same registers, however
+  // narrow, so one signature covers every native the harness has
+  uint64_t args[6] = {0};
+  for (size_t p = 0; p < ip->arg_count; p++) {
+    args[p] = regs[ip->args[p]];
+  }
+  uint64_t (*function)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t,
+    uint64_t) = ip->function;
+  SET(function(args[0], args[1], args[2], args[3], args[4], args[5]));
+} NEXT();
+do_array_copy: {
+  // (dest, destStart, src, srcStart, count), which may overlap
+  size_t *p = ip->args;
+  uint64_t count = regs[p[4]];
+  uint8_t *dest = array_range(regs[p[0]], regs[p[1]], count);
+  uint8_t *src = array_range(regs[p[2]], regs[p[3]], count);
+  memmove(dest, src, count);
+} NEXT();
+do_array_fill: {
+  // (dest, start, count, value)
+  size_t *p = ip->args;
+  uint64_t count = regs[p[2]];
+  memset(array_range(regs[p[0]], regs[p[1]], count), (uint8_t) regs[p[3]],
+    count);
+} NEXT();
+do_array_compare: {
+  // (left, leftStart, right, rightStart, count)
+  size_t *p = ip->args;
+  uint64_t count = regs[p[4]];
+  uint8_t *left = array_range(regs[p[0]], regs[p[1]], count);
+  uint8_t *right = array_range(regs[p[2]], regs[p[3]], count);
+  SET((uint64_t) (int64_t) memcmp(left, right, count));
+} NEXT();
+do_goto:
+  target = R(a);
+  goto jump;
+do_branch:
+  target = R(b) ? R(a) : R(c);
+  goto jump;
+jump:
+  // through passed, since a block may pass its own registers back to itself
+  for (size_t p = 0; p < ip->arg_count; p++) {
+    passed[p] = regs[ip->args[p]];
+  }
+  regs = it->frames[target];
+  memcpy(regs, passed, sizeof(uint64_t) * ip->arg_count);
+  ip = it->code[target];
+  goto *ip->handler;
+do_halt:
+  free(scratch);
+  return 0;
+
+#undef R
+#undef PTR
+#undef SET
+#undef NEXT
+}
+
+int interpret(code_system *system) {
+  struct interpreter it = {.system = system};
+  translate(&it);
+
+  if (compressed_refs) {
+    bear_compress_refs();
+  }
+  // before anything else is interned, as the compiled program's seeding is
+  for (size_t n = 0; n < system->string_count; n++) {
+    bear_string_intern(it.literals[n]);
+  }
+
+  int status = run(&it);
+  free_translation(&it);
+  return status;
+}
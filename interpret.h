@@ -0,0 +1,9 @@
+#ifndef INTERPRET_H
+#define INTERPRET_H
+
+#include "generate.h"
+
+// runs the program without generating any code, returning its exit status
+int interpret(code_system *system);
+
+#endif
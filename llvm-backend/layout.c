@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "layout.h"
+#include "../xalloc.h"
+#include "../backend.h"
+
+// whether a field of this type holds a 32-bit offset instead of a pointer
+bool is_narrow(type *field_type) {
+	return compressed_refs && field_type->type == T_OBJECT;
+}
+
+// as LLVM lays out the equivalent type under our datalayout
+uint64_t type_size(type *t) {
+	switch (t->type) {
+	case T_BOOL:
+	case T_S8:
+	case T_U8:
+		return 1;
+	case T_S16:
+	case T_U16:
+		return 2;
+	case T_F32:
+	case T_S32:
+	case T_U32:
+		return 4;
+	case T_ARRAY:
+	case T_BLOCKREF:
+	case T_F64:
+	case T_OBJECT:
+	case T_S64:
+	case T_STRING:
+	case T_U64:
+		return 8;
+	case T_F128:
+		return 16;
+	default:
+		abort();
+	}
+}
+
+// the alignment loads and stores can assume: natural, except that objects and
+// array elements are only ever 8-byte aligned
+uint64_t type_align(type *t) {
+	uint64_t size = type_size(t);
+	return size > 8 ? 8 : size;
+}
+
+// the size of a field, which may be a compressed reference
+static uint64_t field_size(type *t) {
+	return is_narrow(t) ? 4 : type_size(t);
+}
+
+// lower sorts first
+static int rank(type *t) {
+	if (is_narrow(t)) {
+		return 0;
+	}
+	switch (t->type) {
+	case T_OBJECT:
+	case T_ARRAY:
+		return 0;
+	case T_STRING:
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+static bool goes_before(type *a, type *b) {
+	uint64_t left = field_size(a), right = field_size(b);
+	if (left != right) {
+		return left > right;
+	}
+	return rank(a) < rank(b);
+}
+
+static void layout_struct(code_system *system, struct layout *layouts, size_t index) {
+	code_struct *str = get_code_struct(system, index);
+	struct layout *out = &layouts[index];
+	size_t count = str->field_count;
+	out->position = xmalloc(sizeof(size_t) * (count + 1));
+	out->order = xmalloc(sizeof(size_t) * (count + 1));
+	out->offset = xmalloc(sizeof(uint64_t) * (count + 1));
+
+	// a subclass keeps its parent's layout in front and only arranges its own
+	// fields after it, and a context struct is upcast to its return struct, so
+	// the return blockref stays in front
+	size_t fixed = str->is_context && count ? 1 : 0;
+	struct layout *parent = NULL;
+	if (str->has_parent) {
+		parent = &layouts[str->parent_index];
+		if (parent->position == NULL) {
+			layout_struct(system, layouts, str->parent_index);
+		}
+		fixed = get_code_struct(system, str->parent_index)->field_count;
+	}
+	for (size_t p = 0; p < count; p++) {
+		out->order[p] = parent && p < fixed ? parent->order[p] : p;
+	}
+
+	// stable insertion sort, as structs only have a handful of fields
+	for (size_t p = fixed + 1; p < count; p++) {
+		size_t field = out->order[p], q = p;
+		type *t = str->fields[field].field_type;
+		for (; q > fixed && goes_before(t, str->fields[out->order[q - 1]].field_type); q--) {
+			out->order[q] = out->order[q - 1];
+		}
+		out->order[q] = field;
+	}
+
+	// the metastruct only describes the references after the parent's, and
+	// chains to the parent's metastruct for the rest
+	uint64_t offset = 0, align = 1;
+	out->refs = 0;
+	out->object_refs = 0;
+	out->string_refs = 0;
+	out->narrow = 0;
+	out->narrow_refs = 0;
+	for (size_t p = 0; p < count; p++) {
+		size_t field = out->order[p];
+		type *t = str->fields[field].field_type;
+		uint64_t size = field_size(t), field_align = size;
+		out->position[field] = p;
+
+		offset = (offset + field_align - 1) & ~(field_align - 1);
+		out->offset[field] = offset;
+		if (field_align > align) {
+			align = field_align;
+		}
+
+		if (parent && p < fixed) {
+			offset += size;
+			continue;
+		}
+
+		if (is_narrow(t)) {
+			if (!out->narrow_refs) {
+				out->narrow = offset;
+			}
+			out->narrow_refs++;
+			offset += size;
+			continue;
+		}
+
+		switch (rank(t)) {
+		case 0:
+			if (!out->object_refs) {
+				out->refs = offset;
+			}
+			out->object_refs++;
+			break;
+		case 1:
+			if (!out->object_refs && !out->string_refs) {
+				out->refs = offset;
+			}
+			out->string_refs++;
+			break;
+		}
+		offset += size;
+	}
+
+	out->size = (offset + align - 1) & ~(align - 1);
+}
+
+struct layout *layout_structs(code_system *system) {
+	struct layout *layouts = xmalloc(sizeof(struct layout) * (system->struct_count + 1));
+	for (size_t i = 0; i < system->struct_count; i++) {
+		layouts[i].position = NULL;
+	}
+	for (size_t i = 0; i < system->struct_count; i++) {
+		if (layouts[i].position == NULL) {
+			layout_struct(system, layouts, i);
+		}
+	}
+	return layouts;
+}
+
+void free_layouts(code_system *system, struct layout *layouts) {
+	for (size_t i = 0; i < system->struct_count; i++) {
+		free(layouts[i].position);
+		free(layouts[i].order);
+		free(layouts[i].offset);
+	}
+	free(layouts);
+}
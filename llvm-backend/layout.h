@@ -0,0 +1,35 @@
+#ifndef LLVM_BACKEND_LAYOUT_H
+#define LLVM_BACKEND_LAYOUT_H
+
+#include <stdint.h>
+#include "../generate.h"
+
+// where the fields of a code struct go in its LLVM struct. Fields are ordered
+// by alignment to avoid padding, and the ones the collector follows come
+// first among the 8-byte fields so the metastruct can describe them as one
+// range: objects and arrays, then strings. Compressed object references lead
+// the 4-byte fields instead, as a range of their own. A subclass starts with
+// its parent's layout and arranges only the fields it adds after that.
+struct layout {
+	// position[f] is the LLVM struct element of field f, order[p] the reverse
+	size_t *position;
+	size_t *order;
+	// offset[f] is the byte offset of field f
+	uint64_t *offset;
+	uint64_t size;
+	// the byte offset of the first reference, and how many of each kind follow,
+	// not counting those of a parent
+	uint64_t refs;
+	size_t object_refs, string_refs;
+	// the same for the compressed object references
+	uint64_t narrow;
+	size_t narrow_refs;
+};
+
+bool is_narrow(type *field_type);
+uint64_t type_size(type *t);
+uint64_t type_align(type *t);
+struct layout *layout_structs(code_system *system);
+void free_layouts(code_system *system, struct layout *layouts);
+
+#endif
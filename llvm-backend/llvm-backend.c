@@ -1,22 +1,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #include "../backend.h"
 #include "patch.h"
 #include "types.h"
+#include "layout.h"
+#include "runtime.h"
 
 #define vf(var, ...) { char *cptr; if (asprintf(&cptr, __VA_ARGS__) == -1) { perror("asprintf"); exit(1); } pt_put(var, cptr); }
 #define vfr(var, x) { pt_put(var, x); }
 
+// the LLVM layout of every code struct, for the current backend_write
+static struct layout *layouts;
+
 static struct llvm_type *convert_type(type *t) {
 	if (t == NULL) {
 		abort();
 	}
 	switch (t->type) {
 	case T_ARRAY:
-		fprintf(stderr, "array type not implemented\n");
-		exit(1);
+		// Arrays share the string layout: a 64-bit length followed by the elements.
+		// They are always heap-allocated, so the static bit is never set.
+		return LL_PTR(LL_I8);
 	case T_BLOCKREF:
 		return LL_BLOCK;
 	case T_BOOL:
@@ -61,6 +70,16 @@ static struct llvm_type *convert_type(type *t) {
 static void wt(type *t) {
 	char *ts = llvm_type_string(convert_type(t), LTS_DEALLOC);
 	pt_printf("%s", ts);
+	free(ts);
+}
+
+// the type of a struct field, which is narrower for compressed references
+static void wt_field(type *t) {
+	if (is_narrow(t)) {
+		pt_printf("i32");
+	} else {
+		wt(t);
+	}
 }
 
 bool check_prototypes(code_block *from, code_block *to, size_t toindex) {
@@ -97,36 +116,1229 @@ bool check_prototypes(code_block *from, code_block *to, size_t toindex) {
 
 #define IS_GC_ABLE(tp) ((tp) != NULL && ((tp)->type == T_OBJECT || (tp)->type == T_ARRAY || (tp)->type == T_STRING))
 
+#define TYPEOF(x) ((x) < block->parameter_count ? block->parameters[x].field_type : block->instructions[x - block->parameter_count].type)
+
+// TBAA: every location in the heap is only ever loaded and stored as one LLVM
+// type, so accesses of different types never alias. The tags go by that type
+// rather than by struct field, since an upcast context reaches its return
+// blockref through two structs. Lengths and headers are words nothing else
+// touches. Memory intrinsics and the runtime bitcode carry no tags, which
+// leaves them aliasing everything.
+enum tbaa {
+	TBAA_LENGTH,
+	TBAA_HEADER,
+	TBAA_POINTER,
+	TBAA_I1,
+	TBAA_I8,
+	TBAA_I16,
+	TBAA_I32,
+	TBAA_I64,
+	TBAA_FLOAT,
+	TBAA_DOUBLE,
+	TBAA_FP128,
+	TBAA_COUNT
+};
+
+static const char *tbaa_names[TBAA_COUNT] = {
+	"length", "header", "pointer", "i1", "i8", "i16", "i32", "i64", "float",
+	"double", "fp128"
+};
+
+// the access tag, after the branch weights in !0 and the root in !1
+static void w_tbaa(enum tbaa tbaa) {
+	pt_printf(", !tbaa !%u", 3 + 2 * (unsigned) tbaa);
+}
+
+static enum tbaa tbaa_of(type *t) {
+	if (is_narrow(t)) {
+		return TBAA_I32;
+	}
+	switch (t->type) {
+	case T_ARRAY:
+	case T_BLOCKREF:
+	case T_OBJECT:
+	case T_STRING:
+		return TBAA_POINTER;
+	case T_BOOL:
+		return TBAA_I1;
+	case T_U8:
+	case T_S8:
+		return TBAA_I8;
+	case T_U16:
+	case T_S16:
+		return TBAA_I16;
+	case T_U32:
+	case T_S32:
+		return TBAA_I32;
+	case T_U64:
+	case T_S64:
+		return TBAA_I64;
+	case T_F32:
+		return TBAA_FLOAT;
+	case T_F64:
+		return TBAA_DOUBLE;
+	case T_F128:
+		return TBAA_FP128;
+	default:
+		abort();
+	}
+}
+
+static bool is_signed_type(type *t) {
+	switch (t->type) {
+	case T_S8:
+	case T_S16:
+	case T_S32:
+	case T_S64:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// widens an integer operand to i64 as %<prefix>.i_k
+static void wide_operand(const char *prefix, size_t i, size_t k, type *t, const char *value) {
+	if (t->type == T_U64 || t->type == T_S64) {
+		pt_printf("  %%%s.%zu_%zu = add i64 %s, 0\n", prefix, i, k, value);
+		return;
+	}
+	pt_printf("  %%%s.%zu_%zu = %s ", prefix, i, k, is_signed_type(t) ? "sext" : "zext");
+	wt(t);
+	pt_printf(" %s to i64\n", value);
+}
+
+// loads the length of an array or string as %len.i_k
+static void array_length(size_t i, size_t k, type *t, const char *value) {
+	pt_printf("  %%lenptr.%zu_%zu = bitcast i8* %s to i64*\n", i, k, value);
+	if (t->type == T_STRING) {
+		// the top bits flag static, slice and interned strings
+		pt_printf("  %%lenraw.%zu_%zu = load i64, i64* %%lenptr.%zu_%zu, align 8", i, k, i, k);
+		w_tbaa(TBAA_LENGTH);
+		pt_printf("\n");
+		pt_printf("  %%len.%zu_%zu = and i64 %%lenraw.%zu_%zu, 2305843009213693951\n", i, k, i, k);
+	} else {
+		pt_printf("  %%len.%zu_%zu = load i64, i64* %%lenptr.%zu_%zu, align 8", i, k, i, k);
+		w_tbaa(TBAA_LENGTH);
+		pt_printf("\n");
+	}
+}
+
+// computes the address of an array or string element as %elem.i_k
+static void array_element(size_t i, size_t k, type *element, const char *array, type *array_type, type *index_type, const char *index, struct patchvar *exit_label) {
+	wide_operand("idx", i, k, index_type, index);
+	if (array_type->type == T_STRING) {
+		// a slice keeps a pointer to its first byte in place of the bytes
+		pt_printf("  %%slptr.%zu_%zu = bitcast i8* %s to i64*\n", i, k, array);
+		pt_printf("  %%slhead.%zu_%zu = load i64, i64* %%slptr.%zu_%zu, align 8", i, k, i, k);
+		w_tbaa(TBAA_LENGTH);
+		pt_printf("\n");
+		pt_printf("  %%slbit.%zu_%zu = and i64 %%slhead.%zu_%zu, 4611686018427387904\n", i, k, i, k);
+		pt_printf("  %%isslice.%zu_%zu = icmp ne i64 %%slbit.%zu_%zu, 0\n", i, k, i, k);
+		pt_printf("  br i1 %%isslice.%zu_%zu, label %%Slice%zu_%zu, label %%Flat%zu_%zu\n", i, k, i, k, i, k);
+		pt_printf("Slice%zu_%zu:\n", i, k);
+		pt_printf("  %%sldataptr.%zu_%zu = getelementptr inbounds i64, i64* %%slptr.%zu_%zu, i64 1\n", i, k, i, k);
+		pt_printf("  %%sldatapp.%zu_%zu = bitcast i64* %%sldataptr.%zu_%zu to i8**\n", i, k, i, k);
+		pt_printf("  %%sldata.%zu_%zu = load i8*, i8** %%sldatapp.%zu_%zu, align 8", i, k, i, k);
+		w_tbaa(TBAA_POINTER);
+		pt_printf("\n");
+		pt_printf("  br label %%Data%zu_%zu\n", i, k);
+		pt_printf("Flat%zu_%zu:\n", i, k);
+		pt_printf("  %%fldata.%zu_%zu = getelementptr inbounds i8, i8* %s, i64 8\n", i, k, array);
+		pt_printf("  br label %%Data%zu_%zu\n", i, k);
+		pt_printf("Data%zu_%zu:\n", i, k);
+		pt_printf("  %%data.%zu_%zu = phi i8* [%%sldata.%zu_%zu, %%Slice%zu_%zu], [%%fldata.%zu_%zu, %%Flat%zu_%zu]\n", i, k, i, k, i, k, i, k, i, k);
+		vf(exit_label, "Data%zu_%zu", i, k);
+	} else {
+		pt_printf("  %%data.%zu_%zu = getelementptr inbounds i8, i8* %s, i64 8\n", i, k, array);
+	}
+	pt_printf("  %%elems.%zu_%zu = bitcast i8* %%data.%zu_%zu to ", i, k, i, k);
+	wt(element);
+	pt_printf("*\n  %%elem.%zu_%zu = getelementptr inbounds ", i, k);
+	wt(element);
+	pt_printf(", ");
+	wt(element);
+	pt_printf("* %%elems.%zu_%zu, i64 %%idx.%zu_%zu\n", i, k, i, k);
+}
+
+// natives in the harness that only read the strings they're given, so LLVM can
+// treat their calls like loads; none is readnone, as strings live in memory
+static const char *readonly_natives[] = {
+	"bear_string_ends",
+	"bear_string_find",
+	"bear_string_starts"
+};
+
+static const char *native_attributes(const char *name) {
+	size_t count = sizeof(readonly_natives) / sizeof(readonly_natives[0]);
+	for (size_t n = 0; n < count; n++) {
+		if (strcmp(name, readonly_natives[n]) == 0) {
+			return " readonly willreturn";
+		}
+	}
+	return "";
+}
+
+// checks that %count.i_k elements from start fit in the array, and leaves the
+// address of the first in %<tag>.i_k
+static void array_range(size_t i, size_t k, const char *tag, const char *array, type *start_type, const char *start, struct patchvar *exit_label) {
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%sstart", tag);
+	wide_operand(prefix, i, k, start_type, start);
+
+	pt_printf("  %%%slenptr.%zu_%zu = bitcast i8* %s to i64*\n", tag, i, k, array);
+	pt_printf("  %%%slen.%zu_%zu = load i64, i64* %%%slenptr.%zu_%zu, align 8", tag, i, k, tag, i, k);
+	w_tbaa(TBAA_LENGTH);
+	pt_printf("\n");
+	// both operands were widened from 32 bits, so this cannot wrap
+	pt_printf("  %%%send.%zu_%zu = add i64 %%%sstart.%zu_%zu, %%count.%zu_%zu\n", tag, i, k, tag, i, k, i, k);
+	pt_printf("  %%%sfits.%zu_%zu = icmp ule i64 %%%send.%zu_%zu, %%%slen.%zu_%zu\n", tag, i, k, tag, i, k, tag, i, k);
+	pt_printf("  br i1 %%%sfits.%zu_%zu, label %%%sRange%zu_%zu, label %%%sFail%zu_%zu, !prof !0\n", tag, i, k, tag, i, k, tag, i, k);
+	pt_printf("%sFail%zu_%zu:\n", tag, i, k);
+	pt_printf("  call void @bear_range_fail(i64 %%%sstart.%zu_%zu, i64 %%%send.%zu_%zu, i64 %%%slen.%zu_%zu)\n", tag, i, k, tag, i, k, tag, i, k);
+	pt_printf("  unreachable\n");
+	pt_printf("%sRange%zu_%zu:\n", tag, i, k);
+	vf(exit_label, "%sRange%zu_%zu", tag, i, k);
+
+	pt_printf("  %%%sdata.%zu_%zu = getelementptr inbounds i8, i8* %s, i64 8\n", tag, i, k, array);
+	pt_printf("  %%%s.%zu_%zu = getelementptr inbounds i8, i8* %%%sdata.%zu_%zu, i64 %%%sstart.%zu_%zu\n", tag, i, k, tag, i, k, tag, i, k);
+}
+
+// bulk operations on u8 arrays from lib/core.cub and the loop idiom pass
+static void lower_intrinsic(code_block *block, code_instruction *ins, size_t i, size_t k, struct patchvar **ref, struct patchvar *exit_label) {
+	size_t *ip = ins->parameters;
+	const char *name = ins->native_call;
+
+	if (strcmp(name, "bear_array_fill") == 0) {
+		// (dest, start, count, value)
+		wide_operand("count", i, k, TYPEOF(ip[3]), pt_fetch(ref[ip[3]]));
+		array_range(i, k, "dst", pt_fetch(ref[ip[1]]), TYPEOF(ip[2]), pt_fetch(ref[ip[2]]), exit_label);
+		pt_printf("  call void @llvm.memset.p0i8.i64(i8* %%dst.%zu_%zu, i8 %s, i64 %%count.%zu_%zu, i1 false)\n", i, k, pt_fetch(ref[ip[4]]), i, k);
+		return;
+	}
+
+	// (dest, destStart, src, srcStart, count) and (left, leftStart, right, rightStart, count)
+	wide_operand("count", i, k, TYPEOF(ip[5]), pt_fetch(ref[ip[5]]));
+	array_range(i, k, "dst", pt_fetch(ref[ip[1]]), TYPEOF(ip[2]), pt_fetch(ref[ip[2]]), exit_label);
+	array_range(i, k, "src", pt_fetch(ref[ip[3]]), TYPEOF(ip[4]), pt_fetch(ref[ip[4]]), exit_label);
+
+	if (strcmp(name, "bear_array_copy") == 0) {
+		// the ranges may overlap when both are the same array
+		pt_printf("  call void @llvm.memmove.p0i8.p0i8.i64(i8* %%dst.%zu_%zu, i8* %%src.%zu_%zu, i64 %%count.%zu_%zu, i1 false)\n", i, k, i, k, i, k);
+	} else {
+		pt_printf("  %%b%zu_%zu = call i32 @memcmp(i8* %%dst.%zu_%zu, i8* %%src.%zu_%zu, i64 %%count.%zu_%zu)\n", i, k, i, k, i, k, i, k);
+	}
+}
+
+static bool is_spilled(code_block *block, size_t ssa, size_t j, size_t *last_used_map) {
+	size_t offset = block->parameter_count;
+	size_t start = ssa - offset;
+	size_t end = last_used_map[ssa];
+	return (ssa < offset || start < j) && end > j && IS_GC_ABLE(TYPEOF(ssa))
+		&& (ssa < offset || block->instructions[ssa - offset].operation.type != O_LITERAL);
+}
+
+static bool is_stack_allocation(code_instruction *ins) {
+	return (ins->operation.type == O_NEW || ins->operation.type == O_NEW_ARRAY)
+		&& ins->operation.allocation_type == O_STACK;
+}
+
+// the length of a stack array, which allocate_on_stack made sure is a literal
+static uint64_t stack_array_length(code_block *block, code_instruction *ins) {
+	code_instruction *length = &block->instructions[ins->parameters[0] - block->parameter_count];
+	switch (length->type->type) {
+	case T_U8: return length->value_u8;
+	case T_U16: return length->value_u16;
+	case T_U32: return length->value_u32;
+	case T_U64: return length->value_u64;
+	default: abort();
+	}
+}
+
+// a gcinfo header followed by the object, laid out like allocate's: packed, so
+// the object always starts right after the header
+static void slot_type(code_block *block, code_instruction *ins) {
+	if (ins->operation.type == O_NEW) {
+		pt_printf("<{ %%gcinfo, %%struct.%zu }>", ins->type->struct_index);
+		return;
+	}
+	pt_printf("<{ %%gcinfo, i64, [%lu x ", stack_array_length(block, ins));
+	wt(ins->type->arraytype);
+	pt_printf("] }>");
+}
+
+// loads the compressed reference at %temp.i_k into %bi_k: an offset in 8-byte
+// units from bear_heap_base, where 0 is null
+static void narrow_load(size_t i, size_t k, type *t) {
+	pt_printf("  %%narrow.%zu_%zu = load i32, i32* %%temp.%zu_%zu, align 4", i, k, i, k);
+	w_tbaa(TBAA_I32);
+	pt_printf("\n");
+	pt_printf("  %%nwide.%zu_%zu = zext i32 %%narrow.%zu_%zu to i64\n", i, k, i, k);
+	pt_printf("  %%nbytes.%zu_%zu = shl i64 %%nwide.%zu_%zu, 3\n", i, k, i, k);
+	pt_printf("  %%nbase.%zu_%zu = load i8*, i8** @bear_heap_base\n", i, k);
+	pt_printf("  %%naddr.%zu_%zu = getelementptr i8, i8* %%nbase.%zu_%zu, i64 %%nbytes.%zu_%zu\n", i, k, i, k, i, k);
+	pt_printf("  %%nnull.%zu_%zu = icmp eq i32 %%narrow.%zu_%zu, 0\n", i, k, i, k);
+	pt_printf("  %%nptr.%zu_%zu = select i1 %%nnull.%zu_%zu, i8* null, i8* %%naddr.%zu_%zu\n", i, k, i, k, i, k);
+	pt_printf("  %%b%zu_%zu = bitcast i8* %%nptr.%zu_%zu to ", i, k, i, k);
+	wt(t);
+}
+
+// the reverse of narrow_load, storing value to %temp.i_k
+static void narrow_store(size_t i, size_t k, type *t, const char *value) {
+	pt_printf("  %%nint.%zu_%zu = ptrtoint ", i, k);
+	wt(t);
+	pt_printf(" %s to i64\n", value);
+	pt_printf("  %%nbase.%zu_%zu = load i8*, i8** @bear_heap_base\n", i, k);
+	pt_printf("  %%nbint.%zu_%zu = ptrtoint i8* %%nbase.%zu_%zu to i64\n", i, k, i, k);
+	pt_printf("  %%nbytes.%zu_%zu = sub i64 %%nint.%zu_%zu, %%nbint.%zu_%zu\n", i, k, i, k, i, k);
+	pt_printf("  %%nwide.%zu_%zu = lshr i64 %%nbytes.%zu_%zu, 3\n", i, k, i, k);
+	pt_printf("  %%noff.%zu_%zu = trunc i64 %%nwide.%zu_%zu to i32\n", i, k, i, k);
+	pt_printf("  %%nnull.%zu_%zu = icmp eq i64 %%nint.%zu_%zu, 0\n", i, k, i, k);
+	pt_printf("  %%narrow.%zu_%zu = select i1 %%nnull.%zu_%zu, i32 0, i32 %%noff.%zu_%zu\n", i, k, i, k, i, k);
+	pt_printf("  store i32 %%narrow.%zu_%zu, i32* %%temp.%zu_%zu, align 4", i, k, i, k);
+	w_tbaa(TBAA_I32);
+}
+
+// a pointer to the header of the slot at name, which has slot_type
+static void slot_header(code_block *block, code_instruction *ins, size_t i, size_t k, const char *name) {
+	pt_printf("  %%hdr.%zu_%zu = getelementptr ", i, k);
+	slot_type(block, ins);
+	pt_printf(", ");
+	slot_type(block, ins);
+	pt_printf("* %s, i32 0, i32 0\n", name);
+}
+
+// fills in the header at %hdr.i_k the way allocate does, so the collector marks
+// through the object like any other: the metastruct with the current
+// unreachable mark in its low bits
+static void init_header(size_t i, size_t k, const char *meta) {
+	pt_printf("  %%hdrunr.%zu_%zu = load i32, i32* @unreachable\n", i, k);
+	pt_printf("  %%hdrmark.%zu_%zu = zext i32 %%hdrunr.%zu_%zu to i64\n", i, k, i, k);
+	pt_printf("  %%hdrword.%zu_%zu = or i64 %%hdrmark.%zu_%zu, ptrtoint (%%metastruct* %s to i64)\n", i, k, i, k, meta);
+	pt_printf("  %%hdrslot.%zu_%zu = getelementptr %%gcinfo, %%gcinfo* %%hdr.%zu_%zu, i32 0, i32 0\n", i, k, i, k);
+	pt_printf("  store i64 %%hdrword.%zu_%zu, i64* %%hdrslot.%zu_%zu, align 8", i, k, i, k);
+	w_tbaa(TBAA_HEADER);
+	pt_printf("\n");
+}
+
+// a stack slot is never on a page or in the chain, so it is never freed
+static void init_stack_slot(code_block *block, code_instruction *ins, size_t i, size_t k, const char *meta) {
+	char name[64];
+	snprintf(name, sizeof(name), "%%stack.%zu_%zu", i, k);
+	slot_header(block, ins, i, k, name);
+	init_header(i, k, meta);
+}
+
+// saves the GC roots that live across the allocation at instruction j into a
+// stack array, passed to the runtime as %passi8.i_k, and returns their count
+static size_t spill_roots(code_block *block, size_t i, size_t j, size_t *last_used_map, struct patchvar **ref) {
+	size_t offset = block->parameter_count, k = j + offset;
+	struct patchvar *strref = pt_def();
+	size_t refcnt = 0;
+	for (size_t ssa = 0; ssa < offset + block->instruction_count; ssa++) { // TODO: deduplicate
+		if (is_spilled(block, ssa, j, last_used_map)) { // might be relocated
+			type *tp = TYPEOF(ssa);
+			// TODO: make sure that string literals aren't saved
+			if (refcnt == 0) {
+				pt_printf("  %%save.%zu_%zu = call i8* @llvm.stacksave()\n", i, k);
+				pt_printf("  %%pass.%zu_%zu = alloca ", i, k);
+				pt_use(strref);
+				pt_printf("\n");
+			}
+			pt_printf("  ; save %zu (%zu - %zu - %zu)\n", ssa, ssa - offset, j, last_used_map[ssa]);
+
+			// address of saved pointer
+			pt_printf("  %%prestore.%zu_%zu_%zu = getelementptr ", i, k, refcnt);
+			pt_use(strref);
+			pt_printf(", ");
+			pt_use(strref);
+			pt_printf("* %%pass.%zu_%zu, i64 0, i32 %zu\n", i, k, refcnt);
+
+			if (tp->type == T_STRING) {
+				pt_printf("  %%int.%zu_%zu_%zu = ptrtoint ", i, k, refcnt);
+				wt(tp);
+				pt_printf(" %s to i64\n", pt_fetch(ref[ssa]));
+
+				pt_printf("  %%ord.%zu_%zu_%zu = or i64 %%int.%zu_%zu_%zu, 1\n", i, k, refcnt, i, k, refcnt);
+				pt_printf("  %%cast.%zu_%zu_%zu = inttoptr i64 %%ord.%zu_%zu_%zu to i8*\n", i, k, refcnt, i, k, refcnt)
+			} else {
+				pt_printf("  %%cast.%zu_%zu_%zu = bitcast ", i, k, refcnt);
+				wt(tp);
+				pt_printf(" %s to i8*\n", pt_fetch(ref[ssa]));
+			}
+
+			pt_printf("  store i8* %%cast.%zu_%zu_%zu, i8** %%prestore.%zu_%zu_%zu\n", i, k, refcnt, i, k, refcnt);
+			refcnt++;
+		}
+	}
+	if (refcnt) {
+		const char *single = ", i8*";
+		size_t siz = strlen(single);
+		char cr[siz * refcnt + 1];
+		for (size_t i = 0; i < refcnt; i++) {
+			strcpy(cr + siz * i, single);
+		}
+		vf(strref, "{ %s }", cr + 2); // add two to get rid of leading ", "
+		pt_printf("\n");
+	}
+	pt_printf("  %%passi8.%zu_%zu = bitcast ", i, k);
+	if (refcnt) {
+		pt_use(strref);
+		pt_printf("* %%pass.%zu_%zu to i8*\n", i, k);
+	} else {
+		pt_printf("i8* null to i8*\n");
+	}
+	return refcnt;
+}
+
+// reloads the roots saved by spill_roots, which the collector may have moved
+static void restore_roots(code_block *block, size_t i, size_t j, size_t *last_used_map, struct patchvar **ref, size_t refcnt) {
+	if (refcnt == 0) {
+		return;
+	}
+	size_t offset = block->parameter_count, k = j + offset;
+	refcnt = 0;
+	for (size_t ssa = 0; ssa < offset + block->instruction_count; ssa++) { // TODO: deduplicate
+		size_t start = ssa - offset;
+		size_t end = last_used_map[ssa];
+		type *tp = TYPEOF(ssa);
+		if (is_spilled(block, ssa, j, last_used_map)) { // might be relocated
+			// TODO: make sure that string literals aren't saved
+			pt_printf("\n  ; restore %zu (%zu - %zu - %zu)\n", ssa, start, j, end);
+			pt_printf("  %%postload.%zu_%zu_%zu = load i8*, i8** %%prestore.%zu_%zu_%zu\n", i, k, refcnt, i, k, refcnt);
+			if (tp->type == T_STRING) {
+				// strip the tag spill_roots added
+				pt_printf("  %%unint.%zu_%zu_%zu = ptrtoint i8* %%postload.%zu_%zu_%zu to i64\n", i, k, refcnt, i, k, refcnt);
+				pt_printf("  %%untag.%zu_%zu_%zu = and i64 %%unint.%zu_%zu_%zu, -2\n", i, k, refcnt, i, k, refcnt);
+				pt_printf("  %%restored.%zu_%zu.%zu = inttoptr i64 %%untag.%zu_%zu_%zu to ", i, k, ssa, i, k, refcnt);
+			} else {
+				pt_printf("  %%restored.%zu_%zu.%zu = bitcast i8* %%postload.%zu_%zu_%zu to ", i, k, ssa, i, k, refcnt);
+			}
+			wt(tp);
+			pt_printf("\n")
+			vf(ref[ssa], "%%restored.%zu_%zu.%zu", i, k, ssa);
+			refcnt++;
+		} else if ((ssa < offset || start < j) && end <= j && IS_GC_ABLE(tp)) {
+			pt_printf("  ; NOTE: busting %zu (%zu - %zu - %zu)\n", ssa, start, j, end);
+			vf(ref[ssa], "BUSTED"); // not moved forward. if this ever shows up, then maybe it should have been.
+		}
+	}
+	pt_printf("  call void @llvm.stackrestore(i8* %%save.%zu_%zu)\n", i, k);
+}
+
+// allocates the object of O_NEW at instruction j by bumping bear_heap_cursor,
+// and only calls bear_new when the page is full. The roots that call may move
+// are merged back in with phis after it.
+static void bump_object(code_block *block, code_instruction *ins, size_t i, size_t j, size_t *last_used_map, struct patchvar **ref, struct patchvar *exit_label) {
+	size_t offset = block->parameter_count, k = j + offset;
+	size_t count = offset + block->instruction_count;
+
+	// the header, then the object padded to keep the next header aligned, as
+	// object_size in the runtime has it
+	uint64_t size = (layouts[ins->type->struct_index].size + 7) & ~(uint64_t) 7;
+	pt_printf("  %%hcur.%zu_%zu = load i8*, i8** @bear_heap_cursor\n", i, k);
+	pt_printf("  %%hend.%zu_%zu = getelementptr i8, i8* %%hcur.%zu_%zu, i64 %lu\n", i, k, i, k, 8 + size);
+	pt_printf("  %%hlim.%zu_%zu = load i8*, i8** @bear_heap_limit\n", i, k);
+	pt_printf("  %%hfits.%zu_%zu = icmp ule i8* %%hend.%zu_%zu, %%hlim.%zu_%zu\n", i, k, i, k, i, k);
+	pt_printf("  br i1 %%hfits.%zu_%zu, label %%Bump%zu_%zu, label %%Refill%zu_%zu, !prof !0\n", i, k, i, k, i, k);
+
+	pt_printf("Bump%zu_%zu:\n", i, k);
+	pt_printf("  store i8* %%hend.%zu_%zu, i8** @bear_heap_cursor\n", i, k);
+	pt_printf("  %%hdr.%zu_%zu = bitcast i8* %%hcur.%zu_%zu to %%gcinfo*\n", i, k, i, k);
+	char meta[32];
+	snprintf(meta, sizeof(meta), "@meta.%zu", ins->type->struct_index);
+	init_header(i, k, meta);
+	pt_printf("  %%hraw.%zu_%zu = getelementptr i8, i8* %%hcur.%zu_%zu, i64 8\n", i, k, i, k);
+	pt_printf("  %%hobj.%zu_%zu = bitcast i8* %%hraw.%zu_%zu to ", i, k, i, k);
+	wt(ins->type);
+	pt_printf("\n");
+	pt_printf("  br label %%Alloc%zu_%zu\n", i, k);
+
+	// restore_roots replaces these, so keep the values from before the call
+	char *before[count];
+	for (size_t ssa = 0; ssa < count; ssa++) {
+		before[ssa] = is_spilled(block, ssa, j, last_used_map) ? strdup(pt_fetch(ref[ssa])) : NULL;
+	}
+
+	pt_printf("Refill%zu_%zu:\n", i, k);
+	size_t refcnt = spill_roots(block, i, j, last_used_map, ref);
+	pt_printf("  %%raw.%zu_%zu = call ccc ", i, k);
+	if (size) {
+		// the whole object, which its metastruct gives the runtime
+		pt_printf("dereferenceable(%lu) ", size);
+	}
+	pt_printf("i8* @bear_new(%%metastruct* @meta.%zu, i32 %zu, i8* %%passi8.%zu_%zu )\n", ins->type->struct_index, refcnt, i, k);
+	pt_printf("  %%hslow.%zu_%zu = bitcast i8* %%raw.%zu_%zu to ", i, k, i, k);
+	wt(ins->type);
+	pt_printf("\n");
+	restore_roots(block, i, j, last_used_map, ref, refcnt);
+	pt_printf("  br label %%Alloc%zu_%zu\n", i, k);
+
+	pt_printf("Alloc%zu_%zu:\n", i, k);
+	pt_printf("  %%b%zu_%zu = phi ", i, k);
+	wt(ins->type);
+	pt_printf(" [ %%hobj.%zu_%zu, %%Bump%zu_%zu ], [ %%hslow.%zu_%zu, %%Refill%zu_%zu ]\n", i, k, i, k, i, k, i, k);
+	for (size_t ssa = 0; ssa < count; ssa++) {
+		if (before[ssa] == NULL) {
+			continue;
+		}
+		pt_printf("  %%merged.%zu_%zu.%zu = phi ", i, k, ssa);
+		wt(TYPEOF(ssa));
+		pt_printf(" [ %s, %%Bump%zu_%zu ], [ %s, %%Refill%zu_%zu ]\n", before[ssa], i, k, pt_fetch(ref[ssa]), i, k);
+		vf(ref[ssa], "%%merged.%zu_%zu.%zu", i, k, ssa);
+		free(before[ssa]);
+	}
+	vf(exit_label, "Alloc%zu_%zu", i, k);
+}
+
+// what writing the blocks shares between the threads that do it
+struct emission {
+	code_system *system;
+	struct patchvar ***allrefs;
+	struct patchvar **exit_label;
+	bool *possibly_accessible;
+	// what each block printed, in block order
+	struct patchlist *output;
+	atomic_size_t next;
+};
+
+// writes block i, which may happen on any thread: it only fetches its own
+// values, and leaves references to other blocks' for pt_finalize to resolve
+static void write_block(struct emission *e, size_t i) {
+	code_system *system = e->system;
+	struct patchvar ***allrefs = e->allrefs;
+	struct patchvar **exit_label = e->exit_label;
+	bool *possibly_accessible = e->possibly_accessible;
+
+	code_block *block = get_code_block(system, i);
+	size_t offset = block->parameter_count;
+
+	struct patchvar **ref = allrefs[i];
+
+#define RP(n) pt_fetch(ref[ins->parameters[(n)]])
+#define TP(n) (TYPEOF(ins->parameters[(n)]))
+
+	for (size_t k = 0; k < block->parameter_count + block->instruction_count; k++) {
+		vf(ref[k], "%%b%zu_%zu", i, k);
+	}
+
+#define SET(x, ...) pt_printf("  %%b%zu_%zu = " x, i, k, __VA_ARGS__)
+#define SETR(x) SET("%s", x)
+
+	if (!possibly_accessible[i]) {
+		return;
+	}
+
+	pt_printf("Block%zu:\n", i);
+	// parameters via PHI nodes
+	for (size_t k = 0; k < offset; k++) {
+		SETR("phi ");
+		wt(block->parameters[k].field_type);
+		bool first = true;
+		for (size_t l = 0; l < system->block_count; l++) {
+			code_block *from = get_code_block(system, l);
+			// we want to limit the number of source possibilities - so we make sure the prototype matches.
+			if (possibly_accessible[l] && check_prototypes(from, block, i)) {
+				size_t sourceid = from->tail.parameters[k];
+				if (first) {
+					first = false;
+				} else {
+					pt_printf(",");
+				}
+				pt_printf(" [ ")
+				pt_use(allrefs[l][sourceid]); // this works despite the possibility of the ref changing over the course of a block because other blocks only see the final refs
+				pt_printf(", %%");
+				pt_use(exit_label[l]);
+				pt_printf(" ]");
+			}
+		}
+		pt_printf("\n");
+	}
+
+	size_t last_used_map[block->parameter_count + block->instruction_count];
+	for (size_t j = 0; j < block->parameter_count; j++) {
+		last_used_map[j] = -1;
+	}
+	for (size_t j = 0; j < block->instruction_count; j++) {
+		last_used_map[block->parameter_count + j] = j;
+	}
+	for (size_t j = 0; j < block->instruction_count; j++) {
+		code_instruction *ins = &block->instructions[j];
+
+#define ULP(x) last_used_map[ins->parameters[x]] = j;
+
+		switch (ins->operation.type) {
+		case O_LITERAL:
+		case O_BLOCKREF:
+		case O_NEW:
+			break;
+		case O_BITWISE_NOT:
+		case O_GET_FIELD:
+		case O_GET_LENGTH:
+		case O_GET_SYMBOL:
+		case O_NEGATE:
+		case O_NEW_ARRAY:
+		case O_NOT:
+			ULP(0)
+			break;
+		case O_CAST:
+			ULP(0);
+			break;
+		case O_BOUNDS_CHECK:
+		case O_COMPARE:
+		case O_GET_INDEX:
+		case O_NUMERIC:
+		case O_LOGIC:
+		case O_SHIFT:
+			ULP(0);
+			ULP(1);
+			break;
+		case O_SET_FIELD:
+			ULP(0);
+			ULP(2);
+			break;
+		case O_SET_INDEX:
+			ULP(0);
+			ULP(1);
+			ULP(2);
+			break;
+		case O_NATIVE:
+		case O_STR_CONCAT: {
+			size_t count = ins->parameters[0];
+			for (size_t i = 1; i <= count; i++) {
+				ULP(i);
+			}
+		} break;
+		case O_IDENTITY:
+		case O_INSTANCEOF:
+		case O_SET_LENGTH:
+		case O_CALL:
+		case O_FUNCTION:
+		case O_NUMERIC_ASSIGN:
+		case O_POSTFIX:
+		case O_SET_SYMBOL:
+		case O_SHIFT_ASSIGN:
+		case O_STR_CONCAT_ASSIGN:
+		case O_TERNARY:
+			abort();
+		}
+	}
+	// after the instructions, since a value the tail passes on stays live
+	// through all of them
+	if (!block->is_final) {
+		switch (block->tail.type) {
+		case GOTO:
+			last_used_map[block->tail.first_block] = block->instruction_count;
+			break;
+		case BRANCH:
+			last_used_map[block->tail.first_block] = block->instruction_count;
+			last_used_map[block->tail.second_block] = block->instruction_count;
+			last_used_map[block->tail.condition] = block->instruction_count;
+			break;
+		}
+		for (size_t p = 0; p < block->tail.parameter_count; p++) {
+			last_used_map[block->tail.parameters[p]] = block->instruction_count;
+		}
+	}
+
+	for (size_t j = 0; j < block->instruction_count; j++) {
+		size_t k = j + offset;
+		code_instruction *ins = &block->instructions[j];
+
+#ifdef TRACE_EXECUTION
+		pt_printf("    call void @bear_print_number(i64 %zu)\n", 10000 * i + 100 * j);
+#endif
+
+		switch (ins->operation.type) {
+		case O_BITWISE_NOT:
+			SETR("xor ");
+			wt(ins->type);
+			pt_printf(" %s, -1", RP(0));
+			break;
+		case O_BLOCKREF:
+			vf(ref[k], "blockaddress(@main, %%Block%zu)", ins->block_index);
+			break;
+		case O_BOUNDS_CHECK:
+			array_length(i, k, TP(0), RP(0));
+			wide_operand("chk", i, k, TP(1), RP(1));
+			// a negative signed index wraps around to a huge unsigned one
+			pt_printf("  %%inbounds.%zu_%zu = icmp ult i64 %%chk.%zu_%zu, %%len.%zu_%zu\n", i, k, i, k, i, k);
+			pt_printf("  br i1 %%inbounds.%zu_%zu, label %%Check%zu_%zu, label %%Fail%zu_%zu, !prof !0\n", i, k, i, k, i, k);
+			pt_printf("Fail%zu_%zu:\n", i, k);
+			pt_printf("  call void @bear_bounds_fail(i64 %%chk.%zu_%zu, i64 %%len.%zu_%zu)\n", i, k, i, k);
+			pt_printf("  unreachable\n");
+			pt_printf("Check%zu_%zu:", i, k);
+			vf(exit_label[i], "Check%zu_%zu", i, k);
+			break;
+		case O_CAST: {
+			const char *name = NULL;
+			switch (ins->operation.cast_type) {
+			case O_UPCAST:
+			case O_DOWNCAST: // TODO: check downcasts
+				name = "bitcast";
+				break;
+			case O_FLOAT_EXTEND:
+				name = "fpext";
+				break;
+			case O_FLOAT_TRUNCATE:
+				name = "fptrunc";
+				break;
+			case O_FLOAT_TO_SIGNED:
+				name = "fptosi";
+				break;
+			case O_FLOAT_TO_UNSIGNED:
+				name = "fptoui";
+				break;
+			case O_SIGNED_TO_FLOAT:
+				name = "sitofp";
+				break;
+			case O_UNSIGNED_TO_FLOAT:
+				name = "uitofp";
+				break;
+			case O_SIGN_EXTEND:
+				name = "sext";
+				break;
+			case O_ZERO_EXTEND:
+				name = "zext";
+				break;
+			case O_TRUNCATE:
+				name = "trunc";
+				break;
+			case O_REINTERPRET:
+				name = "bitcast";
+				break;
+			}
+			SET("%s ", name);
+			wt(TP(0));
+			pt_printf(" %s to ", RP(0));
+			wt(ins->type);
+		} break;
+		case O_COMPARE: {
+			const char *op;
+			type *left = TP(0), *right = TP(1);
+			if (left->type != right->type) {
+				fputs("comparison type mismatch\n", stderr);
+				exit(1);
+			}
+			bool is_signed = false, done = false;
+			switch (left->type) {
+			case T_S8:
+			case T_S16:
+			case T_S32:
+			case T_S64:
+				is_signed = true;
+			case T_U8:
+			case T_U16:
+			case T_U32:
+			case T_U64:
+			case T_BOOL:
+				switch (ins->operation.compare_type) {
+				case O_EQ: op = "icmp eq"; break;
+				case O_GT: op = is_signed ? "icmp sgt" : "icmp ugt"; break;
+				case O_GTE: op = is_signed ? "icmp sge" : "icmp uge"; break;
+				case O_LT: op = is_signed ? "icmp slt" : "icmp ult"; break;
+				case O_LTE: op = is_signed ? "icmp sle" : "icmp ule"; break;
+				case O_NE: op = "icmp ne"; break;
+				}
+				break;
+			case T_F32:
+			case T_F64:
+			case T_F128:
+				switch (ins->operation.compare_type) {
+				case O_EQ: op = "fcmp oeq"; break;
+				case O_GT: op = "fcmp ogt"; break;
+				case O_GTE: op = "fcmp oge"; break;
+				case O_LT: op = "fcmp olt"; break;
+				case O_LTE: op = "fcmp ole"; break;
+				case O_NE: op = "fcmp one"; break;
+				}
+				break;
+			case T_OBJECT:
+			case T_BLOCKREF:
+				switch (ins->operation.compare_type) {
+				case O_EQ: op = "icmp eq"; break;
+				case O_NE: op = "icmp ne"; break;
+				case O_GT:
+				case O_GTE:
+				case O_LT:
+				case O_LTE:
+					abort();
+				}
+				break;
+			case T_STRING:
+				switch (ins->operation.compare_type) {
+				case O_EQ:
+					SET("call i1 @bear_streq(i8* %s, i8* %s)", RP(0), RP(1));
+					done = true;
+					break;
+				case O_NE:
+					pt_printf("  %%temp.%zu_%zu = call i1 @bear_streq(i8* %s, i8* %s)\n", i, k, RP(0), RP(1));
+					SET("icmp eq i1 %%temp.%zu_%zu, 0", i, k);
+					done = true;
+					break;
+				case O_GT:
+				case O_GTE:
+				case O_LT:
+				case O_LTE: {
+					const char *cond = ins->operation.compare_type == O_GT ? "sgt"
+						: ins->operation.compare_type == O_GTE ? "sge"
+						: ins->operation.compare_type == O_LT ? "slt" : "sle";
+					pt_printf("  %%temp.%zu_%zu = call i32 @bear_strcmp(i8* %s, i8* %s)\n", i, k, RP(0), RP(1));
+					SET("icmp %s i32 %%temp.%zu_%zu, 0", cond, i, k);
+					done = true;
+				} break;
+				}
+				break;
+			default:
+				fputs("unsupported type to compare\n", stderr);
+				exit(1);
+			}
+			if (!done) {
+				SET("%s ", op);
+				wt(left);
+				pt_printf(" %s, %s", RP(0), RP(1));
+			}
+		} break;
+		case O_GET_FIELD:
+			pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
+			assert(TP(0)->type == T_OBJECT);
+			pt_printf("%%struct.%zu, ", TP(0)->struct_index);
+			wt(TP(0));
+			pt_printf(" %s, i64 0, i32 %zu\n", RP(0), layouts[TP(0)->struct_index].position[ins->parameters[1]]);
+
+			if (is_narrow(ins->type)) {
+				narrow_load(i, k, ins->type);
+				break;
+			}
+			SETR("load ");
+			wt(ins->type);
+			pt_printf(", ");
+			wt(ins->type);
+			pt_printf("* %%temp.%zu_%zu, align %lu", i, k, type_align(ins->type));
+			w_tbaa(tbaa_of(ins->type));
+			break;
+		case O_GET_INDEX:
+			assert(TP(0)->type == T_ARRAY || TP(0)->type == T_STRING);
+			array_element(i, k, ins->type, RP(0), TP(0), TP(1), RP(1), exit_label[i]);
+
+			SETR("load ");
+			wt(ins->type);
+			pt_printf(", ");
+			wt(ins->type);
+			pt_printf("* %%elem.%zu_%zu, align %lu", i, k, type_align(ins->type));
+			w_tbaa(tbaa_of(ins->type));
+			break;
+		case O_GET_LENGTH:
+			array_length(i, k, TP(0), RP(0));
+			SET("trunc i64 %%len.%zu_%zu to i32", i, k);
+			break;
+		case O_GET_SYMBOL:
+			// TODO: fix
+			SET("%s", RP(0));
+			break;
+		case O_LITERAL:
+		switch (ins->type->type) {
+			case T_ARRAY:
+			case T_BLOCKREF:
+			case T_F32:
+			case T_F64:
+			case T_F128:
+			case T_REF:
+			case T_S8:
+			case T_S16:
+			case T_S32:
+			case T_S64:
+			case T_VOID:
+			default:
+				abort();
+			case T_BOOL:
+				vf(ref[k], ins->value_bool ? "true" : "false");
+				break;
+			case T_OBJECT:
+				vf(ref[k], "null");
+				break;
+			case T_STRING: {
+				size_t len = strlen(system->strings[ins->string_index]) + 8;
+				SET("getelementptr [%zu x i8], [%zu x i8]* @str.%zu, i64 0, i64 0", len, len, ins->string_index);
+				break;
+			}
+			case T_U8:
+				vf(ref[k], "%hhu", ins->value_u8);
+				break;
+			case T_U16:
+				vf(ref[k], "%hu", ins->value_u16);
+				break;
+			case T_U32:
+				vf(ref[k], "%u", ins->value_u32);
+				break;
+			case T_U64:
+				vf(ref[k], "%lu", ins->value_u64);
+				break;
+			}
+			break;
+		case O_LOGIC: {
+			pt_printf("  %%a.%zu = icmp ne ", k);
+			wt(TP(0));
+			pt_printf(" %s, 0\n", RP(0));
+
+			pt_printf("  %%b.%zu = icmp ne ", k);
+			wt(TP(1));
+			pt_printf(" %s, 0\n", RP(1));
+
+			switch (ins->operation.logic_type) {
+			case O_AND:
+				SETR("and");
+				break;
+			case O_OR:
+				SETR("or");
+				break;
+			case O_XOR:
+				SETR("xor");
+				break;
+			default:
+				abort();
+			}
+			pt_printf(" i1 %%a.%zu, %%b.%zu", k, k);
+		} break;
+		case O_NATIVE: {
+			if (is_bulk_native(ins->native_call)) {
+				lower_intrinsic(block, ins, i, k, ref, exit_label[i]);
+				break;
+			}
+			if (is_void(ins->type)) {
+				pt_printf("  call void");
+			} else {
+				SETR("call ");
+				wt(ins->type);
+			}
+			pt_printf(" @%s(", ins->native_call);
+			size_t count = ins->parameters[0];
+			if (count) {
+				wt(TP(1));
+				pt_printf(" %s", RP(1));
+				for (size_t i = 2; i <= count; i++) {
+					pt_printf(", ");
+					wt(TP(i));
+					pt_printf(" %s", RP(i));
+				}
+			}
+			pt_printf(")");
+		} break;
+		case O_NEGATE:
+			SETR("sub ");
+			wt(ins->type);
+			pt_printf(" 0, %s", RP(0));
+			break;
+		case O_NEW: { // TODO: check with GC before save-restoring to see if we need to.
+			if (ins->operation.allocation_type == O_STACK) {
+				char meta[32];
+				snprintf(meta, sizeof(meta), "@meta.%zu", ins->type->struct_index);
+				init_stack_slot(block, ins, i, k, meta);
+				SETR("getelementptr ");
+				slot_type(block, ins);
+				pt_printf(", ");
+				slot_type(block, ins);
+				pt_printf("* %%stack.%zu_%zu, i32 0, i32 1", i, k);
+				break;
+			}
+			bump_object(block, ins, i, j, last_used_map, ref, exit_label[i]);
+		} break;
+		case O_NEW_ARRAY: {
+			type *et = ins->type->arraytype;
+			int kind = et->type == T_STRING ? ARRAY_STRING
+				: IS_GC_ABLE(et) ? ARRAY_OBJECT : ARRAY_PRIMITIVE;
+
+			if (ins->operation.allocation_type == O_STACK) {
+				char meta[96];
+				snprintf(meta, sizeof(meta), "getelementptr ([4 x %%metastruct], [4 x %%metastruct]* @array_meta, i64 0, i64 %d)", kind);
+				init_stack_slot(block, ins, i, k, meta);
+				uint64_t length = stack_array_length(block, ins);
+				pt_printf("  %%stlen.%zu_%zu = getelementptr ", i, k);
+				slot_type(block, ins);
+				pt_printf(", ");
+				slot_type(block, ins);
+				pt_printf("* %%stack.%zu_%zu, i32 0, i32 1\n", i, k);
+				pt_printf("  store i64 %lu, i64* %%stlen.%zu_%zu, align 8", length, i, k);
+				w_tbaa(TBAA_LENGTH);
+				pt_printf("\n");
+				// elements start out zero, as on the heap
+				pt_printf("  %%stelems.%zu_%zu = getelementptr ", i, k);
+				slot_type(block, ins);
+				pt_printf(", ");
+				slot_type(block, ins);
+				pt_printf("* %%stack.%zu_%zu, i32 0, i32 2\n", i, k);
+				pt_printf("  store [%lu x ", length);
+				wt(et);
+				pt_printf("] zeroinitializer, [%lu x ", length);
+				wt(et);
+				pt_printf("]* %%stelems.%zu_%zu\n", i, k);
+				SET("bitcast i64* %%stlen.%zu_%zu to i8*", i, k);
+				break;
+			}
+
+			wide_operand("size", i, k, TP(0), RP(0));
+			size_t refcnt = spill_roots(block, i, j, last_used_map, ref);
+			SETR("call ccc i8* @bear_new_array(i64 ptrtoint (");
+			wt(et);
+			pt_printf("* getelementptr (");
+			wt(et);
+			pt_printf(", ");
+			wt(et);
+			pt_printf("* null, i32 1) to i64), i8 %d, i64 %%size.%zu_%zu, i32 %zu, i8* %%passi8.%zu_%zu)\n", kind, i, k, refcnt, i, k);
+			restore_roots(block, i, j, last_used_map, ref, refcnt);
+		} break;
+		case O_NOT:
+			SETR("icmp eq ");
+			wt(TP(0));
+			pt_printf(" %s, 0", RP(0));
+			break;
+		case O_NUMERIC: {
+			const char *op;
+			switch (ins->operation.numeric_type) {
+			case O_ADD: op = "add"; break;
+			case O_BAND: op = "and"; break;
+			case O_BOR: op = "or"; break;
+			case O_BXOR: op = "xor"; break;
+			case O_DIV: op = "udiv"; break; // TODO: check signs
+			case O_MOD: op = "urem"; break; // TODO: check signs
+			case O_MUL: op = "mul"; break;
+			case O_SUB: op = "sub"; break;
+			default: abort();
+			}
+			SET("%s ", op);
+			wt(ins->type);
+			pt_printf(" %s, %s", RP(0), RP(1));
+		} break;
+		case O_SET_FIELD:
+			pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
+			type *t = TP(0);
+			if (t->type != T_OBJECT) {
+				fprintf(stderr, "expected object in SET_FIELD");
+				abort();
+			}
+			pt_printf("%%struct.%zu, ", t->struct_index);
+			wt(t);
+			pt_printf(" %s, i64 0, i32 %zu\n", RP(0), layouts[TP(0)->struct_index].position[ins->parameters[1]]);
+
+			type *ft = get_code_struct(system, t->struct_index)->fields[ins->parameters[1]].field_type;
+
+			if (is_narrow(ft)) {
+				narrow_store(i, k, ft, RP(2));
+				break;
+			}
+			pt_printf("  store ");
+			wt(ft);
+			pt_printf(" %s, ", RP(2));
+			wt(ft);
+			pt_printf("* %%temp.%zu_%zu, align %lu", i, k, type_align(ft));
+			w_tbaa(tbaa_of(ft));
+			break;
+		case O_SET_INDEX: {
+			type *at = TP(0);
+			if (at->type != T_ARRAY) {
+				fprintf(stderr, "expected array in SET_INDEX");
+				abort();
+			}
+
+			type *et = at->arraytype;
+			array_element(i, k, et, RP(0), at, TP(1), RP(1), exit_label[i]);
+
+			pt_printf("  store ");
+			wt(et);
+			pt_printf(" %s, ", RP(2));
+			wt(et);
+			pt_printf("* %%elem.%zu_%zu, align %lu", i, k, type_align(et));
+			w_tbaa(tbaa_of(et));
+		} break;
+		case O_SET_LENGTH:
+			fputs("array resizing not implemented\n", stderr);
+			exit(1);
+		case O_SHIFT: {
+			const char *op;
+			switch (ins->operation.shift_type) {
+			case O_LSHIFT:
+				op = "shl";
+				break;
+			case O_ASHIFT:
+				op = "ashr";
+				break;
+			case O_RSHIFT:
+				op = "lshr";
+				break;
+			default:
+				abort();
+			}
+			SET("%s ", op);
+			wt(ins->type);
+			pt_printf(" %s, %s", RP(0), RP(1));
+		} break;
+		case O_STR_CONCAT: {
+			// the parts go to the runtime in a stack array, which it also
+			// treats as roots
+			size_t count = ins->parameters[0];
+			pt_printf("  %%csave.%zu_%zu = call i8* @llvm.stacksave()\n", i, k);
+			pt_printf("  %%parts.%zu_%zu = alloca [%zu x i8*]\n", i, k, count);
+			for (size_t p = 0; p < count; p++) {
+				pt_printf("  %%part.%zu_%zu_%zu = getelementptr [%zu x i8*], [%zu x i8*]* %%parts.%zu_%zu, i64 0, i64 %zu\n", i, k, p, count, count, i, k, p);
+				pt_printf("  store i8* %s, i8** %%part.%zu_%zu_%zu\n", RP(p + 1), i, k, p);
+			}
+			pt_printf("  %%partsp.%zu_%zu = bitcast [%zu x i8*]* %%parts.%zu_%zu to i8**\n", i, k, count, i, k);
+			size_t refcnt = spill_roots(block, i, j, last_used_map, ref);
+			SETR("call ccc i8* @");
+			pt_printf("%s(i8** %%partsp.%zu_%zu, i64 %zu, i32 %zu, i8* %%passi8.%zu_%zu)\n",
+				ins->operation.concat_type == O_APPEND ? "bear_string_append" : "bear_string_concat",
+				i, k, count, refcnt, i, k);
+			restore_roots(block, i, j, last_used_map, ref, refcnt);
+			pt_printf("  call void @llvm.stackrestore(i8* %%csave.%zu_%zu)", i, k);
+		} break;
+		case O_IDENTITY:
+		case O_INSTANCEOF:
+		case O_CALL:
+		case O_FUNCTION:
+		case O_NUMERIC_ASSIGN:
+		case O_POSTFIX:
+		case O_SET_SYMBOL:
+		case O_SHIFT_ASSIGN:
+		case O_STR_CONCAT_ASSIGN:
+		case O_TERNARY:
+			abort();
+		}
+		pt_printf("\n");
+	}
+
+	if (block->is_final) {
+		pt_printf("  br label %%Done\n");
+	} else {
+		bool needs_indirection = true;
+		switch (block->tail.type) {
+		case GOTO: {
+			if (block->tail.first_block >= offset
+			 && block->instructions[block->tail.first_block - offset].operation.type == O_BLOCKREF) {
+				pt_printf("  br label %%Block%zu\n", block->instructions[block->tail.first_block - offset].block_index);
+				needs_indirection = false;
+			} else {
+				pt_printf("  indirectbr i8* %s, [ ", pt_fetch(ref[block->tail.first_block]));
+			}
+		} break;
+		case BRANCH: {
+			if (block->tail.first_block >= offset
+			 && block->tail.second_block >= offset
+			 && block->instructions[block->tail.first_block - offset].operation.type == O_BLOCKREF
+			 && block->instructions[block->tail.second_block - offset].operation.type == O_BLOCKREF) {
+				pt_printf("  br i1 %s, label %%Block%zu, label %%Block%zu\n",
+				   pt_fetch(ref[block->tail.condition]),
+				   block->instructions[block->tail.first_block - offset].block_index,
+				   block->instructions[block->tail.second_block - offset].block_index);
+				needs_indirection = false;
+			} else {
+				pt_printf("  %%brtarget = select i1 %s, i8* %s, i8* %s\n",
+				   pt_fetch(ref[block->tail.condition]),
+				   pt_fetch(ref[block->tail.first_block]),
+				   pt_fetch(ref[block->tail.second_block]));
+				pt_printf("  indirectbr i8* %%brtarget, [ ");
+			}
+		} break;
+		}
+		if (needs_indirection) {
+			bool first = true;
+			for (size_t j = 0; j < system->block_count; j++) {
+				if (check_prototypes(block, get_code_block(system, j), j)) {
+					if (first) {
+						first = false;
+					} else {
+						pt_printf(", ");
+					}
+					pt_printf("label %%Block%zu", j);
+				}
+			}
+			pt_printf(" ]\n");
+		}
+	}
+}
+
+static void *write_some_blocks(void *data) {
+	struct emission *e = data;
+	for (;;) {
+		size_t i = atomic_fetch_add(&e->next, 1);
+		if (i >= e->system->block_count) {
+			return NULL;
+		}
+		write_block(e, i);
+		pt_take(&e->output[i]);
+	}
+}
+
+// Writes the blocks on a thread per core. They're independent apart from the
+// phis, which only name other blocks' values for pt_finalize to fill in. Each
+// thread prints to its own patch list and the blocks are joined back in order
+// afterwards, so the module is the same whichever thread wrote what.
+static void write_blocks(struct emission *e) {
+	size_t count = e->system->block_count;
+	struct patchlist prelude;
+	pt_take(&prelude);
+
+	e->output = malloc(sizeof(struct patchlist) * count);
+	if (e->output == NULL) {
+		fputs("alloc failed\n", stderr);
+		exit(1);
+	}
+	atomic_init(&e->next, 0);
+
+	// this thread writes blocks too
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t helpers = cores > 1 ? (size_t) cores - 1 : 0;
+	if (helpers > count) {
+		helpers = count;
+	}
+	pthread_t threads[helpers + 1];
+	size_t started = 0;
+	while (started < helpers &&
+			pthread_create(&threads[started], NULL, write_some_blocks, e) == 0) {
+		started++;
+	}
+	write_some_blocks(e);
+	for (size_t t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	pt_append(&prelude);
+	for (size_t i = 0; i < count; i++) {
+		pt_append(&e->output[i]);
+	}
+	free(e->output);
+}
+
 void backend_write(code_system *system, FILE *out) {
 	pt_reset();
 
 	pt_printf("target datalayout = \"e-m:e-i64:64-f80:128-n8:16:32:64-S128\"\n"
 		 "target triple = \"x86_64-unknown-linux-gnu\"\n\n\n");
 
-	// metafield: linked list: offset of field, is field a string, next
-	pt_printf("%%metafield = type { i32, i8, %%metafield* }\n");
+	// metastruct: object length, struct id, offset of the references, then how
+	// many of them are objects or arrays and how many are strings, and the
+	// offset and count of the compressed references
+	pt_printf("%%metastruct = type { i32, i32, i32, i16, i16, i32, i32, %%metastruct* }\n");
+
+	// gcinfo: the metastruct and the mark bits in one word, ahead of every object
+	pt_printf("%%gcinfo = type { i64 }\n");
+	pt_printf("@array_meta = external global [4 x %%metastruct]\n");
+	pt_printf("@unreachable = external global i32\n");
+	pt_printf("@bear_heap_cursor = external global i8*\n");
+	pt_printf("@bear_heap_limit = external global i8*\n");
+	pt_printf("@bear_heap_base = external global i8*\n");
 
-	// metastruct: OBJECT_LENGTH, STRUCT_ID, metanode*
-	pt_printf("%%metastruct = type { i32, i32, %%metafield* }\n");
+	layouts = layout_structs(system);
 
 	if (system->struct_count) {
 		for (size_t i = 0; i < system->struct_count; i++) {
 			code_struct *str = get_code_struct(system, i);
+			struct layout *layout = &layouts[i];
 
-			size_t mf_count = 0;
-			for (size_t j = 0; j < str->field_count; j++) {
-				type *type = str->fields[j].field_type;
-				if (IS_GC_ABLE(type)) {
-					mf_count++;
-				}
-			}
-			size_t mfi = 0;
 			pt_printf("%%struct.%zu = type { ", i);
-			for (size_t j = 0; j < str->field_count; j++) {
-				if (j != 0) {
+			for (size_t p = 0; p < str->field_count; p++) {
+				if (p != 0) {
 					pt_printf(", ");
 				}
-				wt(str->fields[j].field_type);
+				wt_field(str->fields[layout->order[p]].field_type);
 			}
 			pt_printf(" }\n");
 			pt_printf("; types: ");
@@ -134,41 +1346,35 @@ void backend_write(code_system *system, FILE *out) {
 				pt_printf("%u ", str->fields[j].field_type->type);
 			}
 			pt_printf("\n")
-			for (size_t j = 0; j < str->field_count; j++) {
-				type *type = str->fields[j].field_type;
-				if (IS_GC_ABLE(type)) {
-					pt_printf("@mf.%zu_%zu = unnamed_addr constant %%metafield { i32 ptrtoint(", i, mfi);
-					wt(type);
-					pt_printf("* getelementptr(%%struct.%zu, %%struct.%zu* inttoptr(i32 0 to %%struct.%zu*), i64 0, i32 %zu) to i32), ", i, i, i, j);
-					if (type->type == T_OBJECT) {
-						pt_printf("i8 0, ");
-					} else if (type->type == T_STRING) {
-						pt_printf("i8 1, ");
-					} else {
-						abort();
-					}
-					mfi++;
-					if (mfi == mf_count) { // we're the last
-						pt_printf("%%metafield* null }\n");
-					} else {
-						pt_printf("%%metafield* @mf.%zu_%zu }\n", i, mfi);
-					}
-				}
-			}
-			pt_printf("@meta.%zu = unnamed_addr constant %%metastruct { i32 ", i);
-			pt_printf("ptrtoint(%%struct.%zu* getelementptr(%%struct.%zu, %%struct.%zu* inttoptr(i32 0 to %%struct.%zu*), i64 1) to i32), ", i, i, i, i);
-			pt_printf("i32 %zu, ", i);
-			if (mf_count == 0) {
-				pt_printf("%%metafield* null }\n");
+			// the header keeps the mark in the low bits of this address
+			pt_printf("@meta.%zu = unnamed_addr constant %%metastruct { i32 %lu, i32 %zu, i32 %lu, i16 %zu, i16 %zu, i32 %lu, i32 %zu, %%metastruct* ",
+				i, layout->size, i, layout->refs, layout->object_refs, layout->string_refs,
+				layout->narrow, layout->narrow_refs);
+			if (str->has_parent) {
+				pt_printf("@meta.%zu", str->parent_index);
 			} else {
-				pt_printf("%%metafield* @mf.%zu_0 }\n", i);
+				pt_printf("null");
 			}
+			pt_printf(" }, align 8\n");
 		}
 		pt_printf("\n\n");
 	}
 
-	pt_printf("declare i8* @bear_new(%%metastruct*, i32, i8*) nounwind\n");
-	pt_printf("declare i1 @bear_streq(i8*, i8*) nounwind\n");
+	// allocations are fresh and never null; an array has its length word at
+	// least, and each bear_new call adds the size of its object
+	pt_printf("declare noalias nonnull i8* @bear_new(%%metastruct*, i32, i8*) nounwind\n");
+	pt_printf("declare void @bear_compress_refs() nounwind\n");
+	pt_printf("declare noalias nonnull dereferenceable(8) i8* @bear_new_array(i64, i8, i64, i32, i8*) nounwind\n");
+	pt_printf("declare void @bear_bounds_fail(i64, i64) noreturn nounwind cold\n");
+	pt_printf("declare void @bear_range_fail(i64, i64, i64) noreturn nounwind cold\n");
+	pt_printf("declare void @llvm.memmove.p0i8.p0i8.i64(i8* nocapture, i8* nocapture readonly, i64, i1 immarg)\n");
+	pt_printf("declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1 immarg)\n");
+	pt_printf("declare i32 @memcmp(i8* nocapture, i8* nocapture, i64) nounwind readonly\n");
+	pt_printf("declare i1 @bear_streq(i8*, i8*) nounwind readonly\n");
+	pt_printf("declare i32 @bear_strcmp(i8*, i8*) nounwind readonly\n");
+	// either may hand back one of the parts, so the result isn't noalias
+	pt_printf("declare nonnull dereferenceable(8) i8* @bear_string_concat(i8**, i64, i32, i8*) nounwind\n");
+	pt_printf("declare nonnull dereferenceable(8) i8* @bear_string_append(i8**, i64, i32, i8*) nounwind\n");
 
 	pt_printf("declare i8* @llvm.stacksave()\n");
 	pt_printf("declare void @llvm.stackrestore(i8* %%ptr)\n\n");
@@ -180,14 +1386,12 @@ void backend_write(code_system *system, FILE *out) {
 		exit(1);
 	}
 
-#define TYPEOF(x) ((x) < block->parameter_count ? block->parameters[x].field_type : block->instructions[x - block->parameter_count].type)
-
-	// constant and prototype extraction
+	// prototype extraction
 	for (size_t i = 0; i < system->block_count; i++) {
 		code_block *block = get_code_block(system, i);
 		for (size_t j = 0; j < block->instruction_count; j++) {
 			code_instruction *insr = &block->instructions[j];
-			if (insr->operation.type == O_NATIVE) {
+			if (insr->operation.type == O_NATIVE && !is_bulk_native(insr->native_call)) {
 				char *name = insr->native_call;
 				bool found = false;
 				for (size_t k = 0; k < natid; k++) {
@@ -212,30 +1416,61 @@ void backend_write(code_system *system, FILE *out) {
 							wt(TYPEOF(insr->parameters[k]));
 						}
 					}
-					pt_printf(") nounwind\n")
+					pt_printf(") nounwind%s\n", native_attributes(name));
 				}
-			} else if (insr->operation.type == O_LITERAL && insr->type->type == T_STRING) {
-				pt_printf("@str_%zu_%zu = private unnamed_addr constant [%zu x i8] c\"", i, j, strlen(insr->value_string) + 8);
-				// TODO: check endianness
-				uint64_t len = strlen(insr->value_string) | 0x8000000000000000; // specify that it's statically-allocated.
-				pt_printf("\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx", (uint8_t) len, (uint8_t) (len >> 8), (uint8_t) (len >> 16), (uint8_t) (len >> 24), (uint8_t) (len >> 32), (uint8_t) (len >> 40), (uint8_t) (len >> 48), (uint8_t) (len >> 56));
-				for (char *s = insr->value_string; *s; s++) {
-					char c = *s;
-					if (c >= 32 && c <= 126 && c != '"' && c != '\\') {
-						pt_printf("%c", c);
-					} else {
-						pt_printf("\\%02hhx", c);
-					}
-				}
-				pt_printf("\"\n");
 			}
 		}
 	}
 
+	// one constant per distinct literal, aligned for the length load
+	for (size_t n = 0; n < system->string_count; n++) {
+		char *value = system->strings[n];
+		pt_printf("@str.%zu = private unnamed_addr constant [%zu x i8] c\"", n, strlen(value) + 8);
+		// TODO: check endianness
+		uint64_t len = strlen(value) | STRING_STATIC;
+		pt_printf("\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx\\%02hhx", (uint8_t) len, (uint8_t) (len >> 8), (uint8_t) (len >> 16), (uint8_t) (len >> 24), (uint8_t) (len >> 32), (uint8_t) (len >> 40), (uint8_t) (len >> 48), (uint8_t) (len >> 56));
+		for (char *s = value; *s; s++) {
+			char c = *s;
+			if (c >= 32 && c <= 126 && c != '"' && c != '\\') {
+				pt_printf("%c", c);
+			} else {
+				pt_printf("\\%02hhx", c);
+			}
+		}
+		pt_printf("\", align 8\n");
+	}
+
+	// the runtime seeds its intern table with these, see bear_string_intern
+	pt_printf("@bear_literal_count = constant i64 %zu\n", system->string_count);
+	pt_printf("@bear_literals = constant [%zu x i8*] [", system->string_count);
+	for (size_t n = 0; n < system->string_count; n++) {
+		size_t len = strlen(system->strings[n]) + 8;
+		pt_printf("%si8* getelementptr ([%zu x i8], [%zu x i8]* @str.%zu, i64 0, i64 0)", n ? ", " : "", len, len, n);
+	}
+	pt_printf("]\n");
+
 	pt_printf("\ndefine i32 @main() gc \"\" {\n");
+	if (compressed_refs) {
+		// reserves the region the references are offsets into
+		pt_printf("  call void @bear_compress_refs()\n");
+	}
+	// one slot per stack allocation site, see allocate_on_stack
+	for (size_t i = 0; i < system->block_count; i++) {
+		code_block *block = get_code_block(system, i);
+		for (size_t j = 0; j < block->instruction_count; j++) {
+			code_instruction *ins = &block->instructions[j];
+			if (is_stack_allocation(ins)) {
+				pt_printf("  %%stack.%zu_%zu = alloca ", i, j + block->parameter_count);
+				slot_type(block, ins);
+				pt_printf(", align 8\n");
+			}
+		}
+	}
 	pt_printf("  br label %%Block0\n");
 
 	struct patchvar **allrefs[system->block_count];
+	// the label each block finishes in, which its successors' phis refer to
+	struct patchvar *exit_label[system->block_count];
 
 	for (size_t i = 0; i < system->block_count; i++) {
 		code_block *block = get_code_block(system, i);
@@ -248,652 +1483,61 @@ void backend_write(code_system *system, FILE *out) {
 		for (size_t j = 0; j < len; j++) {
 			allrefs[i][j] = pt_def();
 		}
+		exit_label[i] = pt_def();
+		vf(exit_label[i], "Block%zu", i);
 	}
 
+	// a block is only accessible from blocks that are themselves accessible, so
+	// iterate until no more blocks are found - otherwise an unused function
+	// would be emitted with phis that have no incoming values
 	bool possibly_accessible[system->block_count];
 	for (size_t i = 0; i < system->block_count; i++) {
-		code_block *block = get_code_block(system, i);
-
-		bool any_possible_sources = false;
-		if (i == 0) {
-			any_possible_sources = true;
-		} else {
-			for (size_t k = 0; k < system->block_count; k++) {
-				if (check_prototypes(get_code_block(system, k), block, i)) {
-					any_possible_sources = true;
-					break;
-				}
-			}
-		}
-
-		possibly_accessible[i] = any_possible_sources;
+		possibly_accessible[i] = i == 0;
 	}
 
-	for (size_t i = 0; i < system->block_count; i++) {
-		code_block *block = get_code_block(system, i);
-		size_t offset = block->parameter_count;
-
-		struct patchvar **ref = allrefs[i];
-
-#define RP(n) pt_fetch(ref[ins->parameters[(n)]])
-#define TP(n) (TYPEOF(ins->parameters[(n)]))
-
-		for (size_t k = 0; k < block->parameter_count + block->instruction_count; k++) {
-			vf(ref[k], "%%b%zu_%zu", i, k);
-		}
-
-#define SET(x, ...) pt_printf("  %%b%zu_%zu = " x, i, k, __VA_ARGS__)
-#define SETR(x) SET("%s", x)
-
-		if (!possibly_accessible[i]) {
-			continue;
-		}
-
-		pt_printf("Block%zu:\n", i);
-		// parameters via PHI nodes
-		for (size_t k = 0; k < offset; k++) {
-			SETR("phi ");
-			wt(block->parameters[k].field_type);
-			bool first = true;
-			for (size_t l = 0; l < system->block_count; l++) {
-				code_block *from = get_code_block(system, l);
-				// we want to limit the number of source possibilities - so we make sure the prototype matches.
-				if (possibly_accessible[l] && check_prototypes(from, block, i)) {
-					size_t sourceid = from->tail.parameters[k];
-					if (first) {
-						first = false;
-					} else {
-						pt_printf(",");
-					}
-					pt_printf(" [ ")
-					pt_use(allrefs[l][sourceid]); // this works despite the possibility of the ref changing over the course of a block because other blocks only see the final refs
-					pt_printf(", %%Block%zu ]", l);
-				}
+	bool found_accessible;
+	do {
+		found_accessible = false;
+		for (size_t i = 1; i < system->block_count; i++) {
+			if (possibly_accessible[i]) {
+				continue;
 			}
-			pt_printf("\n");
-		}
-
-		size_t last_used_map[block->parameter_count + block->instruction_count];
-		for (size_t j = 0; j < block->parameter_count; j++) {
-			last_used_map[j] = -1;
-		}
-		for (size_t j = 0; j < block->instruction_count; j++) {
-			last_used_map[block->parameter_count + j] = j;
-		}
-		if (!block->is_final) {
-			switch (block->tail.type) {
-			case GOTO:
-				last_used_map[block->tail.first_block] = block->instruction_count;
-				break;
-			case BRANCH:
-				last_used_map[block->tail.first_block] = block->instruction_count;
-				last_used_map[block->tail.second_block] = block->instruction_count;
-				break;
-			}
-		}
-		for (size_t j = 0; j < block->instruction_count; j++) {
-			code_instruction *ins = &block->instructions[j];
-
-#define ULP(x) last_used_map[ins->parameters[x]] = j;
 
-			switch (ins->operation.type) {
-			case O_LITERAL:
-			case O_BLOCKREF:
-			case O_NEW:
-			case O_NEW_ARRAY:
-				break;
-			case O_BITWISE_NOT:
-			case O_GET_FIELD:
-			case O_GET_SYMBOL:
-			case O_NEGATE:
-			case O_NOT:
-				ULP(0)
-				break;
-			case O_CAST:
-				ULP(0);
-				break;
-			case O_COMPARE:
-			case O_GET_INDEX:
-			case O_NUMERIC:
-			case O_LOGIC:
-			case O_SHIFT:
-				ULP(0);
-				ULP(1);
-				break;
-			case O_SET_FIELD:
-				ULP(0);
-				ULP(2);
-				break;
-			case O_SET_INDEX:
-				ULP(0);
-				ULP(1);
-				ULP(2);
-				break;
-			case O_NATIVE: {
-				size_t count = ins->parameters[0];
-				for (size_t i = 1; i <= count; i++) {
-					ULP(i);
+			code_block *block = get_code_block(system, i);
+			for (size_t k = 0; k < system->block_count; k++) {
+				if (possibly_accessible[k] && check_prototypes(get_code_block(system, k), block, i)) {
+					possibly_accessible[i] = true;
+					found_accessible = true;
+					break;
 				}
-			} break;
-			case O_IDENTITY:
-			case O_INSTANCEOF:
-			case O_STR_CONCAT:
-			case O_CALL:
-			case O_FUNCTION:
-			case O_NUMERIC_ASSIGN:
-			case O_POSTFIX:
-			case O_SET_SYMBOL:
-			case O_SHIFT_ASSIGN:
-			case O_STR_CONCAT_ASSIGN:
-			case O_TERNARY:
-				abort();
 			}
 		}
+	} while (found_accessible);
 
-		for (size_t j = 0; j < block->instruction_count; j++) {
-			size_t k = j + offset;
-			code_instruction *ins = &block->instructions[j];
-
-#ifdef TRACE_EXECUTION
-			pt_printf("    call void @bear_print_number(i64 %zu)\n", 10000 * i + 100 * j);
-#endif
-
-			switch (ins->operation.type) {
-			case O_BITWISE_NOT:
-				SETR("xor ");
-				wt(ins->type);
-				pt_printf(" %s, -1", RP(0));
-				break;
-			case O_BLOCKREF:
-				vf(ref[k], "blockaddress(@main, %%Block%zu)", ins->block_index);
-				break;
-			case O_CAST: {
-				const char *name = NULL;
-				switch (ins->operation.cast_type) {
-				case O_UPCAST:
-				case O_DOWNCAST: // TODO: check downcasts
-					name = "bitcast";
-					break;
-				case O_FLOAT_EXTEND:
-					name = "fpext";
-					break;
-				case O_FLOAT_TRUNCATE:
-					name = "fptrunc";
-					break;
-				case O_FLOAT_TO_SIGNED:
-					name = "fptosi";
-					break;
-				case O_FLOAT_TO_UNSIGNED:
-					name = "fptoui";
-					break;
-				case O_SIGNED_TO_FLOAT:
-					name = "sitofp";
-					break;
-				case O_UNSIGNED_TO_FLOAT:
-					name = "uitofp";
-					break;
-				case O_SIGN_EXTEND:
-					name = "sext";
-					break;
-				case O_ZERO_EXTEND:
-					name = "zext";
-					break;
-				case O_TRUNCATE:
-					name = "trunc";
-					break;
-				case O_REINTERPRET:
-					name = "bitcast";
-					break;
-				}
-				SET("%s ", name);
-				wt(TP(0));
-				pt_printf(" %s to ", RP(0));
-				wt(ins->type);
-			} break;
-			case O_COMPARE: {
-				const char *op;
-				type *left = TP(0), *right = TP(1);
-				if (left->type != right->type) {
-					fputs("comparison type mismatch\n", stderr);
-					exit(1);
-				}
-				bool is_signed = false, done = false;
-				switch (left->type) {
-				case T_S8:
-				case T_S16:
-				case T_S32:
-				case T_S64:
-					is_signed = true;
-				case T_U8:
-				case T_U16:
-				case T_U32:
-				case T_U64:
-				case T_BOOL:
-					switch (ins->operation.compare_type) {
-					case O_EQ: op = "icmp eq"; break;
-					case O_GT: op = is_signed ? "icmp sgt" : "icmp ugt"; break;
-					case O_GTE: op = is_signed ? "icmp sge" : "icmp uge"; break;
-					case O_LT: op = is_signed ? "icmp slt" : "icmp ult"; break;
-					case O_LTE: op = is_signed ? "icmp sle" : "icmp ule"; break;
-					case O_NE: op = "icmp ne"; break;
-					}
-					break;
-				case T_F32:
-				case T_F64:
-				case T_F128:
-					switch (ins->operation.compare_type) {
-					case O_EQ: op = "fcmp oeq"; break;
-					case O_GT: op = "fcmp ogt"; break;
-					case O_GTE: op = "fcmp oge"; break;
-					case O_LT: op = "fcmp olt"; break;
-					case O_LTE: op = "fcmp ole"; break;
-					case O_NE: op = "fcmp one"; break;
-					}
-					break;
-				case T_OBJECT:
-				case T_BLOCKREF:
-					switch (ins->operation.compare_type) {
-					case O_EQ: op = "icmp eq"; break;
-					case O_NE: op = "icmp ne"; break;
-					case O_GT:
-					case O_GTE:
-					case O_LT:
-					case O_LTE:
-						abort();
-					}
-					break;
-				case T_STRING:
-					switch (ins->operation.compare_type) {
-					case O_EQ:
-						SET("call i1 @bear_streq(i8* %s, i8* %s)", RP(0), RP(1));
-						done = true;
-						break;
-					case O_NE:
-						pt_printf("  %%temp.%zu_%zu = call i1 @bear_streq(i8* %s, i8* %s)\n", i, k, RP(0), RP(1));
-						SET("icmp eq i1 %%temp.%zu_%zu, 0", i, k);
-						done = true;
-						break;
-					case O_GT:
-					case O_GTE:
-					case O_LT:
-					case O_LTE:
-						abort();
-					}
-					break;
-				default:
-					fputs("unsupported type to compare\n", stderr);
-					exit(1);
-				}
-				if (!done) {
-					SET("%s ", op);
-					wt(left);
-					pt_printf(" %s, %s", RP(0), RP(1));
-				}
-			} break;
-			case O_GET_FIELD:
-				pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
-				assert(TP(0)->type == T_OBJECT);
-				pt_printf("%%struct.%zu, ", TP(0)->struct_index);
-				wt(TP(0));
-				pt_printf(" %s, i64 0, i32 %zu\n", RP(0), ins->parameters[1]);
-
-				SETR("load ");
-				wt(ins->type);
-				pt_printf(", ");
-				wt(ins->type);
-				pt_printf("* %%temp.%zu_%zu, align 1", i, k);
-				break;
-			case O_GET_INDEX:
-				pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
-				assert(TP(0)->type == T_OBJECT);
-				pt_printf("%%struct.%zu, ", TP(0)->struct_index);
-				wt(TP(0));
-				pt_printf(" %s, i64 %s\n", RP(0), RP(1));
+	struct emission e = {
+		.system = system,
+		.allrefs = allrefs,
+		.exit_label = exit_label,
+		.possibly_accessible = possibly_accessible
+	};
+	write_blocks(&e);
 
-				SETR("load ");
-				wt(ins->type);
-				pt_printf(", ");
-				wt(ins->type);
-				pt_printf("* %%temp.%zu_%zu, align 1", i, k);
-				break;
-			case O_GET_SYMBOL:
-				// TODO: fix
-				SET("%s", RP(0));
-				break;
-			case O_LITERAL:
-			switch (ins->type->type) {
-				case T_ARRAY:
-				case T_BLOCKREF:
-				case T_F32:
-				case T_F64:
-				case T_F128:
-				case T_REF:
-				case T_S8:
-				case T_S16:
-				case T_S32:
-				case T_S64:
-				case T_VOID:
-				default:
-					abort();
-				case T_BOOL:
-					vf(ref[k], ins->value_bool ? "true" : "false");
-					break;
-				case T_OBJECT:
-					vf(ref[k], "null");
-					break;
-				case T_STRING: {
-					size_t len = strlen(ins->value_string) + 8;
-					SET("getelementptr [%zu x i8], [%zu x i8]* @str_%zu_%zu, i64 0, i64 0", len, len, i, j);
-					break;
-				}
-				case T_U8:
-					vf(ref[k], "%hhu", ins->value_u8);
-					break;
-				case T_U16:
-					vf(ref[k], "%hu", ins->value_u16);
-					break;
-				case T_U32:
-					vf(ref[k], "%u", ins->value_u32);
-					break;
-				case T_U64:
-					vf(ref[k], "%lu", ins->value_u64);
-					break;
-				}
-				break;
-			case O_LOGIC: {
-				pt_printf("  %%a.%zu = icmp ne ", k);
-				wt(TP(0));
-				pt_printf(" %s, 0\n", RP(0));
+	pt_printf("Done:\n  ret i32 0\n}\n\n");
 
-				pt_printf("  %%b.%zu = icmp ne ", k);
-				wt(TP(1));
-				pt_printf(" %s, 0\n", RP(1));
+	// bounds checks are expected to pass
+	pt_printf("!0 = !{!\"branch_weights\", i32 2000, i32 1}\n");
 
-				switch (ins->operation.logic_type) {
-				case O_AND:
-					SETR("and");
-					break;
-				case O_OR:
-					SETR("or");
-					break;
-				case O_XOR:
-					SETR("xor");
-					break;
-				default:
-					abort();
-				}
-				pt_printf(" i1 %%a.%zu, %%b.%zu", k, k);
-			} break;
-			case O_NATIVE: {
-				if (is_void(ins->type)) {
-					pt_printf("  call void");
-				} else {
-					SETR("call ");
-					wt(ins->type);
-				}
-				pt_printf(" @%s(", ins->native_call);
-				size_t count = ins->parameters[0];
-				if (count) {
-					wt(TP(1));
-					pt_printf(" %s", RP(1));
-					for (size_t i = 2; i <= count; i++) {
-						pt_printf(", ");
-						wt(TP(i));
-						pt_printf(" %s", RP(i));
-					}
-				}
-				pt_printf(")");
-			} break;
-			case O_NEGATE:
-				SETR("sub ");
-				wt(ins->type);
-				pt_printf(" 0, %s", RP(0));
-				break;
-			case O_NEW: { // TODO: check with GC before save-restoring to see if we need to.
-				struct patchvar *strref = pt_def();
-				size_t refcnt = 0;
-				for (size_t ssa = 0; ssa < offset + block->instruction_count; ssa++) { // TODO: deduplicate
-					size_t start = ssa - offset;
-					size_t end = last_used_map[ssa];
-					if ((ssa < offset || start < j) && end > j) { // might be relocated
-						type *tp = TYPEOF(ssa);
-						if (IS_GC_ABLE(tp) && (ssa < offset || block->instructions[ssa - offset].operation.type != O_LITERAL)) {
-							// TODO: make sure that string literals aren't saved
-							if (refcnt == 0) {
-								pt_printf("  %%save.%zu_%zu = call i8* @llvm.stacksave()\n", i, k);
-								pt_printf("  %%pass.%zu_%zu = alloca ", i, k);
-								pt_use(strref);
-								pt_printf("\n");
-							}
-							pt_printf("  ; save %zu (%zu - %zu - %zu)\n", ssa, start, j, end);
-
-							// address of saved pointer
-							pt_printf("  %%prestore.%zu_%zu_%zu = getelementptr ", i, k, refcnt);
-							pt_use(strref);
-							pt_printf(", ");
-							pt_use(strref);
-							pt_printf("* %%pass.%zu_%zu, i64 0, i32 %zu\n", i, k, refcnt);
-
-							if (tp->type == T_STRING) {
-								pt_printf("  %%int.%zu_%zu_%zu = ptrtoint ", i, k, refcnt);
-								wt(tp);
-								pt_printf(" %s to i64\n", pt_fetch(ref[ssa]));
-
-								pt_printf("  %%ord.%zu_%zu_%zu = or i64 %%int.%zu_%zu_%zu, 1\n", i, k, refcnt, i, k, refcnt);
-								pt_printf("  %%cast.%zu_%zu_%zu = inttoptr i64 %%ord.%zu_%zu_%zu to i8*\n", i, k, refcnt, i, k, refcnt)
-							} else {
-								pt_printf("  %%cast.%zu_%zu_%zu = bitcast ", i, k, refcnt);
-								wt(tp);
-								pt_printf(" %s to i8*\n", pt_fetch(ref[ssa]));
-							}
-
-							pt_printf("  store i8* %%cast.%zu_%zu_%zu, i8** %%prestore.%zu_%zu_%zu\n", i, k, refcnt, i, k, refcnt);
-							refcnt++;
-						}
-					}
-				}
-				if (refcnt) {
-					const char *single = ", i8*";
-					size_t siz = strlen(single);
-					char cr[siz * refcnt + 1];
-					for (size_t i = 0; i < refcnt; i++) {
-						strcpy(cr + siz * i, single);
-					}
-//					printf("INITALIZING %zu\n", i);
-					vf(strref, "{ %s }", cr + 2); // add two to get rid of leading ", "
-					pt_printf("\n");
-				} else {
-//					printf("NOT INITALIZING %zu, %zu\n", i, refcnt);
-				}
-				pt_printf("  %%passi8.%zu_%zu = bitcast ", i, k);
-				if (refcnt) {
-					pt_use(strref);
-					pt_printf("* %%pass.%zu_%zu to i8*\n", i, k);
-				} else {
-					pt_printf("i8* null to i8*\n");
-				}
-				pt_printf("  %%raw.%zu_%zu = call ccc i8* @bear_new(%%metastruct* @meta.%zu, i32 %zu, i8* %%passi8.%zu_%zu )\n", i, k, ins->type->struct_index, refcnt, i, k);
-				SET("bitcast i8* %%raw.%zu_%zu to ", i, k);
-				wt(ins->type);
-				pt_printf("\n");
-
-				if (refcnt) {
-					refcnt = 0;
-					for (size_t ssa = 0; ssa < offset + block->instruction_count; ssa++) { // TODO: deduplicate
-						size_t start = ssa - offset;
-						size_t end = last_used_map[ssa];
-						type *tp = TYPEOF(ssa);
-						if ((ssa < offset || start < j) && end > j) { // might be relocated
-							if (IS_GC_ABLE(tp) && (ssa < offset || block->instructions[ssa - offset].operation.type != O_LITERAL)) {
-								// TODO: make sure that string literals aren't saved
-								pt_printf("\n  ; restore %zu (%zu - %zu - %zu)\n", ssa, start, j, end);
-								pt_printf("  %%postload.%zu_%zu_%zu = load i8*, i8** %%prestore.%zu_%zu_%zu\n", i, k, refcnt, i, k, refcnt);
-								pt_printf("  %%restored.%zu_%zu.%zu = bitcast i8* %%postload.%zu_%zu_%zu to ", i, k, ssa, i, k, refcnt);
-								wt(tp);
-								pt_printf("\n")
-								vf(ref[ssa], "%%restored.%zu_%zu.%zu", i, k, ssa);
-								refcnt++;
-							}
-						} else if (start < j && IS_GC_ABLE(tp)) {
-							pt_printf("  ; NOTE: busting %zu (%zu - %zu - %zu)\n", ssa, start, j, end);
-							vf(ref[ssa], "BUSTED"); // not moved forward. if this ever shows up, then maybe it should have been.
-						}
-					}
-					pt_printf("  call void @llvm.stackrestore(i8* %%save.%zu_%zu)\n", i, k);
-				}
-				// ins->parameters[0] is the length of O_NEW_ARRAY
-			} break;
-			case O_NOT:
-				SETR("icmp eq ");
-				wt(TP(0));
-				pt_printf(" %s, 0", RP(0));
-				break;
-			case O_NUMERIC: {
-				const char *op;
-				switch (ins->operation.numeric_type) {
-				case O_ADD: op = "add"; break;
-				case O_BAND: op = "and"; break;
-				case O_BOR: op = "or"; break;
-				case O_BXOR: op = "xor"; break;
-				case O_DIV: op = "udiv"; break; // TODO: check signs
-				case O_MOD: op = "urem"; break; // TODO: check signs
-				case O_MUL: op = "mul"; break;
-				case O_SUB: op = "sub"; break;
-				default: abort();
-				}
-				SET("%s ", op);
-				wt(ins->type);
-				pt_printf(" %s, %s", RP(0), RP(1));
-			} break;
-			case O_SET_FIELD:
-				pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
-				type *t = TP(0);
-				if (t->type != T_OBJECT) {
-					fprintf(stderr, "expected object in SET_FIELD");
-					abort();
-				}
-				pt_printf("%%struct.%zu, ", t->struct_index);
-				wt(t);
-				pt_printf(" %s, i64 0, i32 %zu\n", RP(0), ins->parameters[1]);
-
-				type *ft = get_code_struct(system, t->struct_index)->fields[ins->parameters[1]].field_type;
-
-				pt_printf("  store ");
-				wt(ft);
-				pt_printf(" %s, ", RP(2));
-				wt(ft);
-				pt_printf("* %%temp.%zu_%zu, align 1", i, k);
-				break;
-			case O_SET_INDEX:
-				pt_printf("  %%temp.%zu_%zu = getelementptr inbounds ", i, k);
-				if (t->type != T_ARRAY) {
-					fprintf(stderr, "expected array in SET_INDEX");
-					abort();
-				}
-				wt(TP(0));
-				pt_printf(" (needs to have the star stripped), "); // TODO
-				wt(TP(0));
-				pt_printf(" %s, i64 %s\n", RP(0), RP(1));
-
-				type *et = t->arraytype;
-
-				pt_printf("  store ");
-				wt(et);
-				pt_printf(" %s, ", RP(2));
-				wt(et);
-				pt_printf("* %%temp.%zu_%zu, align 1", i, k);
-				break;
-			case O_SHIFT: {
-				const char *op;
-				switch (ins->operation.shift_type) {
-				case O_LSHIFT:
-					op = "shl";
-					break;
-				case O_ASHIFT:
-					op = "ashr";
-					break;
-				case O_RSHIFT:
-					op = "lshr";
-					break;
-				default:
-					abort();
-				}
-				SET("%s ", op);
-				wt(ins->type);
-				pt_printf(" %s, %s", RP(0), RP(1));
-			} break;
-			case O_NEW_ARRAY:
-			case O_STR_CONCAT:
-			case O_IDENTITY:
-			case O_INSTANCEOF:
-			case O_CALL:
-			case O_FUNCTION:
-			case O_NUMERIC_ASSIGN:
-			case O_POSTFIX:
-			case O_SET_SYMBOL:
-			case O_SHIFT_ASSIGN:
-			case O_STR_CONCAT_ASSIGN:
-			case O_TERNARY:
-				abort();
-			}
-			pt_printf("\n");
-		}
-
-		if (block->is_final) {
-			pt_printf("  br label %%Done\n");
-		} else {
-			bool needs_indirection = true;
-			switch (block->tail.type) {
-			case GOTO: {
-				if (block->tail.first_block >= offset
-				 && block->instructions[block->tail.first_block - offset].operation.type == O_BLOCKREF) {
-					pt_printf("  br label %%Block%zu\n", block->instructions[block->tail.first_block - offset].block_index);
-					needs_indirection = false;
-				} else {
-					pt_printf("  indirectbr i8* %s, [ ", pt_fetch(ref[block->tail.first_block]));
-				}
-			} break;
-			case BRANCH: {
-				if (block->tail.first_block >= offset
-				 && block->tail.second_block >= offset
-				 && block->instructions[block->tail.first_block - offset].operation.type == O_BLOCKREF
-				 && block->instructions[block->tail.second_block - offset].operation.type == O_BLOCKREF) {
-					pt_printf("  br i1 %s, label %%Block%zu, label %%Block%zu\n",
-					   pt_fetch(ref[block->tail.condition]),
-					   block->instructions[block->tail.first_block - offset].block_index,
-					   block->instructions[block->tail.second_block - offset].block_index);
-					needs_indirection = false;
-				} else {
-					pt_printf("  %%brtarget = select i1 %s, i8* %s, i8* %s\n",
-					   pt_fetch(ref[block->tail.condition]),
-					   pt_fetch(ref[block->tail.first_block]),
-					   pt_fetch(ref[block->tail.second_block]));
-					pt_printf("  indirectbr i8* %%brtarget, [ ");
-				}
-			} break;
-			}
-			if (needs_indirection) {
-				bool first = true;
-				for (size_t j = 0; j < system->block_count; j++) {
-					if (check_prototypes(block, get_code_block(system, j), j)) {
-						if (first) {
-							first = false;
-						} else {
-							pt_printf(", ");
-						}
-						pt_printf("label %%Block%zu", j);
-					}
-				}
-				pt_printf(" ]\n");
-			}
-		}
+	// the TBAA root, then a type and an access tag for each of enum tbaa
+	pt_printf("!1 = !{!\"cub tbaa\"}\n");
+	for (unsigned t = 0; t < TBAA_COUNT; t++) {
+		pt_printf("!%u = !{!\"%s\", !1, i64 0}\n", 2 + 2 * t, tbaa_names[t]);
+		pt_printf("!%u = !{!%u, !%u, i64 0}\n", 3 + 2 * t, 2 + 2 * t, 2 + 2 * t);
 	}
 
-	pt_printf("Done:\n  ret i32 0\n}\n");
-
 	for (size_t i = 0; i < system->block_count; i++) {
 		free(allrefs[i]);
 	}
+	free_layouts(system, layouts);
 
 	pt_finalize(out);
 }
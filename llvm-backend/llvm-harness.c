@@ -3,56 +3,145 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <math.h>
+#include "runtime.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+// SSE2 is part of x86-64, AVX2 is picked at startup when the CPU has it
+#define STRING_SIMD
+#endif
 
 // #define TRACE_GC
 
 enum reachable {
 	ALPHA=0,
-	BETA=1
+	BETA=1,
+	// a swept object on a page, whose memory stays until the page is empty
+	DEAD=2
 };
 
-struct metafield {
-	uint32_t offset;
-	uint8_t is_string;
-	struct metafield *next;
+// the one word ahead of every object: its metastruct, which is 8-byte aligned,
+// with the mark in the low bits
+struct gcinfo {
+	uintptr_t word;
 };
 
-struct metastruct {
-	uint32_t length;
-	uint32_t struct_id;
-	struct metafield *mf;
+#define MARK_MASK 3
+
+// also the metastructs of arrays the compiler puts on the stack
+struct metastruct array_meta[] = {
+	{0, ARRAY_STRUCT_ID | ARRAY_PRIMITIVE, 0, 0, 0, 0, 0, NULL},
+	{0, ARRAY_STRUCT_ID | ARRAY_OBJECT, 0, 0, 0, 0, 0, NULL},
+	{0, ARRAY_STRUCT_ID | ARRAY_STRING, 0, 0, 0, 0, 0, NULL},
+	// slices are bumped out of pages, which need their size: a struct slice
+	{sizeof(struct slice), ARRAY_STRUCT_ID | STRING_SLICE, 0, 0, 0, 0, 0, NULL}
 };
 
-struct gcinfo {
-	struct metastruct *meta;
-	enum reachable reachable;
-	struct gcinfo *next;
+// the buffer behind the strings ~= returns, which are slices of it: appending
+// to the slice that ends at used writes into the spare capacity in place
+struct builder {
+	uint64_t used;
+	uint64_t capacity;
+	uint8_t data[];
 };
 
+static struct metastruct builder_meta = {0, ARRAY_STRUCT_ID | ARRAY_PRIMITIVE, 0, 0, 0, 0, 0, NULL};
+
+// a file mapped by bear_map_file. the strings over it are slices with this as
+// their base, so the collector never looks at the mapped bytes, and unmaps
+// them once no slice needs them
+struct mapping {
+	uint64_t length;
+	uint8_t *data;
+};
+
+static struct metastruct mapping_meta = {0, ARRAY_STRUCT_ID | ARRAY_PRIMITIVE, 0, 0, 0, 0, 0, NULL};
+
+static inline uint64_t string_length(uint8_t *value) {
+	return *(uint64_t*) value & ~STRING_FLAGS;
+}
+
+static inline uint8_t *string_data(uint8_t *value) {
+	if (*(uint64_t*) value & STRING_SLICE_BIT) {
+		return ((struct slice*) value)->data;
+	}
+	return value + 8;
+}
+
 #ifdef TRACE_GC
 #define INDENT(indent) for (int i=0; i<indent; i++) { putchar('\t'); }
 #else
 #define INDENT(indent)
 #endif
 
+enum reachable unreachable = ALPHA;
+
+static inline struct metastruct *header_meta(struct gcinfo *info) {
+	return (struct metastruct*) (info->word & ~(uintptr_t) MARK_MASK);
+}
+
+static inline enum reachable header_mark(struct gcinfo *info) {
+	return (enum reachable) (info->word & MARK_MASK);
+}
+
+static inline void set_mark(struct gcinfo *info, enum reachable mark) {
+	info->word = (info->word & ~(uintptr_t) MARK_MASK) | mark;
+}
+
+// a new object starts out unmarked
+static inline void init_header(struct gcinfo *info, struct metastruct *meta) {
+	info->word = (uintptr_t) meta | unreachable;
+}
+
+static inline void enumerate_object(int indent, uint8_t *data);
+
+// the start of the region compressed references are offsets into, in 8-byte
+// units, or NULL when they aren't in use
+uint8_t *bear_heap_base = NULL;
+
 static inline void enumerate_string(int indent, uint8_t *data) {
 	INDENT(indent)
-	if ((*(uint64_t*)data) & 0x8000000000000000) {
+	if (data == NULL) {
+		return;
+	}
+	if ((*(uint64_t*)data) & STRING_STATIC) {
 		// static
 #ifdef TRACE_GC
 		printf("static string\n");
 #endif
 	} else {
-		// TODO: implement
+		// heap strings are u8 arrays, reinterpreted
 #ifdef TRACE_GC
 		printf("heap string\n");
 #endif
+		enumerate_object(indent, data);
 	}
 }
 
-enum reachable unreachable = ALPHA;
+static inline void enumerate_array(int indent, uint8_t *data, uint32_t kind) {
+	if (kind == ARRAY_PRIMITIVE) {
+		return;
+	}
+	if (kind == STRING_SLICE) {
+		enumerate_string(indent + 1, ((struct slice*) data)->base);
+		return;
+	}
+	uint64_t length = *(uint64_t*) data;
+	uint8_t **elements = (uint8_t**) (data + 8);
+	for (uint64_t i = 0; i < length; i++) {
+		if (kind == ARRAY_STRING) {
+			enumerate_string(indent + 1, elements[i]);
+		} else {
+			enumerate_object(indent + 1, elements[i]);
+		}
+	}
+}
 
 static inline void enumerate_object(int indent, uint8_t *data) {
 	INDENT(indent);
@@ -64,30 +153,39 @@ static inline void enumerate_object(int indent, uint8_t *data) {
 	}
 	fflush(stdout);
 	struct gcinfo *gcinfo = &((struct gcinfo *) data)[-1];
-	struct metastruct *meta = gcinfo->meta;
-	if (gcinfo->reachable != unreachable) {
+	struct metastruct *meta = header_meta(gcinfo);
+	if (header_mark(gcinfo) != unreachable) {
 #ifdef TRACE_GC
 		printf("heap object at %lu of type %u already marked.\n", (uint64_t) data, meta->struct_id);
 #endif
 		return;
 	}
-	gcinfo->reachable = !unreachable;
+	set_mark(gcinfo, !unreachable);
 #ifdef TRACE_GC
 	printf("heap object at %lu of type %u", (uint64_t) data, meta->struct_id);
 #endif
-	struct metafield *cur = meta->mf;
-	while (cur != NULL) {
-		INDENT(indent);
+	if ((meta->struct_id & ~3) == ARRAY_STRUCT_ID) {
+		enumerate_array(indent, data, meta->struct_id & 3);
+		return;
+	}
+	for (; meta != NULL; meta = meta->parent) {
+		uint8_t **refs = (uint8_t**) (data + meta->refs);
 #ifdef TRACE_GC
-		printf("    at +%u:\n", cur->offset);
+		printf("    %u objects and %u strings at +%u:\n", meta->object_refs, meta->string_refs, meta->refs);
 #endif
-		uint8_t *value = *(uint8_t**) (data + cur->offset);
-		if (cur->is_string) {
-			enumerate_string(indent + 1, value);
-		} else {
-			enumerate_object(indent + 1, value);
+		for (uint32_t i = 0; i < meta->object_refs; i++) {
+			enumerate_object(indent + 1, refs[i]);
+		}
+		refs += meta->object_refs;
+		for (uint32_t i = 0; i < meta->string_refs; i++) {
+			enumerate_string(indent + 1, refs[i]);
+		}
+		uint32_t *narrow = (uint32_t*) (data + meta->narrow);
+		for (uint32_t i = 0; i < meta->narrow_refs; i++) {
+			if (narrow[i] != 0) {
+				enumerate_object(indent + 1, bear_heap_base + 8 * (uint64_t) narrow[i]);
+			}
 		}
-		cur = cur->next;
 	}
 }
 
@@ -100,58 +198,204 @@ static inline void enumerate_objects_raw(int indent, void *data) {
 	}
 }
 
-struct gcinfo *chain_head = NULL;
+// anything not on a page is malloc'd on its own behind a span, and the spans
+// are chained together for the collector
+struct span {
+	struct span *next;
+	// the bytes malloc'd for it, span included
+	uint64_t size;
+	struct gcinfo header;
+};
 
-static void garbage_collect() {
-	struct gcinfo *cur = chain_head;
-	struct gcinfo *last = NULL;
-	while (cur != NULL) {
-		if (cur->reachable == unreachable) {
-#ifdef TRACE_GC
-			printf("\tDeallocating: %lu\n", (uint64_t) (cur + 1));
-#endif
-			if (last == NULL) {
-				chain_head = cur->next;
-				free(cur);
-				cur = chain_head;
-			} else {
-				last->next = cur->next;
-				free(cur);
-				cur = last->next;
+static struct span *span_head = NULL;
+
+// objects from bear_new are bumped out of pages instead. The
+// compiler inlines the bump against bear_heap_cursor and bear_heap_limit, and
+// only calls bear_new once the current page is full. The collector walks each
+// page's objects in order, and frees a page when none of them are live.
+#define HEAP_PAGE_SIZE (256 * 1024)
+
+struct page {
+	struct page *next;
+	// where the objects end, once this is no longer the current page
+	uint8_t *end;
+};
+
+uint8_t *bear_heap_cursor = NULL, *bear_heap_limit = NULL;
+// the current page, followed by the older ones
+static struct page *page_head = NULL;
+
+// with compressed references, the pages are carved out of one reservation
+// that 32-bit offsets in 8-byte units can reach, and freed pages are kept
+// for reuse instead of going back to malloc
+#define COMPRESSED_REGION_SIZE ((uint64_t) 8 << 32)
+
+static uint8_t *region_cursor = NULL, *region_end = NULL;
+static struct page *free_pages = NULL;
+
+void bear_compress_refs(void) {
+	void *region = mmap(NULL, COMPRESSED_REGION_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED) {
+		perror("could not reserve the compressed heap");
+		abort();
+	}
+	bear_heap_base = region_cursor = region;
+	region_end = bear_heap_base + COMPRESSED_REGION_SIZE;
+}
+
+static struct page *new_page(void) {
+	if (bear_heap_base == NULL) {
+		return malloc(HEAP_PAGE_SIZE);
+	}
+	if (free_pages != NULL) {
+		struct page *page = free_pages;
+		free_pages = page->next;
+		return page;
+	}
+	if (region_end - region_cursor < HEAP_PAGE_SIZE) {
+		return NULL;
+	}
+	struct page *page = (struct page*) region_cursor;
+	region_cursor += HEAP_PAGE_SIZE;
+	return page;
+}
+
+// collecting marks everything that's live, so it only happens once at least
+// as many bytes have been allocated since the last collection as survived it,
+// and never more often than every COLLECT_MINIMUM bytes
+#define COLLECT_MINIMUM (4 * HEAP_PAGE_SIZE)
+
+static uint64_t allocated = 0, collect_at = COLLECT_MINIMUM;
+
+static inline bool collection_due(void) {
+	return allocated >= collect_at;
+}
+
+static void free_page(struct page *page) {
+	if (bear_heap_base == NULL) {
+		free(page);
+		return;
+	}
+	// hand the memory back but keep the address range
+	madvise(page, HEAP_PAGE_SIZE, MADV_DONTNEED);
+	page->next = free_pages;
+	free_pages = page;
+}
+
+// must match the inline bump: the header, then the object padded to 8 bytes
+static inline uint64_t object_size(struct metastruct *meta) {
+	return sizeof(struct gcinfo) + ((meta->length + 7) & ~(uint64_t) 7);
+}
+
+// returns the bytes held by the pages that are left
+static uint64_t sweep_pages(void) {
+	uint64_t kept = 0;
+	struct page **link = &page_head;
+	while (*link != NULL) {
+		struct page *page = *link;
+		uint8_t *start = (uint8_t*) (page + 1);
+		uint8_t *end = page == page_head ? bear_heap_cursor : page->end;
+		bool live = false;
+		for (uint8_t *at = start; at < end;) {
+			struct gcinfo *info = (struct gcinfo*) at;
+			enum reachable mark = header_mark(info);
+			if (mark == unreachable) {
+				set_mark(info, DEAD);
+			} else if (mark != DEAD) {
+				live = true;
 			}
+			at += object_size(header_meta(info));
+		}
+
+		if (live) {
+			link = &page->next;
+			kept += HEAP_PAGE_SIZE;
+		} else if (page == page_head) {
+			// start the current page over
+			bear_heap_cursor = start;
+			link = &page->next;
+			kept += HEAP_PAGE_SIZE;
 		} else {
+			*link = page->next;
+			free_page(page);
+		}
+	}
+	return kept;
+}
+
+// returns the bytes held by the spans that are left
+static uint64_t sweep_spans(void) {
+	uint64_t kept = 0;
+	struct span **link = &span_head;
+	while (*link != NULL) {
+		struct span *span = *link;
+		if (header_mark(&span->header) != unreachable) {
+#ifdef TRACE_GC
+			printf("\tPreserving: %lu\n", (uint64_t) (span + 1));
+#endif
+			link = &span->next;
+			kept += span->size;
+			continue;
+		}
 #ifdef TRACE_GC
-			printf("\tPreserving: %lu\n", (uint64_t) (cur + 1));
+		printf("\tDeallocating: %lu\n", (uint64_t) (span + 1));
 #endif
-			last = cur;
-			cur = cur->next;
+		if (header_meta(&span->header) == &mapping_meta) {
+			struct mapping *mapping = (struct mapping*) (span + 1);
+			munmap(mapping->data, mapping->length);
 		}
+		*link = span->next;
+		free(span);
 	}
+	return kept;
+}
+
+static void garbage_collect() {
+	uint64_t kept = sweep_spans() + sweep_pages();
+	allocated = 0;
+	collect_at = kept > COLLECT_MINIMUM ? kept : COLLECT_MINIMUM;
 	// everything remaining is marked as reachable
 	unreachable = !unreachable;
 	// now everything remaining is marked as unreachable and we're ready for another round
 }
 
-// TODO: make this actually do this correctly
-uint8_t *bear_new(struct metastruct *mts, uint32_t storecount, void **ptr) { // TODO: check for overflow
+// open addressing on the string bytes, at most half full
+static uint8_t **intern_table = NULL;
+static uint64_t intern_count = 0, intern_capacity = 0;
+
+static void mark_roots(uint32_t storecount, void **ptr) {
 #ifdef TRACE_GC
 	printf("\nEnumerating object map...\n");
 #endif
+	// interned strings live as long as the program
+	for (uint64_t i = 0; i < intern_capacity; i++) {
+		enumerate_string(1, intern_table[i]);
+	}
 	for (uint32_t i = 0; i < storecount; i++) {
 #ifdef TRACE_GC
 		printf("Root %u:\n", i);
 #endif
 		enumerate_objects_raw(1, ptr[i]);
 	}
+}
+
+static void collect_roots(uint32_t storecount, void **ptr) {
+	mark_roots(storecount, ptr);
 	garbage_collect();
-#ifdef TRACE_GC
-	printf("ALLOCATING %lu (%lu)\n", mts->struct_id, (uint64_t) mts);
-#endif
-	struct gcinfo *out = malloc(mts->length + sizeof(struct gcinfo));
-	out->meta = mts;
-	out->next = chain_head;
-	out->reachable = unreachable;
-	chain_head = out;
+}
+
+static uint8_t *allocate(struct metastruct *mts, uint64_t length) {
+	struct span *out = malloc(length + sizeof(struct span));
+	if (out == NULL) {
+		fputs("out of memory\n", stderr);
+		abort();
+	}
+	init_header(&out->header, mts);
+	out->size = length + sizeof(struct span);
+	allocated += out->size;
+	out->next = span_head;
+	span_head = out;
 	uint8_t *real_out = (uint8_t*) (out + 1);
 	if (((uintptr_t) real_out) & 1) {
 		printf("Bad alignment.");
@@ -163,32 +407,514 @@ uint8_t *bear_new(struct metastruct *mts, uint32_t storecount, void **ptr) { //
 	return real_out;
 }
 
+void bear_flush(void);
+
+// starts a fresh page, which becomes the one the inline bump allocates from
+static void next_page(void) {
+	struct page *page = new_page();
+	if (page == NULL) {
+		fputs("out of memory\n", stderr);
+		abort();
+	}
+	if (page_head != NULL) {
+		page_head->end = bear_heap_cursor;
+	}
+	page->next = page_head;
+	page->end = NULL;
+	page_head = page;
+	allocated += HEAP_PAGE_SIZE;
+	bear_heap_cursor = (uint8_t*) (page + 1);
+	bear_heap_limit = (uint8_t*) page + HEAP_PAGE_SIZE;
+}
+
+// what the inline bump does, starting a page when the current one is full.
+// like allocate, this never collects
+static uint8_t *bump(struct metastruct *mts) {
+	uint64_t size = object_size(mts);
+	if (bear_heap_cursor == NULL || (uint64_t) (bear_heap_limit - bear_heap_cursor) < size) {
+		next_page();
+	}
+	struct gcinfo *out = (struct gcinfo*) bear_heap_cursor;
+	bear_heap_cursor += size;
+	init_header(out, mts);
+	return (uint8_t*) (out + 1);
+}
+
+// the slow path of the inline bump, taken when the current page is full
+uint8_t *bear_new(struct metastruct *mts, uint32_t storecount, void **ptr) {
+	if (collection_due()) {
+		collect_roots(storecount, ptr);
+	}
+#ifdef TRACE_GC
+	printf("ALLOCATING %lu (%lu)\n", mts->struct_id, (uint64_t) mts);
+#endif
+	if (object_size(mts) > HEAP_PAGE_SIZE - sizeof(struct page)) {
+		if (bear_heap_base != NULL) {
+			// compressed references can't reach anything off the pages
+			fputs("object too large for compressed references\n", stderr);
+			abort();
+		}
+		return allocate(mts, mts->length);
+	}
+	// the collection may have emptied the current page
+	return bump(mts);
+}
+
+uint8_t *bear_new_array(uint64_t element_size, uint8_t kind, uint64_t length, uint32_t storecount, void **ptr) {
+	// also catches negative lengths, which arrive sign-extended
+	if (length > (UINT64_MAX - 8) / element_size) {
+		bear_flush();
+		fprintf(stderr, "invalid array length %ld\n", (int64_t) length);
+		abort();
+	}
+	if (collection_due()) {
+		collect_roots(storecount, ptr);
+	}
+	uint8_t *out = allocate(&array_meta[kind], 8 + length * element_size);
+	*(uint64_t*) out = length;
+	// object and string elements start out null
+	memset(out + 8, 0, length * element_size);
+	return out;
+}
+
+void bear_bounds_fail(uint64_t index, uint64_t length) {
+	bear_flush();
+	fprintf(stderr, "index %lu out of bounds for length %lu\n", index, length);
+	abort();
+}
+
+void bear_range_fail(uint64_t start, uint64_t end, uint64_t length) {
+	bear_flush();
+	fprintf(stderr, "range %lu to %lu out of bounds for length %lu\n", start, end, length);
+	abort();
+}
+
+// length bytes from data, which base keeps alive
+static uint8_t *new_slice(uint8_t *base, uint8_t *data, uint64_t length) {
+	struct slice *out = (struct slice*) bump(&array_meta[STRING_SLICE]);
+	out->length = length | STRING_SLICE_BIT;
+	out->data = data;
+	out->base = base;
+	return (uint8_t*) out;
+}
+
+// the substring of value from start up to but not including end, which shares
+// the bytes of value
+uint8_t *bear_string_slice(uint8_t *value, uint32_t start, uint32_t end) {
+	uint64_t length = string_length(value);
+	if (start > end || end > length) {
+		bear_range_fail(start, end, length);
+	}
+	if (start == 0 && end == length) {
+		return value;
+	}
+	uint8_t *base = value;
+	if (*(uint64_t*) value & STRING_SLICE_BIT) {
+		// slice the original string, so slices never chain
+		base = ((struct slice*) value)->base;
+	}
+	// bump does not collect, so value stays alive
+	return new_slice(base, string_data(value) + start, end - start);
+}
+
+// collects garbage, keeping the strings being concatenated along with the
+// spilled roots
+static void collect_parts(uint8_t **parts, uint64_t count, uint32_t storecount, void **ptr) {
+	mark_roots(storecount, ptr);
+	for (uint64_t i = 0; i < count; i++) {
+		enumerate_string(1, parts[i]);
+	}
+	garbage_collect();
+}
+
+static uint64_t parts_length(uint8_t **parts, uint64_t count) {
+	uint64_t length = 0;
+	for (uint64_t i = 0; i < count; i++) {
+		length += string_length(parts[i]);
+	}
+	if (length & STRING_FLAGS) {
+		fputs("string too long\n", stderr);
+		abort();
+	}
+	return length;
+}
+
+static void copy_parts(uint8_t *out, uint8_t **parts, uint64_t count) {
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t length = string_length(parts[i]);
+		memcpy(out, string_data(parts[i]), length);
+		out += length;
+	}
+}
+
+// a ~ b ~ ..., sized once for all the parts
+uint8_t *bear_string_concat(uint8_t **parts, uint64_t count, uint32_t storecount, void **ptr) {
+	uint64_t length = parts_length(parts, count);
+	for (uint64_t i = 0; i < count; i++) {
+		if (string_length(parts[i]) == length) {
+			// everything else is empty
+			return parts[i];
+		}
+	}
+	if (collection_due()) {
+		collect_parts(parts, count, storecount, ptr);
+	}
+	uint8_t *out = allocate(&array_meta[ARRAY_PRIMITIVE], 8 + length);
+	*(uint64_t*) out = length;
+	copy_parts(out + 8, parts, count);
+	return out;
+}
+
+// the builder value is the latest slice of, if any
+static struct builder *builder_tip(uint8_t *value) {
+	if (!(*(uint64_t*) value & STRING_SLICE_BIT)) {
+		return NULL;
+	}
+	struct slice *slice = (struct slice*) value;
+	// static literals have no header to look at
+	if (*(uint64_t*) slice->base & STRING_STATIC) {
+		return NULL;
+	}
+	struct gcinfo *gcinfo = &((struct gcinfo*) slice->base)[-1];
+	if (header_meta(gcinfo) != &builder_meta) {
+		return NULL;
+	}
+	struct builder *builder = (struct builder*) slice->base;
+	if (slice->data != builder->data || string_length(value) != builder->used) {
+		return NULL;
+	}
+	return builder;
+}
+
+// value ~= a ~ b ~ ..., which only copies value when it has to grow, or when
+// something else already appended to it
+uint8_t *bear_string_append(uint8_t **parts, uint64_t count, uint32_t storecount, void **ptr) {
+	uint8_t *head = parts[0];
+	uint64_t head_length = string_length(head);
+	uint64_t length = parts_length(parts, count);
+	if (length == head_length) {
+		return head;
+	}
+	struct builder *builder = builder_tip(head);
+	if (builder == NULL || length > builder->capacity) {
+		if (collection_due()) {
+			collect_parts(parts, count, storecount, ptr);
+		}
+		uint64_t capacity = length < 8 ? 16 : length * 2;
+		builder = (struct builder*) allocate(&builder_meta, sizeof(struct builder) + capacity);
+		builder->capacity = capacity;
+		memcpy(builder->data, string_data(head), head_length);
+	}
+	copy_parts(builder->data + head_length, parts + 1, count - 1);
+	builder->used = length;
+	// bump does not collect, so the builder stays alive
+	return new_slice((uint8_t*) builder, builder->data, length);
+}
+
+// the index of the first byte where a and b differ, or length if none do
+static size_t mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t length) {
+	size_t i = 0;
+	while (i < length && a[i] == b[i]) {
+		i++;
+	}
+	return i;
+}
+
+// the index of the first occurrence of needle in haystack, or -1
+static int64_t find_scalar(const uint8_t *haystack, size_t length, const uint8_t *needle, size_t needle_length) {
+	if (needle_length == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i + needle_length <= length; i++) {
+		if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needle_length) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+#ifdef STRING_SIMD
+static size_t mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t length) {
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+		unsigned differ = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+		if (differ) {
+			return i + __builtin_ctz(differ);
+		}
+	}
+	return i + mismatch_scalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t length) {
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+		unsigned differ = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (differ) {
+			return i + __builtin_ctz(differ);
+		}
+	}
+	return i + mismatch_sse2(a + i, b + i, length - i);
+}
+
+// tests a block of candidate positions at once by matching the first and last
+// bytes of the needle, and only compares the rest where both match
+static int64_t find_sse2(const uint8_t *haystack, size_t length, const uint8_t *needle, size_t needle_length) {
+	if (needle_length == 0 || needle_length > length) {
+		return needle_length ? -1 : 0;
+	}
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+	size_t i = 0, end = length - needle_length + 1;
+	for (; i + 16 <= end; i += 16) {
+		__m128i head = _mm_loadu_si128((const __m128i*) (haystack + i));
+		__m128i tail = _mm_loadu_si128((const __m128i*) (haystack + i + needle_length - 1));
+		unsigned match = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+		while (match) {
+			size_t at = i + __builtin_ctz(match);
+			if (memcmp(haystack + at, needle, needle_length) == 0) {
+				return at;
+			}
+			match &= match - 1;
+		}
+	}
+	int64_t rest = find_scalar(haystack + i, length - i, needle, needle_length);
+	return rest < 0 ? -1 : (int64_t) i + rest;
+}
+
+__attribute__((target("avx2")))
+static int64_t find_avx2(const uint8_t *haystack, size_t length, const uint8_t *needle, size_t needle_length) {
+	if (needle_length == 0 || needle_length > length) {
+		return needle_length ? -1 : 0;
+	}
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+	size_t i = 0, end = length - needle_length + 1;
+	for (; i + 32 <= end; i += 32) {
+		__m256i head = _mm256_loadu_si256((const __m256i*) (haystack + i));
+		__m256i tail = _mm256_loadu_si256((const __m256i*) (haystack + i + needle_length - 1));
+		unsigned match = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+		while (match) {
+			size_t at = i + __builtin_ctz(match);
+			if (memcmp(haystack + at, needle, needle_length) == 0) {
+				return at;
+			}
+			match &= match - 1;
+		}
+	}
+	int64_t rest = find_sse2(haystack + i, length - i, needle, needle_length);
+	return rest < 0 ? -1 : (int64_t) i + rest;
+}
+#endif
+
+static size_t (*mismatch)(const uint8_t*, const uint8_t*, size_t) = mismatch_scalar;
+static int64_t (*find)(const uint8_t*, size_t, const uint8_t*, size_t) = find_scalar;
+
+// picked before main, so the string functions below never write memory
+__attribute__((constructor))
+static void select_string_kernels(void) {
+#ifdef STRING_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		mismatch = mismatch_avx2;
+		find = find_avx2;
+	} else {
+		mismatch = mismatch_sse2;
+		find = find_sse2;
+	}
+#endif
+}
+
+// every literal in the program, as one constant each
+extern uint8_t *bear_literals[];
+extern const uint64_t bear_literal_count;
+
+static uint64_t string_hash(uint8_t *value) {
+	uint64_t hash = 14695981039346656037u, length = string_length(value);
+	uint8_t *data = string_data(value);
+	for (uint64_t i = 0; i < length; i++) {
+		hash = (hash ^ data[i]) * 1099511628211u;
+	}
+	return hash;
+}
+
+// the entry equal to value, or the empty slot it would go in
+static uint8_t **intern_slot(uint8_t *value, uint64_t hash) {
+	uint64_t mask = intern_capacity - 1, length = string_length(value);
+	for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+		uint8_t *entry = intern_table[i];
+		if (entry == NULL || (string_length(entry) == length &&
+				mismatch(string_data(entry), string_data(value), length) == length)) {
+			return &intern_table[i];
+		}
+	}
+}
+
+static void intern_grow(void) {
+	uint8_t **old = intern_table;
+	uint64_t old_capacity = intern_capacity;
+	intern_capacity = old_capacity ? old_capacity * 2 : 64;
+	intern_table = calloc(intern_capacity, sizeof(uint8_t*));
+	if (intern_table == NULL) {
+		fputs("out of memory\n", stderr);
+		abort();
+	}
+	for (uint64_t i = 0; i < old_capacity; i++) {
+		if (old[i] != NULL) {
+			*intern_slot(old[i], string_hash(old[i])) = old[i];
+		}
+	}
+	free(old);
+}
+
+static void intern_insert(uint8_t *value) {
+	if (2 * (intern_count + 1) > intern_capacity) {
+		intern_grow();
+	}
+	*intern_slot(value, string_hash(value)) = value;
+	intern_count++;
+}
+
+// the one string in the table equal to value. literals are already unique, so
+// interning a string equal to a literal gives that literal
+uint8_t *bear_string_intern(uint8_t *value) {
+	if (intern_table == NULL) {
+		intern_grow();
+		for (uint64_t i = 0; i < bear_literal_count; i++) {
+			intern_insert(bear_literals[i]);
+		}
+	}
+	uint8_t **slot = intern_slot(value, string_hash(value));
+	if (*slot != NULL) {
+		return *slot;
+	}
+	if (*(uint64_t*) value & STRING_STATIC) {
+		intern_insert(value);
+		return value;
+	}
+	// a flat copy, so the table never keeps the rest of a slice's base alive
+	uint64_t length = string_length(value);
+	uint8_t *out = allocate(&array_meta[ARRAY_PRIMITIVE], 8 + length);
+	*(uint64_t*) out = length | STRING_INTERNED;
+	memcpy(out + 8, string_data(value), length);
+	intern_insert(out);
+	return out;
+}
+
 bool bear_streq(uint8_t *a, uint8_t *b) {
 	if (a == b) {
 		return true;
 	}
-	uint64_t la = *(uint64_t*) a, lb = *(uint64_t*) b;
-	la &= ~0x8000000000000000;
-	lb &= ~0x8000000000000000;
+	// both unique for their contents
+	if ((*(uint64_t*) a & (STRING_STATIC | STRING_INTERNED)) &&
+			(*(uint64_t*) b & (STRING_STATIC | STRING_INTERNED))) {
+		return false;
+	}
+	uint64_t la = string_length(a), lb = string_length(b);
 	if (la != lb) {
 		return false;
 	}
-	uint8_t *ra = (uint8_t*) (1 + (uint64_t*) a), *rb = (uint8_t*) (1 + (uint64_t*) b);
-	for (uint64_t i = 0; i < la; i++) {
-		if (ra[i] != rb[i]) {
-			return false;
+	return mismatch(string_data(a), string_data(b), la) == la;
+}
+
+// orders a and b by their bytes, then by length
+int32_t bear_strcmp(uint8_t *a, uint8_t *b) {
+	if (a == b) {
+		return 0;
+	}
+	uint64_t la = string_length(a), lb = string_length(b);
+	uint8_t *da = string_data(a), *db = string_data(b);
+	uint64_t shorter = la < lb ? la : lb;
+	uint64_t at = mismatch(da, db, shorter);
+	if (at < shorter) {
+		return da[at] < db[at] ? -1 : 1;
+	}
+	return la < lb ? -1 : la > lb;
+}
+
+bool bear_string_starts(uint8_t *value, uint8_t *prefix) {
+	uint64_t length = string_length(prefix);
+	return length <= string_length(value) &&
+		mismatch(string_data(value), string_data(prefix), length) == length;
+}
+
+bool bear_string_ends(uint8_t *value, uint8_t *suffix) {
+	uint64_t length = string_length(suffix), value_length = string_length(value);
+	return length <= value_length &&
+		mismatch(string_data(value) + value_length - length, string_data(suffix), length) == length;
+}
+
+int64_t bear_string_find(uint8_t *value, uint8_t *needle) {
+	return find(string_data(value), string_length(value), string_data(needle), string_length(needle));
+}
+
+// stdin and stdout go through these buffers rather than stdio, so printing
+// and reading are mostly memcpy
+#define IO_BUFFER_SIZE 65536
+
+static uint8_t out_buffer[IO_BUFFER_SIZE];
+static size_t out_used = 0;
+
+static uint8_t in_buffer[IO_BUFFER_SIZE];
+static size_t in_pos = 0, in_end = 0;
+
+static void write_all(const uint8_t *data, size_t length) {
+	while (length) {
+		ssize_t written = write(STDOUT_FILENO, data, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// nowhere left to report it, like a closed pipe
+			return;
 		}
+		data += written;
+		length -= written;
 	}
-	return true;
+}
+
+void bear_flush(void) {
+	size_t used = out_used;
+	out_used = 0;
+	write_all(out_buffer, used);
+}
+
+__attribute__((constructor))
+static void setup_output(void) {
+	atexit(bear_flush);
+}
+
+// the work of the constructors, for `cub run`, which links this file in
+// without running them
+void bear_start(void) {
+	select_string_kernels();
+	setup_output();
+}
+
+static void buffer_output(const uint8_t *data, size_t length) {
+	if (out_used + length > IO_BUFFER_SIZE) {
+		bear_flush();
+	}
+	if (length >= IO_BUFFER_SIZE) {
+		write_all(data, length);
+		return;
+	}
+	memcpy(out_buffer + out_used, data, length);
+	out_used += length;
 }
 
 void bear_print(uint8_t *head) {
-	uint64_t length = (*(uint64_t*) head) & ~0x8000000000000000;
-	fwrite(head + 8, sizeof(*head), length, stdout);
+	buffer_output(string_data(head), string_length(head));
 }
 
 void bear_print_number(uint64_t value/*, uint8_t *str*/) {
-	printf("%lu\n", value);
+	char text[24];
+	int length = snprintf(text, sizeof(text), "%lu\n", value);
+	buffer_output((uint8_t*) text, length);
 /*	uint64_t slen = *(uint64_t*) bstr;
 	slen &= ~0x8000000000000000;
 	char temp[slen + 1];
@@ -197,18 +923,306 @@ void bear_print_number(uint64_t value/*, uint8_t *str*/) {
 	printf("%lu %s\n", value, temp);*/
 }
 
+// reads up to length bytes straight from stdin, returning 0 at the end
+static size_t read_some(uint8_t *data, size_t length) {
+	// whatever we printed should show before we wait on input
+	bear_flush();
+	for (;;) {
+		ssize_t got = read(STDIN_FILENO, data, length);
+		if (got >= 0) {
+			return got;
+		}
+		if (errno != EINTR) {
+			return 0;
+		}
+	}
+}
+
+static bool fill_input(void) {
+	in_pos = 0;
+	in_end = read_some(in_buffer, IO_BUFFER_SIZE);
+	return in_end != 0;
+}
+
+// a flat heap string of the given bytes, allocated without collecting
+static uint8_t *new_string(const uint8_t *data, uint64_t length) {
+	uint8_t *out = allocate(&array_meta[ARRAY_PRIMITIVE], 8 + length);
+	*(uint64_t*) out = length;
+	if (length) {
+		memcpy(out + 8, data, length);
+	}
+	return out;
+}
+
 uint32_t bear_read() {
-	int value = fgetc(stdin);
-	if (value == EOF) {
+	if (in_pos == in_end && !fill_input()) {
 		return -1;
 	}
+	return in_buffer[in_pos++];
+}
+
+bool bear_input_end(void) {
+	return in_pos == in_end && !fill_input();
+}
+
+// the next line without its newline, or the rest of the input if it has none
+uint8_t *bear_read_line(void) {
+	uint8_t *line = NULL;
+	size_t length = 0, capacity = 0;
+	while (in_pos != in_end || fill_input()) {
+		uint8_t *start = in_buffer + in_pos;
+		uint8_t *newline = memchr(start, '\n', in_end - in_pos);
+		size_t chunk = (newline ? newline : in_buffer + in_end) - start;
+		if (line == NULL && newline) {
+			// the whole line is already buffered
+			in_pos += chunk + 1;
+			return new_string(start, chunk);
+		}
+		if (length + chunk > capacity) {
+			capacity = (length + chunk) * 2;
+			line = realloc(line, capacity);
+			if (line == NULL) {
+				fputs("out of memory\n", stderr);
+				abort();
+			}
+		}
+		memcpy(line + length, start, chunk);
+		length += chunk;
+		in_pos += chunk;
+		if (newline) {
+			in_pos++;
+			break;
+		}
+	}
+	uint8_t *out = new_string(line, length);
+	free(line);
+	return out;
+}
+
+// fills count bytes of dest from start, returning fewer only at the end
+uint32_t bear_read_bytes(uint8_t *dest, uint32_t start, uint32_t count) {
+	uint64_t length = *(uint64_t*) dest;
+	if ((uint64_t) start + count > length) {
+		bear_range_fail(start, (uint64_t) start + count, length);
+	}
+	uint8_t *data = dest + 8 + start;
+	uint32_t done = 0;
+	while (done < count) {
+		if (in_pos == in_end) {
+			if (count - done >= IO_BUFFER_SIZE) {
+				// too big to be worth buffering
+				size_t got = read_some(data + done, count - done);
+				if (got == 0) {
+					break;
+				}
+				done += got;
+				continue;
+			}
+			if (!fill_input()) {
+				break;
+			}
+		}
+		size_t chunk = in_end - in_pos;
+		if (chunk > count - done) {
+			chunk = count - done;
+		}
+		memcpy(data + done, in_buffer + in_pos, chunk);
+		in_pos += chunk;
+		done += chunk;
+	}
+	return done;
+}
+
+// the rest of stdin as one string
+uint8_t *bear_read_all(void) {
+	size_t length = in_end - in_pos, capacity = length + IO_BUFFER_SIZE;
+	uint8_t *all = malloc(capacity);
+	if (all == NULL) {
+		fputs("out of memory\n", stderr);
+		abort();
+	}
+	memcpy(all, in_buffer + in_pos, length);
+	in_pos = in_end;
+	for (;;) {
+		if (length == capacity) {
+			capacity *= 2;
+			all = realloc(all, capacity);
+			if (all == NULL) {
+				fputs("out of memory\n", stderr);
+				abort();
+			}
+		}
+		size_t got = read_some(all + length, capacity - length);
+		if (got == 0) {
+			break;
+		}
+		length += got;
+	}
+	uint8_t *out = new_string(all, length);
+	free(all);
+	return out;
+}
+
+// the contents of the file at path, without copying or reading it up front
+uint8_t *bear_map_file(uint8_t *path) {
+	uint64_t path_length = string_length(path);
+	char name[path_length + 1];
+	memcpy(name, string_data(path), path_length);
+	name[path_length] = 0;
+
+	int fd = open(name, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0) {
+		bear_flush();
+		fprintf(stderr, "cannot open %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+	uint64_t length = info.st_size;
+	if (length == 0) {
+		close(fd);
+		return new_string(NULL, 0);
+	}
+	if (length & STRING_FLAGS) {
+		bear_flush();
+		fprintf(stderr, "%s is too large\n", name);
+		exit(1);
+	}
+	uint8_t *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		bear_flush();
+		fprintf(stderr, "cannot map %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+	madvise(data, length, MADV_SEQUENTIAL);
+
+	// allocate does not collect, so the mapping stays alive
+	struct mapping *mapping = (struct mapping*) allocate(&mapping_meta, sizeof(struct mapping));
+	mapping->length = length;
+	mapping->data = data;
+	// the mapped bytes count toward the next collection, which unmaps them
+	((struct span*) mapping)[-1].size += length;
+	allocated += length;
+	return new_slice((uint8_t*) mapping, data, length);
+}
+
+// INTEGER TEXT
+
+static const uint64_t powers_of_ten[] = {
+	1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u,
+	1000000000u, 10000000000u, 100000000000u, 1000000000000u,
+	10000000000000u, 100000000000000u, 1000000000000000u,
+	10000000000000000u, 100000000000000000u, 1000000000000000000u,
+	10000000000000000000u
+};
+
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// the number of decimal digits in value, from its bit length: 1233 / 4096 is
+// just over log10(2)
+static unsigned count_digits(uint64_t value) {
+	unsigned bits = 64 - __builtin_clzll(value | 1);
+	unsigned guess = (bits * 1233) >> 12;
+	return guess + ((value | 1) >= powers_of_ten[guess]);
+}
+
+// writes the digits of value so they end just before end
+static void write_digits(uint8_t *end, uint64_t value) {
+	while (value >= 100) {
+		const char *pair = &digit_pairs[(value % 100) * 2];
+		value /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	if (value >= 10) {
+		*--end = digit_pairs[value * 2 + 1];
+		*--end = digit_pairs[value * 2];
+	} else {
+		*--end = '0' + value;
+	}
+}
+
+static uint8_t *format_integer(uint64_t magnitude, bool negative) {
+	uint64_t length = count_digits(magnitude) + negative;
+	uint8_t *out = allocate(&array_meta[ARRAY_PRIMITIVE], 8 + length);
+	*(uint64_t*) out = length;
+	if (negative) {
+		out[8] = '-';
+	}
+	write_digits(out + 8 + length, magnitude);
+	return out;
+}
+
+uint8_t *bear_format_u64(uint64_t value) {
+	return format_integer(value, false);
+}
+
+uint8_t *bear_format_s64(int64_t value) {
+	// negating in unsigned also covers the most negative value
+	return value < 0 ? format_integer(-(uint64_t) value, true) : format_integer(value, false);
+}
+
+static void parse_fail(uint8_t *text, const char *reason) {
+	bear_flush();
+	fprintf(stderr, "cannot parse \"%.*s\": %s\n", (int) string_length(text), string_data(text), reason);
+	exit(1);
+}
+
+// the digits of text as an integer no bigger than limit
+static uint64_t parse_digits(uint8_t *text, const uint8_t *digits, uint64_t length, uint64_t limit) {
+	if (length == 0) {
+		parse_fail(text, "no digits");
+	}
+	uint64_t value = 0;
+	for (uint64_t i = 0; i < length; i++) {
+		unsigned digit = digits[i] - '0';
+		if (digit > 9) {
+			parse_fail(text, "not a digit");
+		}
+		if (value > (limit - digit) / 10) {
+			parse_fail(text, "out of range");
+		}
+		value = value * 10 + digit;
+	}
 	return value;
 }
 
+// parses an unsigned integer no bigger than limit, so narrower types share the
+// 64-bit range check
+uint64_t bear_parse_unsigned(uint8_t *text, uint64_t limit) {
+	return parse_digits(text, string_data(text), string_length(text), limit);
+}
+
+// parses a signed integer in [-limit - 1, limit]
+int64_t bear_parse_signed(uint8_t *text, uint64_t limit) {
+	const uint8_t *digits = string_data(text);
+	uint64_t length = string_length(text);
+	bool negative = length && digits[0] == '-';
+	if (length && (digits[0] == '-' || digits[0] == '+')) {
+		digits++;
+		length--;
+	}
+	uint64_t magnitude = parse_digits(text, digits, length, negative ? limit + 1 : limit);
+	return negative ? (int64_t) -magnitude : (int64_t) magnitude;
+}
+
+uint64_t bear_parse_u64(uint8_t *text) {
+	return bear_parse_unsigned(text, UINT64_MAX);
+}
+
+int64_t bear_parse_s64(uint8_t *text) {
+	return bear_parse_signed(text, INT64_MAX);
+}
+
+// floor(log2(value)), and 0 for 0
 uint8_t bear_log2(uint8_t value) {
-	return log2f(value);
+	return 31 - __builtin_clz(value | 1);
 }
 
+// floor(log10(value)), and 0 for 0
 uint8_t bear_log10(uint8_t value) {
-	return log10f(value);
+	return count_digits(value) - 1;
 }
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/Target.h>
+
+#include "../backend.h"
+#include "llvm-object.h"
+
+#include "out/lib/llvm-harness.h"
+
+// Runs the program inside the compiler. The module goes through the same
+// pipeline as backend_write_object, then ORC compiles it to memory and links
+// it against the harness, which is built into cub as an object file, with
+// libc coming from this process. The whole program is the one main function,
+// so there is nothing to compile lazily: it all runs as soon as it's linked.
+
+// the harness also needs these from the static parts of libc and libgcc, which
+// searching the process can't find
+extern void __cpu_indicator_init(void);
+extern char __cpu_model[];
+
+static void define_static_symbols(LLVMOrcLLJITRef jit, LLVMOrcJITDylibRef dylib) {
+	struct {
+		const char *name;
+		void *address;
+	} symbols[] = {
+		{"atexit", (void*) atexit},
+		{"__cpu_indicator_init", (void*) __cpu_indicator_init},
+		{"__cpu_model", __cpu_model}
+	};
+	size_t count = sizeof(symbols) / sizeof(symbols[0]);
+
+	LLVMJITCSymbolMapPair pairs[count];
+	for (size_t i = 0; i < count; i++) {
+		pairs[i].Name = LLVMOrcLLJITMangleAndIntern(jit, symbols[i].name);
+		pairs[i].Sym = (LLVMJITEvaluatedSymbol) {
+			.Address = (LLVMOrcExecutorAddress) symbols[i].address,
+			.Flags = {.GenericFlags = LLVMJITSymbolGenericFlagsExported}
+		};
+	}
+	check_error("cannot define the runtime symbols", LLVMOrcJITDylibDefine(
+		dylib, LLVMOrcAbsoluteSymbols(pairs, count)));
+}
+
+static LLVMOrcExecutorAddress lookup(LLVMOrcLLJITRef jit, const char *name) {
+	LLVMOrcExecutorAddress address;
+	check_error("unresolved symbol", LLVMOrcLLJITLookup(jit, &address, name));
+	return address;
+}
+
+int backend_run(code_system *system) {
+	LLVMInitializeNativeTarget();
+	LLVMInitializeNativeAsmPrinter();
+
+	LLVMOrcLLJITRef jit;
+	check_error("cannot start the JIT", LLVMOrcCreateLLJIT(&jit, NULL));
+
+	LLVMOrcThreadSafeContextRef tsc = LLVMOrcCreateNewThreadSafeContext();
+	// for the host, whose layout is the JIT's too
+	LLVMTargetMachineRef machine = create_target_machine();
+	LLVMModuleRef module = read_module(LLVMOrcThreadSafeContextGetContext(tsc),
+		system, machine);
+	optimize_module(module, machine);
+	LLVMDisposeTargetMachine(machine);
+	LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+
+	LLVMOrcDefinitionGeneratorRef process;
+	check_error("cannot search this process", LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+		&process, LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL));
+	LLVMOrcJITDylibAddGenerator(dylib, process);
+	define_static_symbols(jit, dylib);
+
+	LLVMMemoryBufferRef harness = LLVMCreateMemoryBufferWithMemoryRangeCopy(
+		(const char*) out_lib_llvm_harness_o, out_lib_llvm_harness_o_len,
+		"llvm-harness.o");
+	check_error("cannot load the harness",
+		LLVMOrcLLJITAddObjectFile(jit, dylib, harness));
+
+	LLVMOrcThreadSafeModuleRef tsm = LLVMOrcCreateNewThreadSafeModule(module, tsc);
+	check_error("cannot add the program",
+		LLVMOrcLLJITAddLLVMIRModule(jit, dylib, tsm));
+	LLVMOrcDisposeThreadSafeContext(tsc);
+
+	// ORC doesn't run the harness constructors, so do their work by hand
+	((void (*)(void)) lookup(jit, "bear_start"))();
+	// the JIT stays up, since bear_start registered its output flush to run at
+	// exit
+	return ((int (*)(void)) lookup(jit, "main"))();
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <llvm-c/BitReader.h>
+#include <llvm-c/Core.h>
+#include <llvm-c/IRReader.h>
+#include <llvm-c/Linker.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "../backend.h"
+#include "llvm-object.h"
+
+#include "out/lib/llvm-runtime.h"
+
+// Compiles straight to an object file inside this process, instead of piping
+// the IR through llc and the assembler. The module still comes from
+// backend_write, so there's one lowering to maintain, but it never leaves
+// memory: LLVM parses it from the buffer, optimizes it with the default
+// pipeline and emits machine code directly.
+//
+// Before optimizing, the module gets the runtime bitcode from
+// llvm-runtime.ll, which is built along with cub, so the harness helpers it
+// has bodies for can inline into the program. Both take the target machine's
+// triple and data layout first, so they link without a mismatch.
+
+static void fail(const char *what, char *message) {
+	fprintf(stderr, "cub: %s: %s\n", what, message);
+	LLVMDisposeMessage(message);
+	exit(1);
+}
+
+// both modules are for the machine's target
+static void set_target(LLVMModuleRef module, LLVMTargetMachineRef machine) {
+	char *triple = LLVMGetTargetMachineTriple(machine);
+	LLVMSetTarget(module, triple);
+	LLVMDisposeMessage(triple);
+	LLVMTargetDataRef layout = LLVMCreateTargetDataLayout(machine);
+	LLVMSetModuleDataLayout(module, layout);
+	LLVMDisposeTargetData(layout);
+}
+
+LLVMModuleRef read_module(LLVMContextRef context, code_system *system,
+		LLVMTargetMachineRef machine) {
+	char *text;
+	size_t length;
+	FILE *out = open_memstream(&text, &length);
+	if (out == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+	backend_write(system, out);
+	fclose(out);
+
+	// the context takes ownership of the buffer, which copies the text
+	LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRangeCopy(
+		text, length, "cub");
+	free(text);
+
+	LLVMModuleRef module;
+	char *message;
+	if (LLVMParseIRInContext(context, buffer, &module, &message)) {
+		fail("invalid module", message);
+	}
+	set_target(module, machine);
+
+	LLVMMemoryBufferRef bitcode = LLVMCreateMemoryBufferWithMemoryRange(
+		(const char*) out_lib_llvm_runtime_bc, out_lib_llvm_runtime_bc_len,
+		"llvm-runtime.bc", false);
+	LLVMModuleRef runtime;
+	if (LLVMParseBitcodeInContext2(context, bitcode, &runtime)) {
+		fputs("cub: invalid runtime bitcode\n", stderr);
+		exit(1);
+	}
+	LLVMDisposeMemoryBuffer(bitcode);
+	set_target(runtime, machine);
+	// takes the runtime apart in the process
+	if (LLVMLinkModules2(module, runtime)) {
+		fputs("cub: cannot link the runtime bitcode\n", stderr);
+		exit(1);
+	}
+	return module;
+}
+
+// the programs run where they're compiled, so this is for the host
+LLVMTargetMachineRef create_target_machine(void) {
+	LLVMInitializeNativeTarget();
+	LLVMInitializeNativeAsmPrinter();
+
+	char *triple = LLVMGetDefaultTargetTriple();
+	LLVMTargetRef target;
+	char *message;
+	if (LLVMGetTargetFromTriple(triple, &target, &message)) {
+		fail("unknown target", message);
+	}
+
+	// position-independent, so the object links into the default gcc output
+	LLVMTargetMachineRef machine = LLVMCreateTargetMachine(target, triple,
+		"generic", "", LLVMCodeGenLevelDefault, LLVMRelocPIC,
+		LLVMCodeModelDefault);
+	LLVMDisposeMessage(triple);
+	return machine;
+}
+
+void check_error(const char *what, LLVMErrorRef error) {
+	if (error != NULL) {
+		char *message = LLVMGetErrorMessage(error);
+		fprintf(stderr, "cub: %s: %s\n", what, message);
+		LLVMDisposeErrorMessage(message);
+		exit(1);
+	}
+}
+
+void optimize_module(LLVMModuleRef module, LLVMTargetMachineRef machine) {
+	LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+	LLVMErrorRef error = LLVMRunPasses(module, "default<O2>", machine, options);
+	LLVMDisposePassBuilderOptions(options);
+	check_error("optimization failed", error);
+}
+
+void backend_write_object(code_system *system, const char *filename) {
+	LLVMContextRef context = LLVMContextCreate();
+	LLVMTargetMachineRef machine = create_target_machine();
+	LLVMModuleRef module = read_module(context, system, machine);
+
+	optimize_module(module, machine);
+
+	char *message;
+	if (LLVMTargetMachineEmitToFile(machine, module, (char*) filename,
+			LLVMObjectFile, &message)) {
+		fail("error writing output-file", message);
+	}
+
+	LLVMDisposeTargetMachine(machine);
+	LLVMDisposeModule(module);
+	LLVMContextDispose(context);
+}
@@ -0,0 +1,19 @@
+#ifndef LLVM_BACKEND_OBJECT_H
+#define LLVM_BACKEND_OBJECT_H
+
+#include <llvm-c/Core.h>
+#include <llvm-c/TargetMachine.h>
+
+#include "../generate.h"
+
+// the module backend_write produces, parsed into context and linked with the
+// runtime bitcode, for machine's target
+LLVMModuleRef read_module(LLVMContextRef context, code_system *system,
+	LLVMTargetMachineRef machine);
+LLVMTargetMachineRef create_target_machine(void);
+void optimize_module(LLVMModuleRef module, LLVMTargetMachineRef machine);
+
+// exits with the message when error is set
+void check_error(const char *what, LLVMErrorRef error);
+
+#endif
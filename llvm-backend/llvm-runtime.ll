@@ -0,0 +1,91 @@
+; The bodies of the harness's hottest small helpers, for LLVM to inline into
+; programs. cub links this into every module before optimizing it, and since
+; the definitions are available_externally they only ever get inlined: the
+; ones in llvm-harness.c stay the only ones emitted, and these have to keep
+; doing exactly what those do, which test/run-tests.sh checks.
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @memcmp(i8* nocapture, i8* nocapture, i64) nounwind readonly
+
+; the first byte of a string, given its length word: a slice keeps a pointer
+; to it in place of the bytes
+define internal i8* @string_data(i8* %value, i64 %word) alwaysinline nounwind readonly {
+entry:
+  %slice = and i64 %word, 4611686018427387904
+  %is_slice = icmp ne i64 %slice, 0
+  %field = getelementptr i8, i8* %value, i64 8
+  br i1 %is_slice, label %view, label %flat
+view:
+  %pointer = bitcast i8* %field to i8**
+  %data = load i8*, i8** %pointer, align 8
+  ret i8* %data
+flat:
+  ret i8* %field
+}
+
+define available_externally i1 @bear_streq(i8* %a, i8* %b) nounwind readonly {
+entry:
+  %same = icmp eq i8* %a, %b
+  br i1 %same, label %equal, label %flags
+flags:
+  %ap = bitcast i8* %a to i64*
+  %bp = bitcast i8* %b to i64*
+  %aw = load i64, i64* %ap, align 8
+  %bw = load i64, i64* %bp, align 8
+  ; both unique for their contents, being static or interned
+  %au = and i64 %aw, -6917529027641081856
+  %bu = and i64 %bw, -6917529027641081856
+  %a_unique = icmp ne i64 %au, 0
+  %b_unique = icmp ne i64 %bu, 0
+  %unique = and i1 %a_unique, %b_unique
+  br i1 %unique, label %different, label %lengths
+lengths:
+  %la = and i64 %aw, 2305843009213693951
+  %lb = and i64 %bw, 2305843009213693951
+  %same_length = icmp eq i64 %la, %lb
+  br i1 %same_length, label %bytes, label %different
+bytes:
+  %da = call i8* @string_data(i8* %a, i64 %aw)
+  %db = call i8* @string_data(i8* %b, i64 %bw)
+  %order = call i32 @memcmp(i8* %da, i8* %db, i64 %la)
+  %match = icmp eq i32 %order, 0
+  ret i1 %match
+equal:
+  ret i1 true
+different:
+  ret i1 false
+}
+
+; orders a and b by their bytes, then by length
+define available_externally i32 @bear_strcmp(i8* %a, i8* %b) nounwind readonly {
+entry:
+  %same = icmp eq i8* %a, %b
+  br i1 %same, label %equal, label %compare
+compare:
+  %ap = bitcast i8* %a to i64*
+  %bp = bitcast i8* %b to i64*
+  %aw = load i64, i64* %ap, align 8
+  %bw = load i64, i64* %bp, align 8
+  %la = and i64 %aw, 2305843009213693951
+  %lb = and i64 %bw, 2305843009213693951
+  %a_shorter = icmp ult i64 %la, %lb
+  %shorter = select i1 %a_shorter, i64 %la, i64 %lb
+  %da = call i8* @string_data(i8* %a, i64 %aw)
+  %db = call i8* @string_data(i8* %b, i64 %bw)
+  %order = call i32 @memcmp(i8* %da, i8* %db, i64 %shorter)
+  %differ = icmp ne i32 %order, 0
+  br i1 %differ, label %bytes, label %lengths
+bytes:
+  %below = icmp slt i32 %order, 0
+  %sign = select i1 %below, i32 -1, i32 1
+  ret i32 %sign
+lengths:
+  %a_longer = icmp ugt i64 %la, %lb
+  %longer = zext i1 %a_longer to i32
+  %result = select i1 %a_shorter, i32 -1, i32 %longer
+  ret i32 %result
+equal:
+  ret i32 0
+}
@@ -1,66 +1,94 @@
+#include <stdarg.h>
+#include <string.h>
+
+#include "../xalloc.h"
 #include "patch.h"
 
-struct patchent *fent = NULL;
-struct patchvar *fvar = NULL;
+// The output is one contiguous buffer per thread, formatted straight into its
+// spare capacity, and a variable that isn't known yet takes up no text: a
+// fixup records where its value goes, and pt_finalize writes the text between
+// fixups as it goes.
 
-void pt_reset() {
-	{
-		struct patchent *cur = fent;
-		while (cur != NULL) {
-			struct patchent *next = cur->next;
-			if (!cur->is_ref) {
-				free(cur->data);
-			}
-			free(cur);
-			cur = next;
+static _Thread_local struct patchlist current;
+
+static void free_list(struct patchlist *list) {
+	buffer_free(&list->text);
+	free(list->fixups);
+	struct patchchunk *chunk = list->chunks;
+	while (chunk != NULL) {
+		struct patchchunk *next = chunk->next;
+		for (size_t i = 0; i < chunk->used; i++) {
+			free(chunk->vars[i].value);
 		}
+		free(chunk);
+		chunk = next;
 	}
-	{
-		struct patchvar *cur = fvar;
-		while (cur != NULL) {
-			struct patchvar *next = cur->next;
-			free(cur->value);
-			free(cur);
-			cur = next;
+	memset(list, 0, sizeof(*list));
+}
+
+void pt_reset() {
+	free_list(&current);
+}
+
+void pt_finalize(FILE *out) {
+	size_t written = 0;
+	for (size_t i = 0; i < current.fixup_count; i++) {
+		struct patchfixup *fixup = &current.fixups[i];
+		if (fixup->var->value == NULL) {
+			fputs("variable not completed\n", stderr);
+			exit(1);
 		}
+		fwrite(current.text.data + written, 1, fixup->position - written, out);
+		fputs(fixup->var->value, out);
+		written = fixup->position;
 	}
-	fent = NULL;
-	fvar = NULL;
+	fwrite(current.text.data + written, 1, current.text.used - written, out);
+
+	pt_reset();
 }
 
-void pt_finalize(FILE *out) {
-	struct patchent *cur = fent;
-	struct patchent *last = NULL;
-
-	while (cur != NULL) { // reverse the linked list
-		struct patchent *next = cur->next;
-		cur->next = last;
-		last = cur;
-		cur = next;
+void pt_take(struct patchlist *list) {
+	*list = current;
+	memset(&current, 0, sizeof(current));
+}
+
+void pt_append(struct patchlist *list) {
+	size_t offset = current.text.used;
+	buffer_append_mem(&current.text, list->text.data, list->text.used);
+	for (size_t i = 0; i < list->fixup_count; i++) {
+		resize(current.fixup_count, &current.fixup_cap, (void**) &current.fixups,
+			sizeof(struct patchfixup));
+		current.fixups[current.fixup_count++] = (struct patchfixup) {
+			.position = list->fixups[i].position + offset,
+			.var = list->fixups[i].var
+		};
 	}
-	fent = last;
-
-	cur = fent;
-	while (cur != NULL) {
-		if (cur->is_ref) {
-			if (cur->ref->value == NULL) {
-				fputs("variable not completed\n", stderr);
-				exit(1);
-			}
-			fputs(cur->ref->value, out);
+
+	// behind the chunk pt_def is filling, which stays first
+	if (list->chunks != NULL) {
+		if (current.chunks == NULL) {
+			current.chunks = list->chunks;
 		} else {
-			fputs(cur->data, out);
+			struct patchchunk *last = list->chunks;
+			while (last->next != NULL) {
+				last = last->next;
+			}
+			last->next = current.chunks->next;
+			current.chunks->next = list->chunks;
 		}
-		cur = cur->next;
+		list->chunks = NULL;
 	}
-
-	pt_reset();
+	free_list(list);
 }
 
 struct patchvar *pt_def() {
-	struct patchvar *out = malloc(sizeof(struct patchvar));
-	out->next = fvar;
-	fvar = out;
+	if (current.chunks == NULL || current.chunks->used == PATCH_CHUNK) {
+		struct patchchunk *chunk = xmalloc(sizeof(struct patchchunk));
+		chunk->next = current.chunks;
+		chunk->used = 0;
+		current.chunks = chunk;
+	}
+	struct patchvar *out = &current.chunks->vars[current.chunks->used++];
 	out->value = NULL;
 	return out;
 }
@@ -84,18 +112,34 @@ const char *pt_fetch(struct patchvar *var) {
 	return var->value;
 }
 
-struct patchent *pt_new_ent(bool is_ref) {
-	struct patchent *out = malloc(sizeof(struct patchent));
-	out->next = fent;
-	fent = out;
-	out->is_ref = is_ref;
-	return out;
-}
-
 void pt_use(struct patchvar *var) {
-	pt_new_ent(true)->ref = var;
+	resize(current.fixup_count, &current.fixup_cap, (void**) &current.fixups,
+		sizeof(struct patchfixup));
+	current.fixups[current.fixup_count++] = (struct patchfixup) {
+		.position = current.text.used,
+		.var = var
+	};
 }
 
-void pt_write(char *text) {
-	pt_new_ent(false)->data = text;
+void pt_format(const char *format, ...) {
+	buffer *text = &current.text;
+	buffer_realloc(text, 128);
+
+	va_list args, retry;
+	va_start(args, format);
+	va_copy(retry, args);
+	int length = vsnprintf(text->data + text->used, text->total - text->used,
+		format, args);
+	if (length < 0) {
+		perror("vsnprintf");
+		exit(1);
+	}
+	if ((size_t) length >= text->total - text->used) {
+		buffer_realloc(text, (size_t) length + 1);
+		vsnprintf(text->data + text->used, text->total - text->used, format,
+			retry);
+	}
+	va_end(retry);
+	va_end(args);
+	text->used += (size_t) length;
 }
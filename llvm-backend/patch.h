@@ -4,31 +4,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../bool.h"
+#include "../buffer.h"
 
-struct patchent {
-	bool is_ref;
-	union {
-		char *data;
-		struct patchvar *ref;
-	};
-	struct patchent *next;
-};
-
+// a value that's printed before it's known, like a struct type that depends on
+// how many roots get spilled after it, or a phi source from a later block
 struct patchvar {
 	char *value;
-	struct patchvar *next;
 };
 
+// where a variable's value goes in the text
+struct patchfixup {
+	size_t position;
+	struct patchvar *var;
+};
+
+// variables are allocated in chunks and freed together
+#define PATCH_CHUNK 256
+
+struct patchchunk {
+	struct patchchunk *next;
+	size_t used;
+	struct patchvar vars[PATCH_CHUNK];
+};
+
+// the text a thread printed, with the fixups into it and the variables it
+// defined, to join onto another thread's
+struct patchlist {
+	buffer text;
+	struct patchfixup *fixups;
+	size_t fixup_count, fixup_cap;
+	struct patchchunk *chunks;
+};
+
+// each thread writes to its own list, and pt_finalize prints the calling
+// thread's
 void pt_reset();
 void pt_finalize(FILE *out);
 
+// moves everything this thread has written since its last pt_take into list
+void pt_take(struct patchlist *list);
+// adds list after everything this thread has written so far
+void pt_append(struct patchlist *list);
+
 struct patchvar *pt_def();
 void pt_put(struct patchvar *var, char *value);
 const char *pt_fetch(struct patchvar *var);
 void pt_use(struct patchvar *var);
-void pt_write(char *text);
+void pt_format(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
 
-#define pt_printf(...) { char *cptr; if (asprintf(&cptr, __VA_ARGS__) == -1) { perror("asprintf"); exit(1); } pt_write(cptr); }
+#define pt_printf(...) { pt_format(__VA_ARGS__); }
 
 #endif
-
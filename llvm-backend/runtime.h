@@ -0,0 +1,53 @@
+#ifndef LLVM_BACKEND_RUNTIME_H
+#define LLVM_BACKEND_RUNTIME_H
+
+#include <stdint.h>
+
+// The layout of the runtime's data as the harness, the interpreter and every
+// backend see it. The C backend copies this file into the programs it writes.
+
+// how the collector walks an object, which points at one from its header
+struct metastruct {
+	uint32_t length;
+	uint32_t struct_id;
+	// the compiler lays out the fields the collector follows contiguously from
+	// this offset: first the objects and arrays, then the strings
+	uint32_t refs;
+	uint16_t object_refs;
+	uint16_t string_refs;
+	// with --compressed-refs, the object fields are instead 32-bit offsets
+	// from bear_heap_base, laid out contiguously from here
+	uint32_t narrow;
+	uint32_t narrow_refs;
+	// a subclass's ranges only cover the fields it adds, and its parent's
+	// metastruct covers the rest
+	struct metastruct *parent;
+};
+
+// arrays are a 64-bit length followed by the elements, and get one of these
+// metastructs depending on whether the elements need to be enumerated
+enum array_kind {
+	ARRAY_PRIMITIVE=0,
+	ARRAY_OBJECT=1,
+	ARRAY_STRING=2,
+	// not an array: a string slice, see bear_string_slice
+	STRING_SLICE=3
+};
+
+#define ARRAY_STRUCT_ID 0xFFFFFFF0
+
+// the top bits of a string's length mark static strings, slices and heap
+// strings in the intern table
+#define STRING_STATIC 0x8000000000000000
+#define STRING_SLICE_BIT 0x4000000000000000
+#define STRING_INTERNED 0x2000000000000000
+#define STRING_FLAGS (STRING_STATIC | STRING_SLICE_BIT | STRING_INTERNED)
+
+// a slice shares the bytes of another string, and keeps it alive through base
+struct slice {
+	uint64_t length;
+	uint8_t *data;
+	uint8_t *base;
+};
+
+#endif
@@ -4,6 +4,7 @@
 typedef enum {
   O_BITWISE_NOT,       // 1
   O_BLOCKREF,          // 1
+  O_BOUNDS_CHECK,      // 2
   O_CALL,              // UNUSED
   O_CAST,              // 2
   O_COMPARE,           // 2
@@ -30,7 +31,7 @@ typedef enum {
   O_SET_SYMBOL,        // UNUSED
   O_SHIFT,             // 2
   O_SHIFT_ASSIGN,      // UNUSED
-  O_STR_CONCAT,        // 2
+  O_STR_CONCAT,
   O_STR_CONCAT_ASSIGN, // UNUSED
   O_TERNARY            // UNUSED
 } operation_type;
@@ -88,6 +89,20 @@ typedef enum {
   O_DECREMENT
 } postfix_type;
 
+typedef enum {
+  // allocates the result exactly
+  O_CONCAT,
+  // appends to the first part, leaving room to append again
+  O_APPEND
+} concat_type;
+
+typedef enum {
+  // collected by the GC
+  O_HEAP,
+  // in a stack slot, for objects that never leave their block
+  O_STACK
+} allocation_type;
+
 typedef enum {
   O_ASHIFT,
   O_LSHIFT,
@@ -97,8 +112,10 @@ typedef enum {
 typedef struct {
   operation_type type;
   union {
+    allocation_type allocation_type;
     cast_type cast_type;
     compare_type compare_type;
+    concat_type concat_type;
     logic_type logic_type;
     numeric_type numeric_type;
     postfix_type postfix_type;
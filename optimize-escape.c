@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "optimize.h"
+
+// Stack allocation. Each block runs to completion before the next starts, and
+// the whole program is one function, so an object that never leaves the block
+// that allocates it is dead by the time that block can run again. Such
+// objects get one fixed stack slot per allocation site instead of going
+// through bear_new, which collects on every call.
+
+// Scalar replacement goes one step further for structs that are only read and
+// written through: every field becomes the SSA value last stored into it, and
+// the allocation goes away entirely.
+
+// arrays beyond this many elements stay on the heap
+#define MAX_STACK_ARRAY 64
+
+// whether an instruction that uses value only reads or writes inside it
+static bool is_local_use(code_instruction *ins, size_t value) {
+  size_t *ip = ins->parameters;
+  switch (ins->operation.type) {
+  case O_BOUNDS_CHECK:
+  case O_GET_FIELD:
+  case O_GET_INDEX:
+  case O_GET_LENGTH:
+    return ip[0] == value;
+  case O_SET_FIELD:
+  case O_SET_INDEX:
+    // storing the object itself somewhere lets it out
+    return ip[0] == value && ip[2] != value;
+  case O_COMPARE:
+    return true;
+  case O_NATIVE:
+    return is_bulk_native(ins->native_call);
+  default:
+    return false;
+  }
+}
+
+static bool escapes(code_block *block, size_t value) {
+  for (size_t j = value - block->parameter_count + 1;
+      j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    struct use_data use = {.value = value, .found = false};
+    each_operand(ins, find_use, &use);
+    if (use.found && !is_local_use(ins, value)) {
+      return true;
+    }
+  }
+
+  struct use_data use = {.value = value, .found = false};
+  each_tail_operand(block, find_use, &use);
+  return use.found;
+}
+
+// whether an array allocation has a small length known at compile time
+static bool is_small_array(code_block *block, code_instruction *ins) {
+  code_instruction *length = get_instruction(block, ins->parameters[0]);
+  if (!length || length->operation.type != O_LITERAL) {
+    return false;
+  }
+
+  switch (length->type->type) {
+  case T_U8: return length->value_u8 <= MAX_STACK_ARRAY;
+  case T_U16: return length->value_u16 <= MAX_STACK_ARRAY;
+  case T_U32: return length->value_u32 <= MAX_STACK_ARRAY;
+  case T_U64: return length->value_u64 <= MAX_STACK_ARRAY;
+  default: return false;
+  }
+}
+
+// whether every use of value is a field access through it, and every field is
+// stored before it is loaded
+static bool is_scalar(code_block *block, size_t value, size_t field_count) {
+  bool stored[field_count + 1];
+  memset(stored, 0, sizeof(stored));
+
+  for (size_t j = value - block->parameter_count + 1;
+      j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    struct use_data use = {.value = value, .found = false};
+    each_operand(ins, find_use, &use);
+    if (!use.found) {
+      continue;
+    }
+
+    size_t *ip = ins->parameters;
+    switch (ins->operation.type) {
+    case O_GET_FIELD:
+      if (!stored[ip[1]]) {
+        return false;
+      }
+      break;
+    case O_SET_FIELD:
+      if (ip[0] != value || ip[2] == value) {
+        return false;
+      }
+      stored[ip[1]] = true;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  struct use_data use = {.value = value, .found = false};
+  each_tail_operand(block, find_use, &use);
+  return !use.found;
+}
+
+// forwards the fields of the struct allocated at instruction index to their
+// uses, and drops the allocation and its accesses
+static void replace_struct(code_block *block, size_t index,
+    size_t field_count) {
+  size_t params = block->parameter_count, lines = block->instruction_count;
+  size_t value = index + params;
+  size_t map[params + lines], current[field_count + 1];
+  bool dead[lines];
+
+  for (size_t i = 0; i < params + lines; i++) {
+    map[i] = i;
+  }
+  memset(dead, 0, sizeof(dead));
+  dead[index] = true;
+
+  for (size_t j = index + 1; j < lines; j++) {
+    code_instruction *ins = &block->instructions[j];
+    each_operand(ins, remap_operand, map);
+
+    size_t *ip = ins->parameters;
+    switch (ins->operation.type) {
+    case O_GET_FIELD:
+      if (ip[0] == value) {
+        map[j + params] = current[ip[1]];
+        dead[j] = true;
+      }
+      break;
+    case O_SET_FIELD:
+      if (ip[0] == value) {
+        current[ip[1]] = ip[2];
+        dead[j] = true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  each_tail_operand(block, remap_operand, map);
+  sweep_block(block, dead);
+}
+
+void replace_scalars(code_system *system) {
+  for (size_t b = 0; b < system->block_count; b++) {
+    code_block *block = get_code_block(system, b);
+
+    // each replacement shifts the instructions after it, so start over
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type != O_NEW) {
+        continue;
+      }
+
+      code_struct *s = get_code_struct(system, ins->type->struct_index);
+      if (is_scalar(block, j + block->parameter_count, s->field_count)) {
+        replace_struct(block, j, s->field_count);
+        j = (size_t) -1;
+      }
+    }
+  }
+}
+
+void allocate_on_stack(code_system *system) {
+  for (size_t b = 0; b < system->block_count; b++) {
+    code_block *block = get_code_block(system, b);
+    size_t params = block->parameter_count;
+
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      switch (ins->operation.type) {
+      case O_NEW:
+        break;
+      case O_NEW_ARRAY:
+        if (!is_small_array(block, ins)) {
+          continue;
+        }
+        break;
+      default:
+        continue;
+      }
+
+      if (!escapes(block, j + params)) {
+        ins->operation.allocation_type = O_STACK;
+      }
+    }
+  }
+}
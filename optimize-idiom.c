@@ -0,0 +1,464 @@
+#include "xalloc.h"
+#include "optimize.h"
+
+// Loop idiom recognition. Loops that only copy or fill the elements of a u8
+// array one at a time, like
+//
+//   for (u32 i = start; i < end; ++i) dest[i] = src[i + offset];
+//   for (u32 i = start; i < end; ++i) dest[i] = value;
+//
+// have their store replaced with a bear_array_copy or bear_array_fill native
+// covering the remaining iterations, which the backend lowers to llvm.memmove
+// and llvm.memset. The rewritten body passes end back as the index, so the
+// guard exits on the next test and the loop's blocks can be left in place.
+
+// generate_loop splits a body into a few blocks, but never many
+#define MAX_CHAIN 8
+
+typedef struct {
+  size_t index, bound;
+  size_t chain_length;
+  code_block *chain[MAX_CHAIN];
+
+  code_block *store_block;
+  size_t store;
+  // O_GET_INDEX the store reads from, or a parameter or literal to fill with
+  size_t source;
+  bool is_copy;
+} loop_idiom;
+
+static bool is_u32(type *t) {
+  return t && t->type == T_U32;
+}
+
+static bool is_byte_array(type *t) {
+  return t && t->type == T_ARRAY && t->arraytype->type == T_U8;
+}
+
+static bool is_parameter(code_block *block, size_t value) {
+  return value < block->parameter_count;
+}
+
+// whether the tail passes every parameter straight through, except skip
+static bool identity_tail(code_block *block, size_t skip) {
+  code_terminal *tail = &block->tail;
+  if (tail->parameter_count != block->parameter_count) {
+    return false;
+  }
+
+  for (size_t p = 0; p < tail->parameter_count; p++) {
+    if (p != skip && tail->parameters[p] != p) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool is_literal_one(code_block *block, size_t value) {
+  code_instruction *ins = get_instruction(block, value);
+  if (ins && ins->operation.type == O_CAST &&
+      ins->operation.cast_type == O_ZERO_EXTEND) {
+    ins = get_instruction(block, ins->parameters[0]);
+  }
+
+  if (!ins || ins->operation.type != O_LITERAL) {
+    return false;
+  }
+
+  switch (ins->type->type) {
+  case T_U8: return ins->value_u8 == 1;
+  case T_U16: return ins->value_u16 == 1;
+  case T_U32: return ins->value_u32 == 1;
+  default: return false;
+  }
+}
+
+// index + 1, in either order
+static bool is_increment(code_block *block, size_t value, size_t index) {
+  code_instruction *ins = get_instruction(block, value);
+  if (!ins || ins->operation.type != O_NUMERIC ||
+      ins->operation.numeric_type != O_ADD) {
+    return false;
+  }
+
+  size_t *ip = ins->parameters;
+  return (ip[0] == index && is_literal_one(block, ip[1])) ||
+    (ip[1] == index && is_literal_one(block, ip[0]));
+}
+
+// values that are the same on every iteration and cheap to recompute
+static bool is_invariant(code_block *block, size_t value, size_t index) {
+  code_instruction *ins = get_instruction(block, value);
+  if (!ins) {
+    return value != index;
+  }
+
+  switch (ins->operation.type) {
+  case O_LITERAL:
+    return is_integer(ins->type);
+  case O_CAST:
+    return ins->operation.cast_type == O_ZERO_EXTEND &&
+      is_invariant(block, ins->parameters[0], index);
+  case O_GET_LENGTH:
+    return is_parameter(block, ins->parameters[0]);
+  default:
+    return false;
+  }
+}
+
+// recomputes an invariant value of the header in a block of the body, which
+// sees the same parameters
+static size_t copy_invariant(code_block *header, size_t value,
+    code_block *block) {
+  code_instruction *ins = get_instruction(header, value);
+  if (!ins) {
+    return value;
+  }
+
+  code_instruction *copy;
+  if (ins->operation.type == O_LITERAL) {
+    copy = add_instruction(block);
+    *copy = *ins;
+  } else {
+    size_t operand = copy_invariant(header, ins->parameters[0], block);
+    copy = new_instruction(block, 1);
+    copy->operation = ins->operation;
+    copy->parameters[0] = operand;
+  }
+
+  copy->type = copy_type(ins->type);
+  return last_instruction(block);
+}
+
+// a literal offset that reads ahead of the index. the copy becomes a memmove,
+// which only matches the loop when the source never trails the destination in
+// the same array, and an offset at or past 2^31 can wrap the index around
+// behind it
+static bool is_forward_offset(code_block *block, size_t value) {
+  code_instruction *ins = get_instruction(block, value);
+  if (ins && ins->operation.type == O_CAST &&
+      ins->operation.cast_type == O_ZERO_EXTEND) {
+    ins = get_instruction(block, ins->parameters[0]);
+  }
+
+  if (!ins || ins->operation.type != O_LITERAL) {
+    return false;
+  }
+
+  switch (ins->type->type) {
+  case T_U8:
+  case T_U16: return true;
+  case T_U32: return ins->value_u32 < 0x80000000u;
+  default: return false;
+  }
+}
+
+// the source index of a copy: the loop index, or the loop index plus a
+// forward offset
+static bool is_source_index(code_block *block, size_t value, size_t index) {
+  if (value == index) {
+    return true;
+  }
+
+  code_instruction *ins = get_instruction(block, value);
+  if (!ins || ins->operation.type != O_NUMERIC ||
+      ins->operation.numeric_type != O_ADD || !is_u32(ins->type)) {
+    return false;
+  }
+
+  size_t *ip = ins->parameters;
+  return (ip[0] == index && is_forward_offset(block, ip[1])) ||
+    (ip[1] == index && is_forward_offset(block, ip[0]));
+}
+
+// instructions a loop body may contain besides the store, none of which have
+// effects once their values are unused
+static bool is_body_instruction(code_instruction *ins) {
+  switch (ins->operation.type) {
+  case O_BLOCKREF:
+  case O_BOUNDS_CHECK:
+  case O_GET_INDEX:
+  case O_GET_LENGTH:
+  case O_LITERAL:
+    return true;
+  case O_CAST:
+    switch (ins->operation.cast_type) {
+    case O_SIGN_EXTEND:
+    case O_TRUNCATE:
+    case O_ZERO_EXTEND:
+      return true;
+    default:
+      return false;
+    }
+  case O_NUMERIC:
+    // division can trap
+    return ins->operation.numeric_type != O_DIV &&
+      ins->operation.numeric_type != O_MOD;
+  default:
+    return false;
+  }
+}
+
+static bool match_header(code_block *header, loop_idiom *loop) {
+  if (header->is_final || header->tail.type != BRANCH ||
+      !identity_tail(header, header->parameter_count)) {
+    return false;
+  }
+
+  code_instruction *condition = get_instruction(header, header->tail.condition);
+  if (!condition || condition->operation.type != O_COMPARE ||
+      condition->operation.compare_type != O_LT) {
+    return false;
+  }
+
+  loop->index = condition->parameters[0];
+  loop->bound = condition->parameters[1];
+  if (!is_parameter(header, loop->index) ||
+      !is_u32(header->parameters[loop->index].field_type)) {
+    return false;
+  }
+
+  return is_invariant(header, loop->bound, loop->index);
+}
+
+// follows the blocks from the guard back to the header, each of which must
+// only be reachable from the one before it
+static bool match_chain(code_system *system, size_t h, const bool *closed,
+    const size_t *predecessors, loop_idiom *loop) {
+  code_block *header = get_code_block(system, h);
+  size_t next = static_target(header, header->tail.first_block);
+
+  loop->chain_length = 0;
+  for (;;) {
+    if (next >= system->block_count || next == h || !closed[next] ||
+        predecessors[next] != 1 || loop->chain_length == MAX_CHAIN) {
+      return false;
+    }
+
+    code_block *block = get_code_block(system, next);
+    if (block->is_final || block->tail.type != GOTO ||
+        block->parameter_count != header->parameter_count) {
+      return false;
+    }
+
+    loop->chain[loop->chain_length++] = block;
+    next = static_target(block, block->tail.first_block);
+    if (next == h) {
+      break;
+    }
+
+    if (!identity_tail(block, block->parameter_count)) {
+      return false;
+    }
+  }
+
+  code_block *last = loop->chain[loop->chain_length - 1];
+  return identity_tail(last, loop->index) &&
+    is_increment(last, last->tail.parameters[loop->index], loop->index);
+}
+
+static bool match_body(loop_idiom *loop) {
+  loop->store_block = NULL;
+
+  for (size_t b = 0; b < loop->chain_length; b++) {
+    code_block *block = loop->chain[b];
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type != O_SET_INDEX) {
+        if (!is_body_instruction(ins)) {
+          return false;
+        }
+        continue;
+      }
+
+      if (loop->store_block) {
+        return false;
+      }
+      loop->store_block = block;
+      loop->store = j;
+    }
+  }
+
+  if (!loop->store_block) {
+    return false;
+  }
+
+  code_block *block = loop->store_block;
+  size_t *ip = block->instructions[loop->store].parameters;
+  size_t dest = ip[0];
+  if (!is_parameter(block, dest) || ip[1] != loop->index ||
+      !is_byte_array(block->parameters[dest].field_type)) {
+    return false;
+  }
+
+  loop->source = ip[2];
+  code_instruction *load = get_instruction(block, loop->source);
+  size_t source_array = block->parameter_count, source_index = 0;
+  if (!load) {
+    loop->is_copy = false;
+  } else if (load->operation.type == O_LITERAL) {
+    loop->is_copy = false;
+  } else if (load->operation.type == O_GET_INDEX) {
+    loop->is_copy = true;
+    source_array = load->parameters[0];
+    source_index = load->parameters[1];
+    if (!is_parameter(block, source_array) ||
+        !is_byte_array(block->parameters[source_array].field_type) ||
+        !is_source_index(block, source_index, loop->index)) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  // the native checks the whole range up front, so the only checks and loads
+  // it may replace are the ones for the store and its source
+  for (size_t b = 0; b < loop->chain_length; b++) {
+    code_block *body = loop->chain[b];
+    for (size_t j = 0; j < body->instruction_count; j++) {
+      code_instruction *ins = &body->instructions[j];
+      size_t k = j + body->parameter_count;
+      switch (ins->operation.type) {
+      case O_BOUNDS_CHECK:
+        if (ins->parameters[0] == dest && ins->parameters[1] == loop->index) {
+          break;
+        }
+        if (body == block && ins->parameters[0] == source_array &&
+            ins->parameters[1] == source_index) {
+          break;
+        }
+        return false;
+      case O_GET_INDEX:
+        if (body != block || k != loop->source) {
+          return false;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+// the store and the checks are gone, so anything else the body computed and
+// no longer uses can be dropped
+static void sweep_body(code_block *block) {
+  size_t params = block->parameter_count, lines = block->instruction_count;
+  size_t uses[params + lines];
+  bool dead[lines + 1];
+
+  for (size_t i = 0; i < params + lines; i++) {
+    uses[i] = 0;
+  }
+
+  for (size_t j = 0; j < lines; j++) {
+    each_operand(&block->instructions[j], count_use, uses);
+  }
+  each_tail_operand(block, count_use, uses);
+
+  for (size_t j = lines; j-- > 0;) {
+    code_instruction *ins = &block->instructions[j];
+    dead[j] = ins->operation.type == O_BOUNDS_CHECK ||
+      ins->operation.type == O_SET_INDEX ||
+      (ins->operation.type != O_NATIVE && uses[j + params] == 0);
+
+    if (dead[j]) {
+      each_operand(ins, drop_use, uses);
+    }
+  }
+
+  sweep_block(block, dead);
+}
+
+static void rewrite_loop(code_block *header, loop_idiom *loop) {
+  code_block *block = loop->store_block;
+  size_t *ip = block->instructions[loop->store].parameters;
+  size_t dest = ip[0], index = loop->index;
+
+  size_t bound = copy_invariant(header, loop->bound, block);
+
+  code_instruction *count = new_instruction(block, 2);
+  count->operation.type = O_NUMERIC;
+  count->operation.numeric_type = O_SUB;
+  count->type = new_type(T_U32);
+  count->parameters[0] = bound;
+  count->parameters[1] = index;
+  size_t count_value = last_instruction(block);
+
+  code_instruction *native;
+  if (loop->is_copy) {
+    size_t *load = block->instructions[loop->source -
+      block->parameter_count].parameters;
+    native = new_instruction(block, 6);
+    native->native_call = "bear_array_copy";
+    native->parameters[0] = 5;
+    native->parameters[1] = dest;
+    native->parameters[2] = index;
+    native->parameters[3] = load[0];
+    native->parameters[4] = load[1];
+    native->parameters[5] = count_value;
+  } else {
+    native = new_instruction(block, 5);
+    native->native_call = "bear_array_fill";
+    native->parameters[0] = 4;
+    native->parameters[1] = dest;
+    native->parameters[2] = index;
+    native->parameters[3] = count_value;
+    native->parameters[4] = loop->source;
+  }
+  native->operation.type = O_NATIVE;
+  native->type = new_type(T_VOID);
+
+  code_block *last = loop->chain[loop->chain_length - 1];
+  last->tail.parameters[index] = last == block ? bound
+    : copy_invariant(header, loop->bound, last);
+
+  for (size_t b = 0; b < loop->chain_length; b++) {
+    sweep_body(loop->chain[b]);
+  }
+}
+
+void recognize_loop_idioms(code_system *system) {
+  size_t count = system->block_count;
+  bool closed[count];
+  size_t predecessors[count];
+
+  find_closed(system, closed);
+
+  for (size_t i = 0; i < count; i++) {
+    predecessors[i] = 0;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    code_block *block = get_code_block(system, i);
+    if (block->is_final) {
+      continue;
+    }
+
+    size_t target = static_target(block, block->tail.first_block);
+    if (target < count) {
+      predecessors[target]++;
+    }
+
+    if (block->tail.type == BRANCH) {
+      target = static_target(block, block->tail.second_block);
+      if (target < count) {
+        predecessors[target]++;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    code_block *header = get_code_block(system, i);
+    loop_idiom loop;
+
+    if (match_header(header, &loop) &&
+        match_chain(system, i, closed, predecessors, &loop) &&
+        match_body(&loop)) {
+      rewrite_loop(header, &loop);
+    }
+  }
+}
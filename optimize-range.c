@@ -0,0 +1,448 @@
+#include <string.h>
+
+#include "xalloc.h"
+#include "optimize.h"
+
+// Integer range analysis over block parameters, used to drop the O_BOUNDS_CHECK
+// instructions that generate emits for every array access. Facts only relate
+// SSA values to the length of an array value, which is all the checks need:
+//
+//   R_LENGTH  value == array.length (new arrays, O_GET_LENGTH)
+//   R_BELOW   value <  array.length (loop guards, earlier checks)
+//
+// Facts flow through tail parameters into blocks whose predecessors are all
+// known, so the condition block that generate_while builds sees the facts from
+// both the loop entry and the loop body, and the body sees the guard.
+
+typedef enum {
+  R_LENGTH,
+  R_BELOW
+} range_kind;
+
+typedef struct {
+  range_kind kind;
+  size_t value, array;
+} range_fact;
+
+typedef struct {
+  bool seeded;
+  size_t fact_count, fact_cap;
+  range_fact *facts;
+} range_set;
+
+typedef struct {
+  code_system *system;
+  // whether every predecessor of the block is a static tail
+  bool *closed;
+  range_set *entry;
+} range_state;
+
+static bool has_fact(range_set *set, range_kind kind, size_t value,
+    size_t array) {
+  for (size_t i = 0; i < set->fact_count; i++) {
+    range_fact *fact = &set->facts[i];
+    if (fact->kind == kind && fact->value == value && fact->array == array) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void add_fact(range_set *set, range_kind kind, size_t value,
+    size_t array) {
+  if (has_fact(set, kind, value, array)) {
+    return;
+  }
+
+  resize(set->fact_count, &set->fact_cap, (void**) &set->facts,
+    sizeof(range_fact));
+
+  range_fact *fact = &set->facts[set->fact_count++];
+  fact->kind = kind;
+  fact->value = value;
+  fact->array = array;
+}
+
+static void clear_facts(range_set *set) {
+  free(set->facts);
+  set->fact_count = 0;
+  set->fact_cap = 0;
+  set->facts = NULL;
+}
+
+static bool is_unsigned(type *t) {
+  switch (t->type) {
+  case T_U8:
+  case T_U16:
+  case T_U32:
+  case T_U64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool literal_value(code_block *block, size_t value, uint64_t *out) {
+  if (value < block->parameter_count) {
+    return false;
+  }
+
+  code_instruction *ins = &block->instructions[value - block->parameter_count];
+  if (ins->operation.type != O_LITERAL) {
+    return false;
+  }
+
+  switch (ins->type->type) {
+  case T_U8: *out = ins->value_u8; return true;
+  case T_U16: *out = ins->value_u16; return true;
+  case T_U32: *out = ins->value_u32; return true;
+  case T_U64: *out = ins->value_u64; return true;
+  default: return false;
+  }
+}
+
+static bool index_in_range(code_block *block, range_set *set, size_t array,
+    size_t index) {
+  if (has_fact(set, R_BELOW, index, array)) {
+    return true;
+  }
+
+  uint64_t literal_index;
+  if (!literal_value(block, index, &literal_index)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < set->fact_count; i++) {
+    range_fact *fact = &set->facts[i];
+    uint64_t length;
+    if (fact->kind == R_LENGTH && fact->array == array &&
+        literal_value(block, fact->value, &length) && literal_index < length) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// copies facts about one value onto another value known to be equal
+static void alias_facts(range_set *set, size_t from, size_t to, bool as_array) {
+  size_t count = set->fact_count;
+  for (size_t i = 0; i < count; i++) {
+    range_fact fact = set->facts[i];
+    if (as_array && fact.array == from) {
+      add_fact(set, fact.kind, fact.value, to);
+    } else if (!as_array && fact.value == from) {
+      add_fact(set, fact.kind, to, fact.array);
+    }
+  }
+}
+
+// walks the block from its entry facts, leaving the exit facts in set and
+// marking the bounds checks that are already known to pass
+static void walk_block(code_block *block, range_set *set, bool *dead) {
+  size_t offset = block->parameter_count;
+
+  for (size_t j = 0; j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    size_t k = j + offset, *ip = ins->parameters;
+
+    switch (ins->operation.type) {
+    case O_BOUNDS_CHECK:
+      if (index_in_range(block, set, ip[0], ip[1])) {
+        if (dead) {
+          dead[j] = true;
+        }
+      } else {
+        // execution only continues past a passing check
+        add_fact(set, R_BELOW, ip[1], ip[0]);
+      }
+      break;
+    case O_CAST:
+      switch (ins->operation.cast_type) {
+      case O_REINTERPRET:
+        // u8[] to string shares the storage, and so the length
+        if (ins->type->type == T_STRING) {
+          alias_facts(set, ip[0], k, true);
+        }
+        break;
+      case O_ZERO_EXTEND:
+        alias_facts(set, ip[0], k, false);
+        break;
+      default:
+        break;
+      }
+      break;
+    case O_GET_LENGTH:
+      add_fact(set, R_LENGTH, k, ip[0]);
+      break;
+    case O_NEW_ARRAY:
+      add_fact(set, R_LENGTH, ip[0], k);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// the facts implied by taking one side of a branch on an unsigned comparison
+static void branch_facts(code_block *block, range_set *set, bool taken) {
+  size_t condition = block->tail.condition;
+  if (condition < block->parameter_count) {
+    return;
+  }
+
+  code_instruction *ins = &block->instructions[condition -
+    block->parameter_count];
+  if (ins->operation.type != O_COMPARE ||
+      !is_unsigned(instruction_type(block, ins->parameters[0]))) {
+    return;
+  }
+
+  size_t below, bound;
+  switch (ins->operation.compare_type) {
+  case O_LT:
+    if (!taken) return;
+    below = ins->parameters[0];
+    bound = ins->parameters[1];
+    break;
+  case O_GT:
+    if (!taken) return;
+    below = ins->parameters[1];
+    bound = ins->parameters[0];
+    break;
+  case O_GTE:
+    if (taken) return;
+    below = ins->parameters[0];
+    bound = ins->parameters[1];
+    break;
+  case O_LTE:
+    if (taken) return;
+    below = ins->parameters[1];
+    bound = ins->parameters[0];
+    break;
+  default:
+    return;
+  }
+
+  size_t count = set->fact_count;
+  for (size_t i = 0; i < count; i++) {
+    range_fact fact = set->facts[i];
+    if (fact.kind == R_LENGTH && fact.value == bound) {
+      add_fact(set, R_BELOW, below, fact.array);
+    }
+  }
+}
+
+// the block a tail operand always refers to, or block_count when it is dynamic
+size_t static_target(code_block *block, size_t value) {
+  if (value < block->parameter_count) {
+    return block->system->block_count;
+  }
+
+  code_instruction *ins = &block->instructions[value - block->parameter_count];
+  return ins->operation.type == O_BLOCKREF ? ins->block_index
+    : block->system->block_count;
+}
+
+// merge the exit facts of a predecessor into the entry facts of a target,
+// returning whether the entry facts changed
+static bool merge_edge(range_state *state, code_block *from, range_set *exit,
+    size_t target) {
+  if (target >= state->system->block_count || !state->closed[target]) {
+    return false;
+  }
+
+  code_terminal *tail = &from->tail;
+  range_set edge = {.seeded = true, .fact_count = 0, .fact_cap = 0,
+    .facts = NULL};
+
+  for (size_t i = 0; i < exit->fact_count; i++) {
+    range_fact *fact = &exit->facts[i];
+    for (size_t p = 0; p < tail->parameter_count; p++) {
+      if (tail->parameters[p] != fact->value) continue;
+      for (size_t q = 0; q < tail->parameter_count; q++) {
+        if (tail->parameters[q] == fact->array) {
+          add_fact(&edge, fact->kind, p, q);
+        }
+      }
+    }
+  }
+
+  range_set *entry = &state->entry[target];
+  if (!entry->seeded) {
+    *entry = edge;
+    return true;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < entry->fact_count; i++) {
+    range_fact *fact = &entry->facts[i];
+    if (has_fact(&edge, fact->kind, fact->value, fact->array)) {
+      entry->facts[kept++] = *fact;
+    }
+  }
+
+  clear_facts(&edge);
+
+  bool changed = kept != entry->fact_count;
+  entry->fact_count = kept;
+  return changed;
+}
+
+static void copy_facts(range_set *dest, range_set *src) {
+  dest->seeded = true;
+  dest->fact_count = 0;
+  dest->fact_cap = 0;
+  dest->facts = NULL;
+  for (size_t i = 0; i < src->fact_count; i++) {
+    resize(dest->fact_count, &dest->fact_cap, (void**) &dest->facts,
+      sizeof(range_fact));
+    dest->facts[dest->fact_count++] = src->facts[i];
+  }
+}
+
+static bool propagate(range_state *state, size_t index) {
+  code_block *block = get_code_block(state->system, index);
+  range_set *entry = &state->entry[index];
+
+  if (!entry->seeded || block->is_final) {
+    return false;
+  }
+
+  range_set exit;
+  copy_facts(&exit, entry);
+  walk_block(block, &exit, NULL);
+
+  bool changed = false;
+  if (block->tail.type == GOTO) {
+    size_t target = static_target(block, block->tail.first_block);
+    changed = merge_edge(state, block, &exit, target);
+  } else {
+    range_set taken;
+    copy_facts(&taken, &exit);
+    branch_facts(block, &taken, true);
+    changed = merge_edge(state, block, &taken,
+      static_target(block, block->tail.first_block));
+    clear_facts(&taken);
+
+    branch_facts(block, &exit, false);
+    changed = merge_edge(state, block, &exit,
+      static_target(block, block->tail.second_block)) || changed;
+  }
+
+  clear_facts(&exit);
+  return changed;
+}
+
+struct static_ref_data {
+  size_t params;
+  bool *escapes;
+};
+
+static void mark_escape(size_t *operand, void *data) {
+  struct static_ref_data *ref_data = data;
+  if (*operand >= ref_data->params) {
+    ref_data->escapes[*operand - ref_data->params] = true;
+  }
+}
+
+// a block is closed when the only references to it are the static targets of
+// GOTO and BRANCH tails, so all of its predecessors are visible here - dynamic
+// tails can only reach blocks whose references escape
+void find_closed(code_system *system, bool *closed) {
+  size_t count = system->block_count;
+  bool referenced[count];
+
+  for (size_t i = 0; i < count; i++) {
+    closed[i] = i != 0;
+    referenced[i] = false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    code_block *block = get_code_block(system, i);
+    size_t params = block->parameter_count;
+    bool escapes[block->instruction_count + 1];
+    memset(escapes, 0, sizeof(escapes));
+
+    struct static_ref_data data = {.params = params, .escapes = escapes};
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      each_operand(&block->instructions[j], mark_escape, &data);
+    }
+
+    if (!block->is_final) {
+      for (size_t j = 0; j < block->tail.parameter_count; j++) {
+        mark_escape(&block->tail.parameters[j], &data);
+      }
+      if (block->tail.type == BRANCH) {
+        mark_escape(&block->tail.condition, &data);
+      }
+    }
+
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type != O_BLOCKREF) {
+        continue;
+      }
+
+      size_t k = j + params;
+      bool is_tail = !block->is_final && (block->tail.first_block == k ||
+        (block->tail.type == BRANCH && block->tail.second_block == k));
+
+      referenced[ins->block_index] = true;
+      if (escapes[j] || !is_tail) {
+        closed[ins->block_index] = false;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    closed[i] = closed[i] && referenced[i];
+  }
+}
+
+void eliminate_bounds_checks(code_system *system) {
+  size_t count = system->block_count;
+
+  // resizing an array invalidates every length fact, including through aliases
+  for (size_t i = 0; i < count; i++) {
+    code_block *block = get_code_block(system, i);
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      if (block->instructions[j].operation.type == O_SET_LENGTH) {
+        return;
+      }
+    }
+  }
+
+  bool closed[count];
+  range_set entry[count];
+  range_state state = {.system = system, .closed = closed, .entry = entry};
+
+  find_closed(system, closed);
+
+  for (size_t i = 0; i < count; i++) {
+    entry[i].seeded = !closed[i];
+    entry[i].fact_count = 0;
+    entry[i].fact_cap = 0;
+    entry[i].facts = NULL;
+  }
+
+  // entry facts only ever shrink, so this reaches a fixed point
+  bool changed;
+  do {
+    changed = false;
+    for (size_t i = 0; i < count; i++) {
+      changed = propagate(&state, i) || changed;
+    }
+  } while (changed);
+
+  for (size_t i = 0; i < count; i++) {
+    code_block *block = get_code_block(system, i);
+    bool dead[block->instruction_count + 1];
+    memset(dead, 0, sizeof(dead));
+
+    walk_block(block, &entry[i], dead);
+    sweep_block(block, dead);
+
+    clear_facts(&entry[i]);
+  }
+}
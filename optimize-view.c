@@ -0,0 +1,459 @@
+#include <string.h>
+
+#include "xalloc.h"
+#include "optimize.h"
+
+// Array to string views. generate_array_string copies the array for every
+// <string> cast, because a later write to the array must not show through the
+// string. The copy is dropped when the array is owned - no other reference to
+// it exists - and the cast is its last use, which covers the usual pattern
+// of filling in a new array and returning it as a string.
+//
+// Ownership starts at O_NEW_ARRAY and follows the single place each value
+// moves to: a tail parameter of a closed block, or a field of a call's context
+// struct, which is read back exactly once. Values may also be lent to a block
+// that only reads and writes elements, like the parameter of copyArray, since
+// such a block finishes before the value is used again.
+
+typedef enum {
+  // element access and bulk natives, which never keep the array
+  U_ACCESS,
+  U_MOVE,
+  U_BORROW,
+  U_ESCAPE
+} use_kind;
+
+typedef struct {
+  code_system *system;
+  // per block, whether each parameter and instruction holds an owned array
+  bool **owned;
+  // per block, whether each value escapes, is moved more than once, or is
+  // lent and moved within one tail
+  bool **leaks;
+  // per context struct, whether each field only receives owned arrays
+  bool **field_owned;
+} view_state;
+
+static type *value_type(code_block *block, size_t value) {
+  return value < block->parameter_count
+    ? block->parameters[value].field_type
+    : block->instructions[value - block->parameter_count].type;
+}
+
+static bool is_array(type *t) {
+  return t && t->type == T_ARRAY;
+}
+
+// the context struct field an O_SET_FIELD or O_GET_FIELD touches, if any
+static code_struct *context_field(code_system *system, code_block *block,
+    code_instruction *ins) {
+  type *object = value_type(block, ins->parameters[0]);
+  if (!object || object->type != T_OBJECT) {
+    return NULL;
+  }
+
+  code_struct *str = get_code_struct(system, object->struct_index);
+  return str->is_context ? str : NULL;
+}
+
+static bool uses_value(code_instruction *ins, size_t value) {
+  struct use_data use = {.value = value, .found = false};
+  each_operand(ins, find_use, &use);
+  return use.found;
+}
+
+// how an instruction uses value, which it must have as an operand
+static use_kind instruction_use(view_state *state, code_block *block,
+    code_instruction *ins, size_t value) {
+  size_t *ip = ins->parameters;
+  switch (ins->operation.type) {
+  case O_BOUNDS_CHECK:
+  case O_GET_INDEX:
+  case O_GET_LENGTH:
+    return ip[0] == value ? U_ACCESS : U_ESCAPE;
+  case O_SET_INDEX:
+    return ip[0] == value && ip[2] != value ? U_ACCESS : U_ESCAPE;
+  case O_NATIVE:
+    return is_bulk_native(ins->native_call) ? U_ACCESS : U_ESCAPE;
+  case O_SET_FIELD:
+    return ip[2] == value && ip[0] != value &&
+      context_field(state->system, block, ins) ? U_MOVE : U_ESCAPE;
+  case O_CAST:
+    // a view aliases the array, so it counts as another reference
+  default:
+    return U_ESCAPE;
+  }
+}
+
+// whether a block only accesses the elements of a parameter and lets it die
+static bool only_accesses(view_state *state, code_block *block, size_t param) {
+  for (size_t j = 0; j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    if (uses_value(ins, param) &&
+        instruction_use(state, block, ins, param) != U_ACCESS) {
+      return false;
+    }
+  }
+
+  if (block->is_final) {
+    return true;
+  }
+
+  for (size_t p = 0; p < block->tail.parameter_count; p++) {
+    if (block->tail.parameters[p] == param) {
+      return false;
+    }
+  }
+
+  return block->tail.type != BRANCH || block->tail.condition != param;
+}
+
+// how a tail parameter uses its value
+static use_kind tail_use(view_state *state, code_block *block, size_t p) {
+  size_t target = static_target(block, block->tail.first_block);
+  if (target >= state->system->block_count) {
+    return U_ESCAPE;
+  }
+
+  code_block *dest = get_code_block(state->system, target);
+  if (block->tail.type == BRANCH) {
+    size_t second = static_target(block, block->tail.second_block);
+    if (second >= state->system->block_count) {
+      return U_ESCAPE;
+    }
+    // lending only works when both sides only access the elements
+    if (only_accesses(state, dest, p) &&
+        only_accesses(state, get_code_block(state->system, second), p)) {
+      return U_BORROW;
+    }
+    return U_MOVE;
+  }
+
+  return only_accesses(state, dest, p) ? U_BORROW : U_MOVE;
+}
+
+// counts the moves and loans of an array value in its block, returning false
+// when it escapes
+static bool count_uses(view_state *state, code_block *block, size_t value,
+    size_t *moves, size_t *tail_moves, size_t *borrows) {
+  *moves = *tail_moves = *borrows = 0;
+
+  for (size_t j = 0; j < block->instruction_count; j++) {
+    code_instruction *ins = &block->instructions[j];
+    if (!uses_value(ins, value)) {
+      continue;
+    }
+
+    switch (instruction_use(state, block, ins, value)) {
+    case U_ACCESS:
+      break;
+    case U_MOVE:
+      (*moves)++;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  if (block->is_final) {
+    return true;
+  }
+
+  if (block->tail.type == BRANCH && block->tail.condition == value) {
+    return false;
+  }
+
+  for (size_t p = 0; p < block->tail.parameter_count; p++) {
+    if (block->tail.parameters[p] != value) {
+      continue;
+    }
+
+    switch (tail_use(state, block, p)) {
+    case U_BORROW:
+      (*borrows)++;
+      break;
+    case U_MOVE:
+      (*moves)++;
+      (*tail_moves)++;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool value_leaks(view_state *state, code_block *block, size_t value) {
+  size_t moves, tail_moves, borrows;
+  if (!count_uses(state, block, value, &moves, &tail_moves, &borrows)) {
+    return true;
+  }
+
+  // a loan to the same block a move goes to would outlive the move
+  return moves > 1 || (tail_moves && borrows);
+}
+
+// whether value hands over its ownership when passed to tail parameter p
+static bool owned_edge(view_state *state, size_t b, size_t value, size_t p) {
+  code_block *block = get_code_block(state->system, b);
+  if (!state->owned[b][value] || state->leaks[b][value]) {
+    return false;
+  }
+
+  if (tail_use(state, block, p) == U_MOVE) {
+    return true;
+  }
+
+  // a loan that is the last reference hands the array over too
+  size_t moves, tail_moves, borrows;
+  count_uses(state, block, value, &moves, &tail_moves, &borrows);
+  return moves == 0 && borrows == 1;
+}
+
+static bool propagate(view_state *state) {
+  code_system *system = state->system;
+  size_t count = system->block_count;
+  bool changed = false;
+
+  // a parameter is owned when every edge into it hands over ownership
+  for (size_t b = 0; b < count; b++) {
+    code_block *block = get_code_block(system, b);
+    if (block->is_final) {
+      continue;
+    }
+
+    size_t targets[2] = {
+      static_target(block, block->tail.first_block),
+      block->tail.type == BRANCH
+        ? static_target(block, block->tail.second_block) : count
+    };
+
+    for (size_t p = 0; p < block->tail.parameter_count; p++) {
+      size_t value = block->tail.parameters[p];
+      if (owned_edge(state, b, value, p)) {
+        continue;
+      }
+
+      for (size_t t = 0; t < 2; t++) {
+        if (targets[t] < count && state->owned[targets[t]][p]) {
+          state->owned[targets[t]][p] = false;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // a context field is owned when every array stored into it is
+  for (size_t b = 0; b < count; b++) {
+    code_block *block = get_code_block(system, b);
+    size_t params = block->parameter_count;
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type != O_SET_FIELD) {
+        continue;
+      }
+
+      size_t value = ins->parameters[2];
+      if (!is_array(value_type(block, value)) ||
+          !context_field(system, block, ins)) {
+        continue;
+      }
+
+      size_t s = value_type(block, ins->parameters[0])->struct_index;
+      bool *field = &state->field_owned[s][ins->parameters[1]];
+      if (*field && !(state->owned[b][value] && !state->leaks[b][value])) {
+        *field = false;
+        changed = true;
+      }
+    }
+
+    for (size_t j = 0; j < block->instruction_count; j++) {
+      code_instruction *ins = &block->instructions[j];
+      if (ins->operation.type == O_GET_FIELD && state->owned[b][j + params]) {
+        size_t s = value_type(block, ins->parameters[0])->struct_index;
+        if (!state->field_owned[s][ins->parameters[1]]) {
+          state->owned[b][j + params] = false;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  return changed;
+}
+
+// matches the copy generate_array_string emits for the cast at index j,
+// returning the copied array
+static bool match_copy(code_block *block, size_t j, size_t *array,
+    size_t *native) {
+  size_t params = block->parameter_count;
+  code_instruction *cast = &block->instructions[j];
+  if (cast->operation.type != O_CAST ||
+      cast->operation.cast_type != O_REINTERPRET ||
+      cast->type->type != T_STRING) {
+    return false;
+  }
+
+  size_t copy = cast->parameters[0];
+  code_instruction *new = get_instruction(block, copy);
+  if (!new || new->operation.type != O_NEW_ARRAY) {
+    return false;
+  }
+
+  for (size_t n = copy - params + 1; n < j; n++) {
+    code_instruction *ins = &block->instructions[n];
+    if (ins->operation.type != O_NATIVE ||
+        strcmp(ins->native_call, "bear_array_copy") != 0 ||
+        ins->parameters[1] != copy) {
+      continue;
+    }
+
+    code_instruction *length = get_instruction(block, ins->parameters[5]);
+    if (length && length->operation.type == O_GET_LENGTH &&
+        length->parameters[0] == ins->parameters[3] &&
+        new->parameters[0] == ins->parameters[5]) {
+      *array = ins->parameters[3];
+      *native = n;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// whether anything after instruction j, tail included, uses value
+static bool used_after(code_block *block, size_t j, size_t value) {
+  for (size_t n = j + 1; n < block->instruction_count; n++) {
+    if (uses_value(&block->instructions[n], value)) {
+      return true;
+    }
+  }
+
+  struct use_data use = {.value = value, .found = false};
+  each_tail_operand(block, find_use, &use);
+  return use.found;
+}
+
+static void forward_views(view_state *state, size_t b) {
+  code_block *block = get_code_block(state->system, b);
+  size_t params = block->parameter_count, lines = block->instruction_count;
+  bool dead[lines + 1];
+  bool any = false;
+
+  memset(dead, 0, sizeof(dead));
+
+  for (size_t j = 0; j < lines; j++) {
+    size_t array, native;
+    if (!match_copy(block, j, &array, &native) || !state->owned[b][array]) {
+      continue;
+    }
+
+    size_t moves, tail_moves, borrows;
+    if (!count_uses(state, block, array, &moves, &tail_moves, &borrows) ||
+        moves || borrows || used_after(block, native, array)) {
+      continue;
+    }
+
+    block->instructions[j].parameters[0] = array;
+    dead[native] = true;
+    any = true;
+  }
+
+  if (!any) {
+    return;
+  }
+
+  // drop the copies, and the lengths and literals only they used
+  size_t uses[params + lines];
+  memset(uses, 0, sizeof(uses));
+  for (size_t j = 0; j < lines; j++) {
+    if (!dead[j]) {
+      each_operand(&block->instructions[j], count_use, uses);
+    }
+  }
+  each_tail_operand(block, count_use, uses);
+
+  for (size_t j = lines; j-- > 0;) {
+    code_instruction *ins = &block->instructions[j];
+    if (dead[j]) {
+      continue;
+    }
+
+    switch (ins->operation.type) {
+    case O_GET_LENGTH:
+    case O_LITERAL:
+    case O_NEW_ARRAY:
+      if (uses[j + params] == 0) {
+        dead[j] = true;
+        each_operand(ins, drop_use, uses);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  sweep_block(block, dead);
+}
+
+void forward_array_views(code_system *system) {
+  size_t count = system->block_count;
+  bool closed[count];
+  bool *owned[count], *leaks[count];
+  bool *field_owned[system->struct_count];
+
+  find_closed(system, closed);
+
+  view_state state = {.system = system, .owned = owned, .leaks = leaks,
+    .field_owned = field_owned};
+
+  for (size_t s = 0; s < system->struct_count; s++) {
+    code_struct *str = get_code_struct(system, s);
+    field_owned[s] = NULL;
+    if (str->is_context) {
+      field_owned[s] = xmalloc(sizeof(bool) * str->field_count);
+      memset(field_owned[s], 1, sizeof(bool) * str->field_count);
+    }
+  }
+
+  // start out assuming every array that could be owned is
+  for (size_t b = 0; b < count; b++) {
+    code_block *block = get_code_block(system, b);
+    size_t params = block->parameter_count;
+    size_t total = params + block->instruction_count;
+    owned[b] = xmalloc(sizeof(bool) * (total + 1));
+    leaks[b] = xmalloc(sizeof(bool) * (total + 1));
+
+    for (size_t v = 0; v < total; v++) {
+      owned[b][v] = false;
+      leaks[b][v] = true;
+      if (!is_array(value_type(block, v))) {
+        continue;
+      }
+
+      code_instruction *ins = get_instruction(block, v);
+      if (!ins) {
+        owned[b][v] = closed[b];
+      } else if (ins->operation.type == O_NEW_ARRAY) {
+        owned[b][v] = true;
+      } else if (ins->operation.type == O_GET_FIELD) {
+        owned[b][v] = context_field(system, block, ins) != NULL;
+      }
+
+      leaks[b][v] = value_leaks(&state, block, v);
+    }
+  }
+
+  while (propagate(&state));
+
+  for (size_t b = 0; b < count; b++) {
+    forward_views(&state, b);
+    free(owned[b]);
+    free(leaks[b]);
+  }
+
+  for (size_t s = 0; s < system->struct_count; s++) {
+    free(field_owned[s]);
+  }
+}
@@ -23,6 +23,78 @@
   *start = now;
 }*/
 
+// the instruction behind value, or NULL for a parameter
+code_instruction *get_instruction(code_block *block, size_t value) {
+  if (value < block->parameter_count) {
+    return NULL;
+  }
+
+  return &block->instructions[value - block->parameter_count];
+}
+
+void find_use(size_t *operand, void *data) {
+  struct use_data *use = data;
+  use->found = use->found || *operand == use->value;
+}
+
+// per value use counts, for each_operand and each_tail_operand
+void count_use(size_t *operand, void *uses) {
+  ((size_t*) uses)[*operand]++;
+}
+
+void drop_use(size_t *operand, void *uses) {
+  ((size_t*) uses)[*operand]--;
+}
+
+// renumbers an operand through a map from old values to new
+void remap_operand(size_t *operand, void *map) {
+  *operand = ((size_t*) map)[*operand];
+}
+
+void sweep_block(code_block *block, const bool *dead) {
+  size_t params = block->parameter_count, lines = block->instruction_count;
+  size_t map[params + lines], offset = 0;
+
+  for (size_t i = 0; i < params; i++) {
+    map[i] = i;
+  }
+
+  for (size_t i = 0; i < lines; i++) {
+    code_instruction *ins = &block->instructions[i];
+
+    if (dead[i]) {
+      if (ins->operation.type != O_BLOCKREF &&
+          ins->operation.type != O_LITERAL) {
+        free(ins->parameters);
+      }
+      free_type(ins->type);
+      continue;
+    }
+
+    each_operand(ins, remap_operand, map);
+
+    if (i != offset) {
+      memcpy(&block->instructions[offset], ins, sizeof(*ins));
+    }
+
+    map[i + params] = offset + params;
+    offset++;
+  }
+
+  if (offset == lines) {
+    return;
+  }
+
+  block->instruction_count = offset;
+  block->instruction_cap = offset;
+  if (offset) {
+    block->instructions = xrealloc(block->instructions,
+      sizeof(code_instruction) * offset);
+  }
+
+  each_tail_operand(block, remap_operand, map);
+}
+
 static void optimize_copies(code_block *block) {
   size_t params = block->parameter_count, lines = block->instruction_count;
   size_t total = params + lines, offset = 0;
@@ -38,72 +110,15 @@ static void optimize_copies(code_block *block) {
 
     size_t *ip = ins->parameters;
 
-    switch (ins->operation.type) {
-    case O_BITWISE_NOT:
-    case O_CAST:
-    case O_GET_FIELD:
-    case O_INSTANCEOF:
-    case O_NEGATE:
-    case O_NEW_ARRAY:
-    case O_NOT:
-      ip[0] = map[ip[0]];
-      break;
-    case O_COMPARE:
-    case O_IDENTITY:
-    case O_LOGIC:
-    case O_NUMERIC:
-    case O_SHIFT:
-    case O_STR_CONCAT:
-      ip[0] = map[ip[0]];
-      ip[1] = map[ip[1]];
-      break;
-    case O_GET_INDEX:
-      ip[0] = map[ip[0]];
-      ip[1] = map[ip[1]];
-      break;
-    case O_GET_LENGTH:
-      ip[0] = map[ip[0]];
-      break;
-    case O_GET_SYMBOL: {
+    if (ins->operation.type == O_GET_SYMBOL) {
       map[j] = map[ip[0]];
       free(ip);
       free_type(ins->type);
-    } continue;
-    case O_NATIVE: {
-      size_t count = ip[0];
-      for (size_t i = 1; i <= count; i++) {
-        ip[i] = map[ip[i]];
-      }
-    } break;
-    case O_SET_FIELD:
-      ip[0] = map[ip[0]];
-      ip[2] = map[ip[2]];
-      break;
-    case O_SET_INDEX:
-      ip[0] = map[ip[0]];
-      ip[1] = map[ip[1]];
-      ip[2] = map[ip[2]];
-      break;
-    case O_SET_LENGTH:
-      ip[0] = map[ip[0]];
-      ip[1] = map[ip[1]];
-      break;
-
-    case O_BLOCKREF:
-    case O_LITERAL:
-    case O_NEW:
-      break;
-    case O_CALL:
-    case O_FUNCTION:
-    case O_NUMERIC_ASSIGN:
-    case O_POSTFIX:
-    case O_SET_SYMBOL:
-    case O_SHIFT_ASSIGN:
-    case O_STR_CONCAT_ASSIGN:
-    case O_TERNARY:
-      abort();
+      continue;
     }
 
+    each_operand(ins, remap_operand, map);
+
     if (i != offset) {
       memcpy(&block->instructions[offset], ins, sizeof(*ins));
     }
@@ -113,22 +128,13 @@ static void optimize_copies(code_block *block) {
   }
 
   block->instruction_count = offset;
-  block->instructions = xrealloc(block->instructions, sizeof(code_instruction) *
-    offset);
-
-  if (!block->is_final) {
-    block->tail.first_block = map[block->tail.first_block];
-
-    if (block->tail.type == BRANCH) {
-      block->tail.second_block = map[block->tail.second_block];
-
-      block->tail.condition = map[block->tail.condition];
-    }
-
-    for (size_t i = 0; i < block->tail.parameter_count; i++) {
-      block->tail.parameters[i] = map[block->tail.parameters[i]];
-    }
+  block->instruction_cap = offset;
+  if (offset) {
+    block->instructions = xrealloc(block->instructions,
+      sizeof(code_instruction) * offset);
   }
+
+  each_tail_operand(block, remap_operand, map);
 }
 
 /*static void optimize_copies(code_block *block) {
@@ -199,4 +205,10 @@ void optimize(code_system *system) {
     code_block *block = get_code_block(system, i);
     optimize_copies(block);
   }
+
+  recognize_loop_idioms(system);
+  forward_array_views(system);
+  eliminate_bounds_checks(system);
+  replace_scalars(system);
+  allocate_on_stack(system);
 }
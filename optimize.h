@@ -3,6 +3,25 @@
 
 #include "generate.h"
 
+// a value and whether find_use has seen it among the operands it was given
+struct use_data {
+  size_t value;
+  bool found;
+};
+
+code_instruction *get_instruction(code_block*, size_t value);
+void find_use(size_t *operand, void *use_data);
+void count_use(size_t *operand, void *uses);
+void drop_use(size_t *operand, void *uses);
+void remap_operand(size_t *operand, void *map);
+void sweep_block(code_block*, const bool *dead);
+size_t static_target(code_block*, size_t value);
+void find_closed(code_system*, bool *closed);
+void eliminate_bounds_checks(code_system*);
+void recognize_loop_idioms(code_system*);
+void forward_array_views(code_system*);
+void replace_scalars(code_system*);
+void allocate_on_stack(code_system*);
 void optimize(code_system*);
 
 #endif
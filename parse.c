@@ -779,6 +779,7 @@ void free_expression(expression *value, bool free_strings) {
     free_expression(value->value, free_strings);
     break;
   case O_BLOCKREF:
+  case O_BOUNDS_CHECK:
   case O_GET_LENGTH:
   case O_SET_LENGTH:
     // not supposed to exist at this level
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Checks the runtime bitcode against the harness, then runs every program in
+# test/programs through each backend and compares what it prints against the
+# .out file next to it. Expects cub and the harness to be built already, as
+# by `make`.
+
+DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+CUB="$DIR/out/Debug/cub"
+
+BACKENDS=(object run interpret c x86)
+if [ "$#" -gt 0 ]; then
+  BACKENDS=("$@")
+fi
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# runs $1 on backend $2, leaving whatever it printed in $WORK/actual
+run() {
+  case "$2" in
+  object) "$DIR/cub" "$1" "$WORK/program" && "$WORK/program" ;;
+  run) "$CUB" run "$1" ;;
+  interpret) "$CUB" run --interpret "$1" ;;
+  # with the errors newer compilers make of these by default
+  c) CC="${CC:-cc} -Werror=incompatible-pointer-types -Werror=int-conversion
+      -Werror=implicit-function-declaration -Werror=builtin-declaration-mismatch" \
+      "$DIR/cub" --emit-c "$1" "$WORK/program" && "$WORK/program" ;;
+  x86) "$DIR/cub" --emit-x86 "$1" "$WORK/program" && "$WORK/program" ;;
+  *) echo "unknown backend $2" >&2; return 1 ;;
+  esac > "$WORK/actual" 2> "$WORK/errors"
+}
+
+PASSED=0
+FAILED=0
+
+# the runtime bitcode's bodies have to keep matching the harness functions
+# they stand in for, so they're built under their own names to compare
+if sed -e 's/available_externally //' -e 's/@bear_/@runtime_/g' \
+    "$DIR/llvm-backend/llvm-runtime.ll" |
+    llc -filetype=obj -relocation-model=pic -o "$WORK/runtime.o" &&
+    ${CC:-cc} -std=c11 "$DIR/test/runtime-test.c" "$WORK/runtime.o" \
+    "$DIR/out/lib/llvm-harness.o" -lm -o "$WORK/runtime-test" &&
+    "$WORK/runtime-test"; then
+  PASSED=$((PASSED + 1))
+else
+  FAILED=$((FAILED + 1))
+  echo "FAIL llvm-runtime.ll differs from the harness"
+fi
+
+for PROGRAM in "$DIR"/test/programs/*.cub; do
+  NAME="$(basename "$PROGRAM" .cub)"
+  for BACKEND in "${BACKENDS[@]}"; do
+    rm -f "$WORK/program"
+    if run "$PROGRAM" "$BACKEND" &&
+        cmp -s "$WORK/actual" "${PROGRAM%.cub}.out"; then
+      PASSED=$((PASSED + 1))
+    else
+      FAILED=$((FAILED + 1))
+      echo "FAIL $NAME ($BACKEND)"
+      diff "${PROGRAM%.cub}.out" "$WORK/actual" | head -n 10
+      grep -v '^parsing ' "$WORK/errors" | head -n 10
+    fi
+  done
+done
+
+echo "$PASSED passed, $FAILED failed"
+[ "$FAILED" -eq 0 ]
@@ -0,0 +1,76 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../llvm-backend/runtime.h"
+
+// Checks that the bodies in llvm-backend/llvm-runtime.ll do what the harness
+// functions they stand in for do. run-tests.sh assembles them under runtime_
+// names, without available_externally, and links them with the harness and
+// this.
+
+bool bear_streq(uint8_t *a, uint8_t *b);
+int32_t bear_strcmp(uint8_t *a, uint8_t *b);
+bool runtime_streq(uint8_t *a, uint8_t *b);
+int32_t runtime_strcmp(uint8_t *a, uint8_t *b);
+
+// the harness wants these from the program
+uint8_t *bear_literals[1];
+uint64_t bear_literal_count = 0;
+
+static const char *contents[] = {
+  "", "a", "b", "ab", "abc", "abd", "abcd", "\xff", "a\xff",
+  "the quick brown fox jumps over the lazy dog",
+  "the quick brown fox jumps over the lazy cat",
+  "the quick brown fox jumps over the lazy dog!"
+};
+
+#define CONTENTS (sizeof(contents) / sizeof(contents[0]))
+// flat, static, interned and slice
+#define FORMS 4
+#define STRINGS (CONTENTS * FORMS)
+
+static uint8_t storage[STRINGS][64];
+static struct slice slices[CONTENTS];
+static uint8_t *strings[STRINGS];
+
+static void make_strings(void) {
+  for (size_t i = 0; i < CONTENTS; i++) {
+    uint64_t length = strlen(contents[i]);
+    uint64_t flags[] = {0, STRING_STATIC, STRING_INTERNED};
+    for (size_t f = 0; f < 3; f++) {
+      uint8_t *value = storage[i * FORMS + f];
+      *(uint64_t*) value = length | flags[f];
+      memcpy(value + 8, contents[i], length);
+      strings[i * FORMS + f] = value;
+    }
+    // a slice into the middle of a flat string
+    uint8_t *base = storage[i * FORMS + 3];
+    *(uint64_t*) base = length + 2;
+    memcpy(base + 9, contents[i], length);
+    slices[i] = (struct slice) {length | STRING_SLICE_BIT, base + 9, base};
+    strings[i * FORMS + 3] = (uint8_t*) &slices[i];
+  }
+}
+
+int main() {
+  make_strings();
+  int failures = 0;
+  for (size_t i = 0; i < STRINGS; i++) {
+    for (size_t j = 0; j < STRINGS; j++) {
+      uint8_t *a = strings[i], *b = strings[j];
+      if (bear_streq(a, b) != runtime_streq(a, b)) {
+        fprintf(stderr, "streq differs on \"%s\" (form %zu) and \"%s\" (form %zu)\n",
+          contents[i / FORMS], i % FORMS, contents[j / FORMS], j % FORMS);
+        failures++;
+      }
+      if (bear_strcmp(a, b) != runtime_strcmp(a, b)) {
+        fprintf(stderr, "strcmp differs on \"%s\" (form %zu) and \"%s\" (form %zu)\n",
+          contents[i / FORMS], i % FORMS, contents[j / FORMS], j % FORMS);
+        failures++;
+      }
+    }
+  }
+  return failures != 0;
+}
@@ -0,0 +1,257 @@
+#include <elf.h>
+#include <string.h>
+
+#include "../xalloc.h"
+#include "elf-object.h"
+
+// section header indices, in the order elf_write lays the sections out
+enum {
+	SH_NULL,
+	SH_TEXT,
+	SH_DATA,
+	SH_RELA_TEXT,
+	SH_RELA_DATA,
+	SH_SYMTAB,
+	SH_STRTAB,
+	SH_SHSTRTAB,
+	SH_NOTE_STACK,
+	SH_COUNT
+};
+
+static const char *section_names[SH_COUNT] = {
+	"", ".text", ".data", ".rela.text", ".rela.data", ".symtab", ".strtab",
+	".shstrtab", ".note.GNU-stack"
+};
+
+void elf_init(struct elf_object *object) {
+	for (size_t s = 0; s < ELF_SECTION_COUNT; s++) {
+		buffer_init(&object->sections[s]);
+	}
+	object->symbol_count = 0;
+	object->symbol_cap = 16;
+	object->symbols = xmalloc(sizeof(struct elf_symbol) * object->symbol_cap);
+	object->relocation_count = 0;
+	object->relocation_cap = 64;
+	object->relocations = xmalloc(sizeof(struct elf_relocation) *
+		object->relocation_cap);
+
+	// the section symbols come first, see elf_section_symbol
+	for (size_t s = 0; s < ELF_SECTION_COUNT; s++) {
+		object->symbols[object->symbol_count++] = (struct elf_symbol) {
+			.name = NULL,
+			.section = s,
+			.offset = 0,
+			.is_defined = true,
+			.is_function = false
+		};
+	}
+}
+
+void elf_free(struct elf_object *object) {
+	for (size_t s = 0; s < ELF_SECTION_COUNT; s++) {
+		buffer_free(&object->sections[s]);
+	}
+	for (size_t i = ELF_SECTION_COUNT; i < object->symbol_count; i++) {
+		free(object->symbols[i].name);
+	}
+	free(object->symbols);
+	free(object->relocations);
+}
+
+size_t elf_section_symbol(enum elf_section section) {
+	return section;
+}
+
+size_t elf_symbol(struct elf_object *object, const char *name) {
+	for (size_t i = ELF_SECTION_COUNT; i < object->symbol_count; i++) {
+		if (strcmp(object->symbols[i].name, name) == 0) {
+			return i;
+		}
+	}
+
+	resize(object->symbol_count, &object->symbol_cap,
+		(void**) &object->symbols, sizeof(struct elf_symbol));
+	object->symbols[object->symbol_count] = (struct elf_symbol) {
+		.name = xstrdup(name),
+		.section = ELF_TEXT,
+		.offset = 0,
+		.is_defined = false,
+		.is_function = false
+	};
+	return object->symbol_count++;
+}
+
+void elf_define(struct elf_object *object, const char *name,
+		enum elf_section section, uint64_t offset, bool is_function) {
+	struct elf_symbol *symbol = &object->symbols[elf_symbol(object, name)];
+	symbol->section = section;
+	symbol->offset = offset;
+	symbol->is_defined = true;
+	symbol->is_function = is_function;
+}
+
+void elf_relocate(struct elf_object *object, enum elf_section section,
+		uint64_t offset, uint32_t type, size_t symbol, int64_t addend) {
+	resize(object->relocation_count, &object->relocation_cap,
+		(void**) &object->relocations, sizeof(struct elf_relocation));
+	object->relocations[object->relocation_count++] = (struct elf_relocation) {
+		.section = section,
+		.offset = offset,
+		.type = type,
+		.symbol = symbol,
+		.addend = addend
+	};
+}
+
+uint64_t elf_align(struct elf_object *object, enum elf_section section,
+		uint64_t alignment) {
+	buffer *data = &object->sections[section];
+	while (data->used % alignment) {
+		buffer_append_char(data, 0);
+	}
+	return data->used;
+}
+
+// pads the file to alignment and returns the offset
+static uint64_t file_align(buffer *file, uint64_t alignment) {
+	while (file->used % alignment) {
+		buffer_append_char(file, 0);
+	}
+	return file->used;
+}
+
+static void write_relocations(struct elf_object *object,
+		enum elf_section section, buffer *file) {
+	for (size_t i = 0; i < object->relocation_count; i++) {
+		struct elf_relocation *relocation = &object->relocations[i];
+		if (relocation->section != section) {
+			continue;
+		}
+		// symbol table index 0 is the null symbol
+		Elf64_Rela rela = {
+			.r_offset = relocation->offset,
+			.r_info = ELF64_R_INFO(relocation->symbol + 1, relocation->type),
+			.r_addend = relocation->addend
+		};
+		buffer_append_mem(file, (char*) &rela, sizeof(rela));
+	}
+}
+
+void elf_write(struct elf_object *object, FILE *out) {
+	buffer file;
+	buffer_init(&file);
+	Elf64_Shdr headers[SH_COUNT];
+	memset(headers, 0, sizeof(headers));
+
+	// filled in once the section headers are placed
+	Elf64_Ehdr header;
+	buffer_append_mem(&file, (char*) &header, sizeof(header));
+
+	static const Elf64_Section indices[ELF_SECTION_COUNT] = {SH_TEXT, SH_DATA};
+	for (size_t s = 0; s < ELF_SECTION_COUNT; s++) {
+		buffer *data = &object->sections[s];
+		Elf64_Shdr *sh = &headers[indices[s]];
+		sh->sh_type = SHT_PROGBITS;
+		sh->sh_flags = SHF_ALLOC | (s == ELF_TEXT ? SHF_EXECINSTR : SHF_WRITE);
+		sh->sh_addralign = 16;
+		sh->sh_offset = file_align(&file, 16);
+		sh->sh_size = data->used;
+		buffer_append_mem(&file, data->data, data->used);
+	}
+
+	static const Elf64_Section relocated[ELF_SECTION_COUNT] = {
+		SH_RELA_TEXT, SH_RELA_DATA
+	};
+	for (size_t s = 0; s < ELF_SECTION_COUNT; s++) {
+		Elf64_Shdr *sh = &headers[relocated[s]];
+		sh->sh_type = SHT_RELA;
+		sh->sh_flags = SHF_INFO_LINK;
+		sh->sh_offset = file_align(&file, 8);
+		write_relocations(object, s, &file);
+		sh->sh_size = file.used - sh->sh_offset;
+		sh->sh_link = SH_SYMTAB;
+		sh->sh_info = indices[s];
+		sh->sh_addralign = 8;
+		sh->sh_entsize = sizeof(Elf64_Rela);
+	}
+
+	// the null symbol, then the section symbols, which are the only local ones
+	buffer strings;
+	buffer_init(&strings);
+	buffer_append_char(&strings, 0);
+	Elf64_Shdr *symtab = &headers[SH_SYMTAB];
+	symtab->sh_offset = file_align(&file, 8);
+	Elf64_Sym null_symbol;
+	memset(&null_symbol, 0, sizeof(null_symbol));
+	buffer_append_mem(&file, (char*) &null_symbol, sizeof(null_symbol));
+	for (size_t i = 0; i < object->symbol_count; i++) {
+		struct elf_symbol *symbol = &object->symbols[i];
+		Elf64_Sym sym;
+		memset(&sym, 0, sizeof(sym));
+		if (symbol->name == NULL) {
+			sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+			sym.st_shndx = indices[symbol->section];
+		} else {
+			sym.st_name = strings.used;
+			buffer_append_mem(&strings, symbol->name, strlen(symbol->name) + 1);
+			sym.st_info = ELF64_ST_INFO(STB_GLOBAL, !symbol->is_defined ? STT_NOTYPE
+				: symbol->is_function ? STT_FUNC : STT_OBJECT);
+			sym.st_shndx = symbol->is_defined ? indices[symbol->section] : SHN_UNDEF;
+			sym.st_value = symbol->is_defined ? symbol->offset : 0;
+		}
+		buffer_append_mem(&file, (char*) &sym, sizeof(sym));
+	}
+	symtab->sh_type = SHT_SYMTAB;
+	symtab->sh_size = file.used - symtab->sh_offset;
+	symtab->sh_link = SH_STRTAB;
+	symtab->sh_info = 1 + ELF_SECTION_COUNT;
+	symtab->sh_addralign = 8;
+	symtab->sh_entsize = sizeof(Elf64_Sym);
+
+	Elf64_Shdr *strtab = &headers[SH_STRTAB];
+	strtab->sh_type = SHT_STRTAB;
+	strtab->sh_offset = file.used;
+	strtab->sh_size = strings.used;
+	strtab->sh_addralign = 1;
+	buffer_append_mem(&file, strings.data, strings.used);
+	buffer_free(&strings);
+
+	Elf64_Shdr *shstrtab = &headers[SH_SHSTRTAB];
+	shstrtab->sh_type = SHT_STRTAB;
+	shstrtab->sh_offset = file.used;
+	shstrtab->sh_addralign = 1;
+	for (size_t s = 0; s < SH_COUNT; s++) {
+		headers[s].sh_name = file.used - shstrtab->sh_offset;
+		buffer_append_mem(&file, (char*) section_names[s],
+			strlen(section_names[s]) + 1);
+	}
+	shstrtab->sh_size = file.used - shstrtab->sh_offset;
+
+	// an empty note, so the linker doesn't make the stack executable
+	Elf64_Shdr *note = &headers[SH_NOTE_STACK];
+	note->sh_type = SHT_PROGBITS;
+	note->sh_offset = file.used;
+	note->sh_addralign = 1;
+
+	uint64_t section_headers = file_align(&file, 8);
+	buffer_append_mem(&file, (char*) headers, sizeof(headers));
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.e_ident, ELFMAG, SELFMAG);
+	header.e_ident[EI_CLASS] = ELFCLASS64;
+	header.e_ident[EI_DATA] = ELFDATA2LSB;
+	header.e_ident[EI_VERSION] = EV_CURRENT;
+	header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+	header.e_type = ET_REL;
+	header.e_machine = EM_X86_64;
+	header.e_version = EV_CURRENT;
+	header.e_shoff = section_headers;
+	header.e_ehsize = sizeof(Elf64_Ehdr);
+	header.e_shentsize = sizeof(Elf64_Shdr);
+	header.e_shnum = SH_COUNT;
+	header.e_shstrndx = SH_SHSTRTAB;
+	memcpy(file.data, &header, sizeof(header));
+
+	fwrite(file.data, 1, file.used, out);
+	buffer_free(&file);
+}
@@ -0,0 +1,65 @@
+#ifndef X86_BACKEND_ELF_OBJECT_H
+#define X86_BACKEND_ELF_OBJECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../buffer.h"
+
+// A relocatable ELF object for x86-64 with one section of code and one of
+// data, which is all the machine code backend produces. Symbols are either
+// defined in one of those sections or left for the linker to resolve against
+// the harness and libc.
+
+enum elf_section {
+	ELF_TEXT,
+	ELF_DATA,
+	ELF_SECTION_COUNT
+};
+
+struct elf_symbol {
+	char *name;
+	enum elf_section section;
+	uint64_t offset;
+	bool is_defined, is_function;
+};
+
+struct elf_relocation {
+	enum elf_section section;
+	uint64_t offset;
+	uint32_t type;
+	size_t symbol;
+	int64_t addend;
+};
+
+struct elf_object {
+	buffer sections[ELF_SECTION_COUNT];
+	struct elf_symbol *symbols;
+	size_t symbol_count, symbol_cap;
+	struct elf_relocation *relocations;
+	size_t relocation_count, relocation_cap;
+};
+
+void elf_init(struct elf_object*);
+void elf_free(struct elf_object*);
+
+// the symbol of a section, for relocations against offsets within it
+size_t elf_section_symbol(enum elf_section);
+
+// finds the named symbol, adding it as undefined when it isn't there yet
+size_t elf_symbol(struct elf_object*, const char *name);
+
+// defines the named symbol at offset in section
+void elf_define(struct elf_object*, const char *name, enum elf_section,
+	uint64_t offset, bool is_function);
+
+void elf_relocate(struct elf_object*, enum elf_section, uint64_t offset,
+	uint32_t type, size_t symbol, int64_t addend);
+
+// pads the section to a multiple of alignment and returns its size
+uint64_t elf_align(struct elf_object*, enum elf_section, uint64_t alignment);
+
+void elf_write(struct elf_object*, FILE *out);
+
+#endif
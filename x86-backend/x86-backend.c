@@ -0,0 +1,1374 @@
+#include <elf.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../backend.h"
+#include "../optimize.h"
+#include "../xalloc.h"
+#include "../llvm-backend/layout.h"
+#include "../llvm-backend/runtime.h"
+#include "elf-object.h"
+
+// Writes x86-64 machine code for the program straight into an ELF object, for
+// debug builds that shouldn't wait on LLVM. It's a baseline compiler: one pass
+// over each block, no instruction selection beyond the obvious sequence per
+// instruction, and a linear scan over the block's values to put the ones it
+// can in callee-saved registers, which survive the calls into the harness.
+//
+// The program is main, as with the other backends. Blocks exchange their
+// parameters through fixed pass slots in the frame, whether the jump is direct
+// or through a label address, so every block has one calling convention. Each
+// block then moves its parameters from the pass slots to wherever the scan
+// put them. Objects use the layouts and metastructs of the LLVM backend.
+//
+// Floating point isn't supported, nor are compressed references, and stack
+// allocations go on the heap.
+
+enum reg {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// the registers the scan hands out, all of them callee-saved
+static const enum reg allocatable[] = {RBX, R12, R13, R14, R15};
+#define ALLOCATABLE (sizeof(allocatable) / sizeof(allocatable[0]))
+
+static const enum reg argument_regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+
+// condition codes, as they appear in jcc and setcc
+enum cc {
+	CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+	CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+// the bytes of main's frame below rbp taken by the saved registers
+#define SAVED_BYTES 40
+
+// an opcode and its length
+#define OP(bytes) bytes, sizeof(bytes) - 1
+
+struct location {
+	enum {
+		L_NONE,
+		// literals are rematerialized at every use
+		L_CONST,
+		L_REG,
+		L_SLOT
+	} kind;
+	enum reg reg;
+	size_t slot;
+};
+
+// a rel32 to patch with the distance to a block once it's placed
+struct fixup {
+	size_t position;
+	size_t block;
+};
+
+struct emitter {
+	code_system *system;
+	struct layout *layouts;
+	struct elf_object object;
+	buffer *text;
+
+	// where each block starts, and done after them
+	size_t *labels;
+	size_t done;
+	struct fixup *fixups;
+	size_t fixup_count, fixup_cap;
+
+	// where the metastructs and strings went in the data section
+	uint64_t *metas, *strings;
+
+	// the frame: pass slots, then the current block's spill slots, both off rbp,
+	// and the scratch arrays the harness reads roots and parts from at rsp
+	size_t pass_slots, max_spills, max_scratch;
+	size_t frame_size;
+
+	// the block being compiled
+	code_block *block;
+	struct location *locations;
+	size_t *start, *end;
+};
+
+static void unsupported(const char *what) {
+	fprintf(stderr, "cub: the x86-64 backend does not support %s\n", what);
+	exit(1);
+}
+
+static void emit(struct emitter *e, uint8_t byte) {
+	buffer_append_char(e->text, (char) byte);
+}
+
+static void emit_bytes(struct emitter *e, const char *bytes, size_t count) {
+	buffer_append_mem(e->text, (char*) bytes, count);
+}
+
+static void emit32(struct emitter *e, uint32_t value) {
+	buffer_append_mem(e->text, (char*) &value, 4);
+}
+
+static void emit64(struct emitter *e, uint64_t value) {
+	buffer_append_mem(e->text, (char*) &value, 8);
+}
+
+static void patch32(struct emitter *e, size_t position, uint32_t value) {
+	memcpy(e->text->data + position, &value, 4);
+}
+
+// the distance from the end of the rel32 at position to target
+static void patch_relative(struct emitter *e, size_t position, size_t target) {
+	patch32(e, position, (uint32_t) (target - (position + 4)));
+}
+
+// the REX prefix, which byte operations always need so that sil and dil
+// aren't taken for dh and bh
+static void rex(struct emitter *e, bool wide, bool byte, int reg, int base) {
+	uint8_t prefix = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+	if (prefix != 0x40 || byte) {
+		emit(e, prefix);
+	}
+}
+
+// op reg, rm, both registers
+static void op_rr(struct emitter *e, bool wide, bool byte, const char *op,
+		size_t length, int reg, int rm) {
+	rex(e, wide, byte, reg, rm);
+	emit_bytes(e, op, length);
+	emit(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [base + disp]
+static void op_rm(struct emitter *e, bool wide, bool byte, const char *op,
+		size_t length, int reg, int base, int32_t disp) {
+	rex(e, wide, byte, reg, base);
+	emit_bytes(e, op, length);
+	emit(e, 0x80 | (reg & 7) << 3 | (base & 7));
+	if ((base & 7) == RSP) {
+		emit(e, 0x24);
+	}
+	emit32(e, (uint32_t) disp);
+}
+
+// op reg, [rip + disp], returning where the disp goes
+static size_t op_rip(struct emitter *e, bool wide, const char *op,
+		size_t length, int reg) {
+	rex(e, wide, false, reg, 0);
+	emit_bytes(e, op, length);
+	emit(e, 0x05 | (reg & 7) << 3);
+	size_t position = e->text->used;
+	emit32(e, 0);
+	return position;
+}
+
+static void mov_rr(struct emitter *e, enum reg dest, enum reg src) {
+	if (dest != src) {
+		op_rr(e, true, false, OP("\x89"), src, dest);
+	}
+}
+
+static void mov_load(struct emitter *e, enum reg dest, enum reg base,
+		int32_t disp) {
+	op_rm(e, true, false, OP("\x8b"), dest, base, disp);
+}
+
+static void mov_store(struct emitter *e, enum reg base, int32_t disp,
+		enum reg src) {
+	op_rm(e, true, false, OP("\x89"), src, base, disp);
+}
+
+static void mov_imm(struct emitter *e, enum reg dest, uint64_t value) {
+	if (value <= UINT32_MAX) {
+		// writing the low half clears the rest
+		rex(e, false, false, 0, dest);
+		emit(e, 0xB8 | (dest & 7));
+		emit32(e, (uint32_t) value);
+	} else {
+		rex(e, true, false, 0, dest);
+		emit(e, 0xB8 | (dest & 7));
+		emit64(e, value);
+	}
+}
+
+static void lea(struct emitter *e, enum reg dest, enum reg base, int32_t disp) {
+	op_rm(e, true, false, OP("\x8d"), dest, base, disp);
+}
+
+// add, or, and, sub, xor and cmp, as dest op= src
+static void alu(struct emitter *e, const char *op, enum reg dest,
+		enum reg src) {
+	op_rr(e, true, false, op, 1, src, dest);
+}
+
+#define ALU_ADD "\x01"
+#define ALU_OR "\x09"
+#define ALU_AND "\x21"
+#define ALU_SUB "\x29"
+#define ALU_XOR "\x31"
+#define ALU_CMP "\x39"
+
+// the group of add, or, and, sub, xor and cmp against an immediate
+static void alu_imm(struct emitter *e, int extension, enum reg dest,
+		int32_t value) {
+	op_rr(e, true, false, OP("\x81"), extension, dest);
+	emit32(e, (uint32_t) value);
+}
+
+#define IMM_ADD 0
+#define IMM_OR 1
+#define IMM_SUB 5
+#define IMM_XOR 6
+#define IMM_CMP 7
+
+static void test(struct emitter *e, enum reg left, enum reg right) {
+	op_rr(e, true, false, OP("\x85"), right, left);
+}
+
+// not, neg and div
+static void unary(struct emitter *e, int extension, enum reg r) {
+	op_rr(e, true, false, OP("\xf7"), extension, r);
+}
+
+#define UNARY_NOT 2
+#define UNARY_NEG 3
+#define UNARY_DIV 6
+
+// shl, shr and sar by cl
+static void shift_cl(struct emitter *e, int extension, enum reg r) {
+	op_rr(e, true, false, OP("\xd3"), extension, r);
+}
+
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+#define SHIFT_SAR 7
+
+static void shift_imm(struct emitter *e, int extension, enum reg r,
+		uint8_t count) {
+	op_rr(e, true, false, OP("\xc1"), extension, r);
+	emit(e, count);
+}
+
+// r = the condition, as 0 or 1
+static void setcc(struct emitter *e, enum cc cc, enum reg r) {
+	char op[] = {0x0f, 0x90 | cc};
+	op_rr(e, false, true, op, 2, 0, r);
+	op_rr(e, false, true, OP("\x0f\xb6"), r, r);
+}
+
+// extends the low size bytes of r to all of it
+static void extend(struct emitter *e, enum reg r, uint64_t size,
+		bool is_signed) {
+	switch (size) {
+	case 1:
+		op_rr(e, is_signed, true, is_signed ? "\x0f\xbe" : "\x0f\xb6", 2, r, r);
+		break;
+	case 2:
+		op_rr(e, is_signed, false, is_signed ? "\x0f\xbf" : "\x0f\xb7", 2, r, r);
+		break;
+	case 4:
+		if (is_signed) {
+			op_rr(e, true, false, OP("\x63"), r, r);
+		} else {
+			op_rr(e, false, false, OP("\x89"), r, r);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// jumps, returning where their rel32 goes
+static size_t jmp(struct emitter *e) {
+	emit(e, 0xE9);
+	size_t position = e->text->used;
+	emit32(e, 0);
+	return position;
+}
+
+static size_t jcc(struct emitter *e, enum cc cc) {
+	emit(e, 0x0F);
+	emit(e, 0x80 | cc);
+	size_t position = e->text->used;
+	emit32(e, 0);
+	return position;
+}
+
+// points the jump at position here
+static void land(struct emitter *e, size_t position) {
+	patch_relative(e, position, e->text->used);
+}
+
+static void jump_to_block(struct emitter *e, size_t position, size_t block) {
+	resize(e->fixup_count, &e->fixup_cap, (void**) &e->fixups,
+		sizeof(struct fixup));
+	e->fixups[e->fixup_count++] = (struct fixup) {
+		.position = position,
+		.block = block
+	};
+}
+
+static void call(struct emitter *e, const char *name) {
+	emit(e, 0xE8);
+	elf_relocate(&e->object, ELF_TEXT, e->text->used, R_X86_64_PLT32,
+		elf_symbol(&e->object, name), -4);
+	emit32(e, 0);
+}
+
+// dest = the address of the harness global, through the GOT
+static void global_address(struct emitter *e, enum reg dest, const char *name) {
+	size_t position = op_rip(e, true, OP("\x8b"), dest);
+	elf_relocate(&e->object, ELF_TEXT, position, R_X86_64_GOTPCREL,
+		elf_symbol(&e->object, name), -4);
+}
+
+// dest = the address of offset in the data section
+static void data_address(struct emitter *e, enum reg dest, uint64_t offset) {
+	size_t position = op_rip(e, true, OP("\x8d"), dest);
+	elf_relocate(&e->object, ELF_TEXT, position, R_X86_64_PC32,
+		elf_section_symbol(ELF_DATA), (int64_t) offset - 4);
+}
+
+// loads the size bytes at [base + disp] into dest, extended
+static void load_sized(struct emitter *e, enum reg dest, enum reg base,
+		int32_t disp, uint64_t size, bool is_signed) {
+	switch (size) {
+	case 1:
+		op_rm(e, is_signed, false, is_signed ? "\x0f\xbe" : "\x0f\xb6", 2, dest,
+			base, disp);
+		break;
+	case 2:
+		op_rm(e, is_signed, false, is_signed ? "\x0f\xbf" : "\x0f\xb7", 2, dest,
+			base, disp);
+		break;
+	case 4:
+		op_rm(e, is_signed, false, is_signed ? "\x63" : "\x8b", 1, dest, base,
+			disp);
+		break;
+	default:
+		mov_load(e, dest, base, disp);
+	}
+}
+
+static void store_sized(struct emitter *e, enum reg base, int32_t disp,
+		enum reg src, uint64_t size) {
+	switch (size) {
+	case 1:
+		op_rm(e, false, true, OP("\x88"), src, base, disp);
+		break;
+	case 2:
+		emit(e, 0x66);
+		op_rm(e, false, false, OP("\x89"), src, base, disp);
+		break;
+	case 4:
+		op_rm(e, false, false, OP("\x89"), src, base, disp);
+		break;
+	default:
+		mov_store(e, base, disp, src);
+	}
+}
+
+static bool is_signed_type(type *t) {
+	switch (t->type) {
+	case T_S8:
+	case T_S16:
+	case T_S32:
+	case T_S64:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_gc_able(type *t) {
+	return t != NULL && (t->type == T_OBJECT || t->type == T_ARRAY ||
+		t->type == T_STRING);
+}
+
+// every value is kept extended to 64 bits by the signedness of its type
+static void canonicalize(struct emitter *e, enum reg r, type *t) {
+	if (is_float(t)) {
+		unsupported("floating point");
+	}
+	extend(e, r, type_size(t), is_signed_type(t));
+}
+
+static int32_t slot_disp(size_t slot) {
+	return -(int32_t) (SAVED_BYTES + 8 * (slot + 1));
+}
+
+static type *type_of(struct emitter *e, size_t value) {
+	return instruction_type(e->block, value);
+}
+
+static void load_literal(struct emitter *e, enum reg dest,
+		code_instruction *ins) {
+	switch (ins->type->type) {
+	case T_BOOL:
+		mov_imm(e, dest, ins->value_bool);
+		break;
+	case T_OBJECT:
+		mov_imm(e, dest, 0);
+		break;
+	case T_STRING:
+		data_address(e, dest, e->strings[ins->string_index]);
+		break;
+	case T_U8:
+		mov_imm(e, dest, ins->value_u8);
+		break;
+	case T_U16:
+		mov_imm(e, dest, ins->value_u16);
+		break;
+	case T_U32:
+		mov_imm(e, dest, ins->value_u32);
+		break;
+	case T_U64:
+		mov_imm(e, dest, ins->value_u64);
+		break;
+	default:
+		unsupported("this literal type");
+	}
+}
+
+static void load(struct emitter *e, enum reg dest, size_t value) {
+	struct location *location = &e->locations[value];
+	switch (location->kind) {
+	case L_CONST:
+		load_literal(e, dest,
+			&e->block->instructions[value - e->block->parameter_count]);
+		break;
+	case L_REG:
+		mov_rr(e, dest, location->reg);
+		break;
+	case L_SLOT:
+		mov_load(e, dest, RBP, slot_disp(e->pass_slots + location->slot));
+		break;
+	case L_NONE:
+		abort();
+	}
+}
+
+static void store(struct emitter *e, size_t value, enum reg src) {
+	struct location *location = &e->locations[value];
+	switch (location->kind) {
+	case L_REG:
+		mov_rr(e, location->reg, src);
+		break;
+	case L_SLOT:
+		mov_store(e, RBP, slot_disp(e->pass_slots + location->slot), src);
+		break;
+	case L_CONST:
+	case L_NONE:
+		abort();
+	}
+}
+
+// whether the tail jumps to blocks it names directly
+static bool is_static_tail(code_block *block) {
+	size_t count = block->system->block_count;
+	if (block->is_final) {
+		return false;
+	}
+	switch (block->tail.type) {
+	case GOTO:
+		return static_target(block, block->tail.first_block) < count;
+	case BRANCH:
+		return static_target(block, block->tail.first_block) < count &&
+			static_target(block, block->tail.second_block) < count;
+	}
+	return false;
+}
+
+// whether the block reference at value needs the address of its block, rather
+// than only naming the target of a direct jump
+static bool is_dynamic_ref(code_block *block, size_t value) {
+	struct use_data use = {.value = value, .found = false};
+	for (size_t j = value - block->parameter_count + 1;
+			j < block->instruction_count; j++) {
+		each_operand(&block->instructions[j], find_use, &use);
+	}
+	if (block->is_final) {
+		return use.found;
+	}
+	for (size_t p = 0; p < block->tail.parameter_count; p++) {
+		use.found = use.found || block->tail.parameters[p] == value;
+	}
+	return use.found || (!is_static_tail(block) &&
+		(block->tail.first_block == value ||
+		 (block->tail.type == BRANCH && block->tail.second_block == value)));
+}
+
+// the location an instruction's value needs, before the scan picks one
+static int value_kind(code_block *block, size_t j) {
+	code_instruction *ins = &block->instructions[j];
+	switch (ins->operation.type) {
+	case O_BOUNDS_CHECK:
+	case O_SET_FIELD:
+	case O_SET_INDEX:
+		return L_NONE;
+	case O_LITERAL:
+		return L_CONST;
+	case O_BLOCKREF:
+		return is_dynamic_ref(block, j + block->parameter_count) ? L_REG : L_NONE;
+	default:
+		return ins->type != NULL && !is_void(ins->type) ? L_REG : L_NONE;
+	}
+}
+
+struct interval_data {
+	size_t *end;
+	size_t position;
+};
+
+static void extend_interval(size_t *operand, void *data) {
+	struct interval_data *interval = data;
+	if (interval->end[*operand] < interval->position) {
+		interval->end[*operand] = interval->position;
+	}
+}
+
+// Linear scan over the values of the block. Parameters are defined at
+// position 0, instruction j at j + 1 and the tail uses its operands at the
+// end. An interval that has ended by the time another starts gives its
+// register up, since every instruction reads its operands before it writes.
+// When the registers run out, whichever interval ends last goes to a slot.
+static void allocate_registers(struct emitter *e) {
+	code_block *block = e->block;
+	size_t params = block->parameter_count;
+	size_t count = params + block->instruction_count;
+
+	for (size_t v = 0; v < count; v++) {
+		e->start[v] = v < params ? 0 : v - params + 1;
+		e->end[v] = e->start[v];
+		e->locations[v].kind = v < params ? L_REG : value_kind(block, v - params);
+	}
+
+	struct interval_data interval = {.end = e->end};
+	for (size_t j = 0; j < block->instruction_count; j++) {
+		interval.position = j + 1;
+		each_operand(&block->instructions[j], extend_interval, &interval);
+	}
+	if (!block->is_final) {
+		interval.position = block->instruction_count + 1;
+		each_tail_operand(block, extend_interval, &interval);
+	}
+
+	size_t active[ALLOCATABLE], active_count = 0, spills = 0;
+	bool taken[ALLOCATABLE];
+	memset(taken, 0, sizeof(taken));
+	for (size_t v = 0; v < count; v++) {
+		struct location *location = &e->locations[v];
+		if (location->kind != L_REG) {
+			continue;
+		}
+
+		for (size_t a = 0; a < active_count;) {
+			size_t other = active[a];
+			if (e->end[other] <= e->start[v]) {
+				for (size_t r = 0; r < ALLOCATABLE; r++) {
+					if (allocatable[r] == e->locations[other].reg) {
+						taken[r] = false;
+					}
+				}
+				active[a] = active[--active_count];
+			} else {
+				a++;
+			}
+		}
+
+		if (active_count < ALLOCATABLE) {
+			for (size_t r = 0; r < ALLOCATABLE; r++) {
+				if (!taken[r]) {
+					taken[r] = true;
+					location->reg = allocatable[r];
+					break;
+				}
+			}
+			active[active_count++] = v;
+			continue;
+		}
+
+		size_t last = 0;
+		for (size_t a = 1; a < active_count; a++) {
+			if (e->end[active[a]] > e->end[active[last]]) {
+				last = a;
+			}
+		}
+		size_t victim = active[last];
+		if (e->end[victim] > e->end[v]) {
+			location->reg = e->locations[victim].reg;
+			e->locations[victim].kind = L_SLOT;
+			e->locations[victim].slot = spills++;
+			active[last] = v;
+		} else {
+			location->kind = L_SLOT;
+			location->slot = spills++;
+		}
+	}
+
+	if (spills > e->max_spills) {
+		e->max_spills = spills;
+	}
+}
+
+static void use_scratch(struct emitter *e, size_t slots) {
+	if (slots > e->max_scratch) {
+		e->max_scratch = slots;
+	}
+}
+
+// stores the roots an allocation at instruction j hands the collector into the
+// scratch array from slot first: the GC-able values still needed after it,
+// strings tagged the way the collector expects. Returns how many there are.
+static size_t write_roots(struct emitter *e, size_t j, size_t first) {
+	size_t position = j + 1, count = 0;
+	for (size_t v = 0; v < e->block->parameter_count + j; v++) {
+		int kind = e->locations[v].kind;
+		type *t = type_of(e, v);
+		if ((kind != L_REG && kind != L_SLOT) || !is_gc_able(t) ||
+				e->end[v] <= position) {
+			continue;
+		}
+		load(e, RAX, v);
+		if (t->type == T_STRING) {
+			op_rr(e, true, false, OP("\x83"), IMM_OR, RAX);
+			emit(e, 1);
+		}
+		mov_store(e, RSP, 8 * (first + count), RAX);
+		count++;
+	}
+	use_scratch(e, first + count);
+	return count;
+}
+
+// r = the length of the array or string in r
+static void load_length(struct emitter *e, enum reg r, type *t) {
+	mov_load(e, r, r, 0);
+	if (t->type == T_STRING) {
+		// the top bits flag static, slice and interned strings
+		mov_imm(e, RDX, ~STRING_FLAGS);
+		alu(e, ALU_AND, r, RDX);
+	}
+}
+
+static int log2_size(uint64_t size) {
+	switch (size) {
+	case 1: return 0;
+	case 2: return 1;
+	case 4: return 2;
+	case 8: return 3;
+	default:
+		unsupported("elements of this size");
+		return 0;
+	}
+}
+
+// rax = the address of element rcx of the array or string in rax, less 8
+static void element_address(struct emitter *e, type *array_type,
+		type *element) {
+	if (array_type->type == T_STRING) {
+		// a slice keeps a pointer to its first byte in place of the bytes
+		mov_imm(e, RDX, STRING_SLICE_BIT);
+		op_rm(e, true, false, OP("\x85"), RDX, RAX, 0);
+		size_t flat = jcc(e, CC_E);
+		mov_load(e, RAX, RAX, 8);
+		lea(e, RAX, RAX, -8);
+		land(e, flat);
+		alu(e, ALU_ADD, RAX, RCX);
+		return;
+	}
+	int shift = log2_size(type_size(element));
+	if (shift) {
+		shift_imm(e, SHIFT_SHL, RCX, shift);
+	}
+	alu(e, ALU_ADD, RAX, RCX);
+}
+
+// dest = the address of count elements from start in the u8 array, after
+// checking they fit
+static void array_range(struct emitter *e, enum reg dest, size_t array,
+		size_t start, size_t count) {
+	load(e, RAX, array);
+	load(e, RCX, start);
+	load(e, RDX, count);
+	mov_rr(e, R8, RCX);
+	alu(e, ALU_ADD, R8, RDX);
+	mov_load(e, R9, RAX, 0);
+	alu(e, ALU_CMP, R8, R9);
+	size_t fits = jcc(e, CC_BE);
+	mov_rr(e, RDI, RCX);
+	mov_rr(e, RSI, R8);
+	mov_rr(e, RDX, R9);
+	call(e, "bear_range_fail");
+	land(e, fits);
+	lea(e, dest, RAX, 8);
+	alu(e, ALU_ADD, dest, RCX);
+}
+
+// bulk operations on u8 arrays from lib/core.cub and the loop idiom pass
+static void emit_intrinsic(struct emitter *e, code_instruction *ins,
+		size_t k) {
+	size_t *ip = ins->parameters;
+	const char *name = ins->native_call;
+
+	if (strcmp(name, "bear_array_fill") == 0) {
+		// (dest, start, count, value)
+		array_range(e, RDI, ip[1], ip[2], ip[3]);
+		load(e, RSI, ip[4]);
+		load(e, RDX, ip[3]);
+		call(e, "memset");
+		return;
+	}
+
+	// (dest, destStart, src, srcStart, count) and
+	// (left, leftStart, right, rightStart, count)
+	array_range(e, R10, ip[1], ip[2], ip[5]);
+	array_range(e, R11, ip[3], ip[4], ip[5]);
+	mov_rr(e, RDI, R10);
+	mov_rr(e, RSI, R11);
+	load(e, RDX, ip[5]);
+	if (strcmp(name, "bear_array_copy") == 0) {
+		// the ranges may overlap when both are the same array
+		call(e, "memmove");
+		return;
+	}
+	call(e, "memcmp");
+	canonicalize(e, RAX, ins->type);
+	store(e, k, RAX);
+}
+
+static void emit_native(struct emitter *e, code_instruction *ins, size_t k) {
+	if (is_bulk_native(ins->native_call)) {
+		emit_intrinsic(e, ins, k);
+		return;
+	}
+
+	size_t count = ins->parameters[0];
+	if (count > sizeof(argument_regs) / sizeof(argument_regs[0])) {
+		unsupported("natives with more than six arguments");
+	}
+	for (size_t p = 0; p < count; p++) {
+		size_t value = ins->parameters[p + 1];
+		if (is_float(type_of(e, value))) {
+			unsupported("floating point");
+		}
+		// the values live in callee-saved registers and slots, so this can't
+		// overwrite one that's still to be loaded
+		load(e, argument_regs[p], value);
+	}
+	call(e, ins->native_call);
+	if (e->locations[k].kind != L_NONE) {
+		canonicalize(e, RAX, ins->type);
+		store(e, k, RAX);
+	}
+}
+
+// the inline bump of the LLVM backend, falling back on bear_new
+static void emit_new(struct emitter *e, code_instruction *ins, size_t j) {
+	size_t k = j + e->block->parameter_count;
+	size_t index = ins->type->struct_index;
+	uint64_t length = e->layouts[index].size;
+	uint64_t size = 8 + ((length + 7) & ~(uint64_t) 7);
+
+	global_address(e, RSI, "bear_heap_cursor");
+	mov_load(e, RAX, RSI, 0);
+	test(e, RAX, RAX);
+	size_t empty = jcc(e, CC_E);
+	global_address(e, RDX, "bear_heap_limit");
+	mov_load(e, RDX, RDX, 0);
+	alu(e, ALU_SUB, RDX, RAX);
+	alu_imm(e, IMM_CMP, RDX, (int32_t) size);
+	size_t full = jcc(e, CC_B);
+	lea(e, RDX, RAX, (int32_t) size);
+	mov_store(e, RSI, 0, RDX);
+	// the header: the metastruct with the current unreachable mark
+	data_address(e, RDX, e->metas[index]);
+	global_address(e, RCX, "unreachable");
+	op_rm(e, false, false, OP("\x8b"), RCX, RCX, 0);
+	alu(e, ALU_OR, RDX, RCX);
+	mov_store(e, RAX, 0, RDX);
+	lea(e, RAX, RAX, 8);
+	size_t bumped = jmp(e);
+
+	land(e, empty);
+	land(e, full);
+	size_t count = write_roots(e, j, 0);
+	data_address(e, RDI, e->metas[index]);
+	mov_imm(e, RSI, count);
+	lea(e, RDX, RSP, 0);
+	call(e, "bear_new");
+
+	// every field is stored before it is read, but the collector may look first
+	land(e, bumped);
+	if (length) {
+		mov_rr(e, RDI, RAX);
+		mov_rr(e, RDX, RAX);
+		mov_imm(e, RAX, 0);
+		mov_imm(e, RCX, (length + 7) / 8);
+		emit_bytes(e, OP("\xf3\x48\xab"));
+		mov_rr(e, RAX, RDX);
+	}
+	store(e, k, RAX);
+}
+
+static void emit_new_array(struct emitter *e, code_instruction *ins,
+		size_t j) {
+	size_t k = j + e->block->parameter_count;
+	type *et = ins->type->arraytype;
+	int kind = et->type == T_STRING ? ARRAY_STRING
+		: is_gc_able(et) ? ARRAY_OBJECT : ARRAY_PRIMITIVE;
+
+	size_t count = write_roots(e, j, 0);
+	mov_imm(e, RDI, type_size(et));
+	mov_imm(e, RSI, kind);
+	load(e, RDX, ins->parameters[0]);
+	mov_imm(e, RCX, count);
+	lea(e, R8, RSP, 0);
+	call(e, "bear_new_array");
+	store(e, k, RAX);
+}
+
+static void emit_concat(struct emitter *e, code_instruction *ins, size_t j) {
+	size_t k = j + e->block->parameter_count;
+	size_t parts = ins->parameters[0];
+
+	// the runtime treats the parts as roots too
+	for (size_t p = 0; p < parts; p++) {
+		load(e, RAX, ins->parameters[p + 1]);
+		mov_store(e, RSP, 8 * p, RAX);
+	}
+	size_t count = write_roots(e, j, parts);
+	lea(e, RDI, RSP, 0);
+	mov_imm(e, RSI, parts);
+	mov_imm(e, RDX, count);
+	lea(e, RCX, RSP, 8 * parts);
+	call(e, ins->operation.concat_type == O_APPEND ? "bear_string_append"
+		: "bear_string_concat");
+	store(e, k, RAX);
+}
+
+static void emit_compare(struct emitter *e, code_instruction *ins, size_t k) {
+	size_t *ip = ins->parameters;
+	type *t = type_of(e, ip[0]);
+	bool is_signed = is_signed_type(t);
+	enum cc cc;
+	switch (ins->operation.compare_type) {
+	case O_EQ: cc = CC_E; break;
+	case O_NE: cc = CC_NE; break;
+	case O_GT: cc = is_signed ? CC_G : CC_A; break;
+	case O_GTE: cc = is_signed ? CC_GE : CC_AE; break;
+	case O_LT: cc = is_signed ? CC_L : CC_B; break;
+	case O_LTE: cc = is_signed ? CC_LE : CC_BE; break;
+	default: abort();
+	}
+
+	if (is_float(t)) {
+		unsupported("floating point");
+	}
+	if (t->type == T_STRING) {
+		load(e, RDI, ip[0]);
+		load(e, RSI, ip[1]);
+		if (cc == CC_E || cc == CC_NE) {
+			call(e, "bear_streq");
+			extend(e, RAX, 1, false);
+			if (cc == CC_NE) {
+				alu_imm(e, IMM_XOR, RAX, 1);
+			}
+		} else {
+			// orders by the sign of the result
+			call(e, "bear_strcmp");
+			extend(e, RAX, 4, true);
+			test(e, RAX, RAX);
+			setcc(e, cc == CC_A ? CC_G : cc == CC_AE ? CC_GE
+				: cc == CC_B ? CC_L : CC_LE, RAX);
+		}
+		store(e, k, RAX);
+		return;
+	}
+
+	load(e, RAX, ip[0]);
+	load(e, RCX, ip[1]);
+	alu(e, ALU_CMP, RAX, RCX);
+	setcc(e, cc, RAX);
+	store(e, k, RAX);
+}
+
+static void emit_numeric(struct emitter *e, code_instruction *ins, size_t k) {
+	size_t *ip = ins->parameters;
+	if (is_float(ins->type)) {
+		unsupported("floating point");
+	}
+
+	load(e, RAX, ip[0]);
+	load(e, RCX, ip[1]);
+	switch (ins->operation.numeric_type) {
+	case O_ADD: alu(e, ALU_ADD, RAX, RCX); break;
+	case O_BAND: alu(e, ALU_AND, RAX, RCX); break;
+	case O_BOR: alu(e, ALU_OR, RAX, RCX); break;
+	case O_BXOR: alu(e, ALU_XOR, RAX, RCX); break;
+	case O_SUB: alu(e, ALU_SUB, RAX, RCX); break;
+	case O_MUL:
+		op_rr(e, true, false, OP("\x0f\xaf"), RAX, RCX);
+		break;
+	case O_DIV:
+	case O_MOD: {
+		// unsigned at the operands' width, as the LLVM backend divides
+		uint64_t size = type_size(ins->type);
+		extend(e, RAX, size, false);
+		extend(e, RCX, size, false);
+		mov_imm(e, RDX, 0);
+		unary(e, UNARY_DIV, RCX);
+		if (ins->operation.numeric_type == O_MOD) {
+			mov_rr(e, RAX, RDX);
+		}
+	} break;
+	default:
+		abort();
+	}
+	canonicalize(e, RAX, ins->type);
+	store(e, k, RAX);
+}
+
+static void emit_shift(struct emitter *e, code_instruction *ins, size_t k) {
+	size_t *ip = ins->parameters;
+	uint64_t size = type_size(ins->type);
+
+	load(e, RAX, ip[0]);
+	load(e, RCX, ip[1]);
+	switch (ins->operation.shift_type) {
+	case O_LSHIFT:
+		shift_cl(e, SHIFT_SHL, RAX);
+		break;
+	case O_RSHIFT:
+		extend(e, RAX, size, false);
+		shift_cl(e, SHIFT_SHR, RAX);
+		break;
+	case O_ASHIFT:
+		extend(e, RAX, size, true);
+		shift_cl(e, SHIFT_SAR, RAX);
+		break;
+	default:
+		abort();
+	}
+	canonicalize(e, RAX, ins->type);
+	store(e, k, RAX);
+}
+
+static void emit_cast(struct emitter *e, code_instruction *ins, size_t k) {
+	type *from = type_of(e, ins->parameters[0]);
+	if (is_float(from) || is_float(ins->type)) {
+		unsupported("floating point");
+	}
+
+	load(e, RAX, ins->parameters[0]);
+	switch (ins->operation.cast_type) {
+	case O_UPCAST:
+	case O_DOWNCAST:
+	case O_REINTERPRET:
+		break;
+	case O_SIGN_EXTEND:
+		extend(e, RAX, type_size(from), true);
+		canonicalize(e, RAX, ins->type);
+		break;
+	case O_ZERO_EXTEND:
+		extend(e, RAX, type_size(from), false);
+		canonicalize(e, RAX, ins->type);
+		break;
+	case O_TRUNCATE:
+		canonicalize(e, RAX, ins->type);
+		break;
+	default:
+		unsupported("floating point");
+	}
+	store(e, k, RAX);
+}
+
+static void emit_instruction(struct emitter *e, size_t j) {
+	code_block *block = e->block;
+	code_instruction *ins = &block->instructions[j];
+	size_t k = j + block->parameter_count;
+	size_t *ip = ins->parameters;
+
+	switch (ins->operation.type) {
+	case O_BITWISE_NOT:
+		load(e, RAX, ip[0]);
+		unary(e, UNARY_NOT, RAX);
+		canonicalize(e, RAX, ins->type);
+		store(e, k, RAX);
+		break;
+	case O_BLOCKREF:
+		if (e->locations[k].kind == L_NONE) {
+			// only ever the target of a direct jump
+			break;
+		}
+		jump_to_block(e, op_rip(e, true, OP("\x8d"), RAX), ins->block_index);
+		store(e, k, RAX);
+		break;
+	case O_BOUNDS_CHECK: {
+		// a negative signed index wraps around to a huge unsigned one
+		load(e, RAX, ip[0]);
+		load_length(e, RAX, type_of(e, ip[0]));
+		load(e, RCX, ip[1]);
+		alu(e, ALU_CMP, RCX, RAX);
+		size_t inside = jcc(e, CC_B);
+		mov_rr(e, RDI, RCX);
+		mov_rr(e, RSI, RAX);
+		call(e, "bear_bounds_fail");
+		land(e, inside);
+	} break;
+	case O_CAST:
+		emit_cast(e, ins, k);
+		break;
+	case O_COMPARE:
+		emit_compare(e, ins, k);
+		break;
+	case O_GET_FIELD: {
+		type *t = type_of(e, ip[0]);
+		struct layout *layout = &e->layouts[t->struct_index];
+		load(e, RAX, ip[0]);
+		load_sized(e, RAX, RAX, (int32_t) layout->offset[ip[1]],
+			type_size(ins->type), is_signed_type(ins->type));
+		store(e, k, RAX);
+	} break;
+	case O_GET_INDEX:
+		load(e, RAX, ip[0]);
+		load(e, RCX, ip[1]);
+		element_address(e, type_of(e, ip[0]), ins->type);
+		load_sized(e, RAX, RAX, 8, type_size(ins->type),
+			is_signed_type(ins->type));
+		store(e, k, RAX);
+		break;
+	case O_GET_LENGTH:
+		load(e, RAX, ip[0]);
+		load_length(e, RAX, type_of(e, ip[0]));
+		extend(e, RAX, 4, false);
+		store(e, k, RAX);
+		break;
+	case O_GET_SYMBOL:
+		load(e, RAX, ip[0]);
+		store(e, k, RAX);
+		break;
+	case O_LITERAL:
+		// loaded where it's used
+		break;
+	case O_LOGIC:
+		load(e, RAX, ip[0]);
+		test(e, RAX, RAX);
+		setcc(e, CC_NE, RAX);
+		load(e, RCX, ip[1]);
+		test(e, RCX, RCX);
+		setcc(e, CC_NE, RCX);
+		switch (ins->operation.logic_type) {
+		case O_AND: alu(e, ALU_AND, RAX, RCX); break;
+		case O_OR: alu(e, ALU_OR, RAX, RCX); break;
+		case O_XOR: alu(e, ALU_XOR, RAX, RCX); break;
+		default: abort();
+		}
+		store(e, k, RAX);
+		break;
+	case O_NATIVE:
+		emit_native(e, ins, k);
+		break;
+	case O_NEGATE:
+		if (is_float(ins->type)) {
+			unsupported("floating point");
+		}
+		load(e, RAX, ip[0]);
+		unary(e, UNARY_NEG, RAX);
+		canonicalize(e, RAX, ins->type);
+		store(e, k, RAX);
+		break;
+	case O_NEW:
+		emit_new(e, ins, j);
+		break;
+	case O_NEW_ARRAY:
+		emit_new_array(e, ins, j);
+		break;
+	case O_NOT:
+		load(e, RAX, ip[0]);
+		test(e, RAX, RAX);
+		setcc(e, CC_E, RAX);
+		store(e, k, RAX);
+		break;
+	case O_NUMERIC:
+		emit_numeric(e, ins, k);
+		break;
+	case O_SET_FIELD: {
+		type *t = type_of(e, ip[0]);
+		code_struct *s = get_code_struct(e->system, t->struct_index);
+		load(e, RAX, ip[0]);
+		load(e, RCX, ip[2]);
+		store_sized(e, RAX, (int32_t) e->layouts[t->struct_index].offset[ip[1]],
+			RCX, type_size(s->fields[ip[1]].field_type));
+	} break;
+	case O_SET_INDEX: {
+		type *et = type_of(e, ip[0])->arraytype;
+		load(e, RAX, ip[0]);
+		load(e, RCX, ip[1]);
+		element_address(e, type_of(e, ip[0]), et);
+		load(e, RDX, ip[2]);
+		store_sized(e, RAX, 8, RDX, type_size(et));
+	} break;
+	case O_SHIFT:
+		emit_shift(e, ins, k);
+		break;
+	case O_STR_CONCAT:
+		emit_concat(e, ins, j);
+		break;
+	case O_IDENTITY:
+		unsupported("identity checking");
+		break;
+	case O_INSTANCEOF:
+		unsupported("instanceof checking");
+		break;
+	case O_SET_LENGTH:
+		unsupported("array resizing");
+		break;
+	case O_CALL:
+	case O_FUNCTION:
+	case O_NUMERIC_ASSIGN:
+	case O_POSTFIX:
+	case O_SET_SYMBOL:
+	case O_SHIFT_ASSIGN:
+	case O_STR_CONCAT_ASSIGN:
+	case O_TERNARY:
+		abort();
+	}
+}
+
+static void emit_tail(struct emitter *e) {
+	code_block *block = e->block;
+	code_terminal *tail = &block->tail;
+
+	if (block->is_final) {
+		jump_to_block(e, jmp(e), e->system->block_count);
+		return;
+	}
+
+	if (tail->parameter_count > e->pass_slots) {
+		abort();
+	}
+	for (size_t p = 0; p < tail->parameter_count; p++) {
+		load(e, RAX, tail->parameters[p]);
+		mov_store(e, RBP, slot_disp(p), RAX);
+	}
+
+	if (is_static_tail(block)) {
+		size_t first = static_target(block, tail->first_block);
+		if (tail->type == BRANCH) {
+			load(e, RAX, tail->condition);
+			test(e, RAX, RAX);
+			jump_to_block(e, jcc(e, CC_NE), first);
+			first = static_target(block, tail->second_block);
+		}
+		jump_to_block(e, jmp(e), first);
+		return;
+	}
+
+	if (tail->type == BRANCH) {
+		load(e, RCX, tail->condition);
+		load(e, RAX, tail->first_block);
+		test(e, RCX, RCX);
+		size_t taken = jcc(e, CC_NE);
+		load(e, RAX, tail->second_block);
+		land(e, taken);
+	} else {
+		load(e, RAX, tail->first_block);
+	}
+	op_rr(e, false, false, OP("\xff"), 4, RAX);
+}
+
+static void emit_block(struct emitter *e, size_t i) {
+	code_block *block = get_code_block(e->system, i);
+	size_t count = block->parameter_count + block->instruction_count;
+	e->block = block;
+	e->locations = xmalloc(sizeof(struct location) * (count + 1));
+	e->start = xmalloc(sizeof(size_t) * (count + 1));
+	e->end = xmalloc(sizeof(size_t) * (count + 1));
+	allocate_registers(e);
+
+	e->labels[i] = e->text->used;
+	for (size_t p = 0; p < block->parameter_count; p++) {
+		if (is_float(block->parameters[p].field_type)) {
+			unsupported("floating point");
+		}
+		mov_load(e, RAX, RBP, slot_disp(p));
+		store(e, p, RAX);
+	}
+	for (size_t j = 0; j < block->instruction_count; j++) {
+		emit_instruction(e, j);
+	}
+	emit_tail(e);
+
+	free(e->locations);
+	free(e->start);
+	free(e->end);
+}
+
+static void write_data(struct emitter *e) {
+	code_system *system = e->system;
+	struct elf_object *object = &e->object;
+	buffer *data = &object->sections[ELF_DATA];
+
+	// the header keeps the mark in the low bits of these addresses
+	e->metas = xmalloc(sizeof(uint64_t) * (system->struct_count + 1));
+	for (size_t i = 0; i < system->struct_count; i++) {
+		struct layout *layout = &e->layouts[i];
+		struct metastruct meta = {
+			(uint32_t) layout->size, (uint32_t) i, (uint32_t) layout->refs,
+			(uint16_t) layout->object_refs, (uint16_t) layout->string_refs,
+			(uint32_t) layout->narrow, (uint32_t) layout->narrow_refs, NULL
+		};
+		e->metas[i] = elf_align(object, ELF_DATA, 8);
+		buffer_append_mem(data, (char*) &meta, sizeof(meta));
+	}
+	// the parent may come later
+	for (size_t i = 0; i < system->struct_count; i++) {
+		code_struct *str = get_code_struct(system, i);
+		if (str->has_parent) {
+			elf_relocate(object, ELF_DATA,
+				e->metas[i] + offsetof(struct metastruct, parent), R_X86_64_64,
+				elf_section_symbol(ELF_DATA), (int64_t) e->metas[str->parent_index]);
+		}
+	}
+
+	// one constant per distinct literal, laid out like a static heap string
+	e->strings = xmalloc(sizeof(uint64_t) * (system->string_count + 1));
+	for (size_t n = 0; n < system->string_count; n++) {
+		char *value = system->strings[n];
+		uint64_t length = strlen(value) | STRING_STATIC;
+		e->strings[n] = elf_align(object, ELF_DATA, 8);
+		buffer_append_mem(data, (char*) &length, 8);
+		buffer_append_mem(data, value, strlen(value));
+	}
+
+	// the runtime seeds its intern table with these, see bear_string_intern
+	uint64_t literals = elf_align(object, ELF_DATA, 8);
+	elf_define(object, "bear_literals", ELF_DATA, literals, false);
+	for (size_t n = 0; n < system->string_count; n++) {
+		elf_relocate(object, ELF_DATA, data->used, R_X86_64_64,
+			elf_section_symbol(ELF_DATA), (int64_t) e->strings[n]);
+		uint64_t zero = 0;
+		buffer_append_mem(data, (char*) &zero, 8);
+	}
+	if (system->string_count == 0) {
+		uint64_t zero = 0;
+		buffer_append_mem(data, (char*) &zero, 8);
+	}
+	uint64_t count = system->string_count;
+	elf_define(object, "bear_literal_count", ELF_DATA, data->used, false);
+	buffer_append_mem(data, (char*) &count, 8);
+}
+
+// blocks 0 runs first, and the rest are reachable when a reachable block
+// refers to them
+static void find_reachable(code_system *system, bool *reachable) {
+	reachable[0] = true;
+	bool changed;
+	do {
+		changed = false;
+		for (size_t i = 0; i < system->block_count; i++) {
+			if (!reachable[i]) {
+				continue;
+			}
+			code_block *block = get_code_block(system, i);
+			for (size_t j = 0; j < block->instruction_count; j++) {
+				code_instruction *ins = &block->instructions[j];
+				if (ins->operation.type == O_BLOCKREF && !reachable[ins->block_index]) {
+					reachable[ins->block_index] = changed = true;
+				}
+			}
+		}
+	} while (changed);
+}
+
+void backend_write_x86(code_system *system, const char *filename) {
+	if (compressed_refs) {
+		unsupported("compressed references");
+	}
+
+	struct emitter e = {
+		.system = system,
+		.layouts = layout_structs(system),
+		.fixup_count = 0,
+		.fixup_cap = 0,
+		.fixups = NULL,
+		.pass_slots = 0,
+		.max_spills = 0,
+		.max_scratch = 0
+	};
+	elf_init(&e.object);
+	e.text = &e.object.sections[ELF_TEXT];
+	e.labels = xmalloc(sizeof(size_t) * (system->block_count + 1));
+	write_data(&e);
+
+	bool *reachable = calloc(system->block_count, sizeof(bool));
+	if (reachable == NULL) {
+		fputs("alloc failed\n", stderr);
+		exit(1);
+	}
+	find_reachable(system, reachable);
+	for (size_t i = 0; i < system->block_count; i++) {
+		size_t params = get_code_block(system, i)->parameter_count;
+		if (reachable[i] && params > e.pass_slots) {
+			e.pass_slots = params;
+		}
+	}
+
+	elf_define(&e.object, "main", ELF_TEXT, 0, true);
+	static const enum reg saved[] = {RBX, R12, R13, R14, R15};
+	rex(&e, false, false, 0, RBP);
+	emit(&e, 0x50 | RBP);
+	mov_rr(&e, RBP, RSP);
+	for (size_t r = 0; r < ALLOCATABLE; r++) {
+		rex(&e, false, false, 0, saved[r]);
+		emit(&e, 0x50 | (saved[r] & 7));
+	}
+	op_rr(&e, true, false, OP("\x81"), IMM_SUB, RSP);
+	size_t frame = e.text->used;
+	emit32(&e, 0);
+
+	// block 0 takes no parameters, and runs first
+	for (size_t i = 0; i < system->block_count; i++) {
+		if (reachable[i]) {
+			emit_block(&e, i);
+		}
+	}
+
+	e.labels[system->block_count] = e.text->used;
+	mov_imm(&e, RAX, 0);
+	lea(&e, RSP, RBP, -SAVED_BYTES);
+	for (size_t r = ALLOCATABLE; r-- > 0;) {
+		rex(&e, false, false, 0, saved[r]);
+		emit(&e, 0x58 | (saved[r] & 7));
+	}
+	emit(&e, 0x58 | RBP);
+	emit(&e, 0xC3);
+
+	// keeps rsp 16-byte aligned at calls, with the return address and the six
+	// saved registers above the frame
+	size_t frame_size = 8 * (e.pass_slots + e.max_spills + e.max_scratch);
+	frame_size = ((frame_size + 15) & ~(size_t) 15) + 8;
+	patch32(&e, frame, (uint32_t) frame_size);
+
+	for (size_t f = 0; f < e.fixup_count; f++) {
+		patch_relative(&e, e.fixups[f].position, e.labels[e.fixups[f].block]);
+	}
+
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "cub: error opening output-file\n");
+		exit(1);
+	}
+	elf_write(&e.object, out);
+	fclose(out);
+
+	free(reachable);
+	free(e.labels);
+	free(e.fixups);
+	free(e.metas);
+	free(e.strings);
+	elf_free(&e.object);
+	free_layouts(system, e.layouts);
+}
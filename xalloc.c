@@ -36,7 +36,9 @@ void resize(const size_t used, size_t *total, void **ptr, size_t size) {
   if (t == 0) {
     *total = t = 16;
   } else if (used >= t) {
-    size_t n = t;
+    // the growth step below never moves past a capacity of one, which shrunk
+    // arrays can have
+    size_t n = t < 16 ? 16 : t;
     while (used >= n) {
       // not converts to true/false, so cast is needed to prevent warning
       const size_t mask = -(size_t) !(n & (n - 1));